@@ -0,0 +1,164 @@
+#!/usr/bin/env python3
+#
+# ShiftX3 firmware
+#
+# Copyright (C) 2018 Autosport Labs
+#
+# This file is part of the Race Capture firmware suite
+#
+# This is free software: you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This software is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+#
+# See the GNU General Public License for more details. You should
+# have received a copy of the GNU General Public License along with
+# this code. If not, see <http://www.gnu.org/licenses/>.
+
+"""
+Decode the ShiftX3 log streamed over CAN.
+
+Log records arrive on CAN ID base + 6, split over several frames. The
+first data byte of each frame holds the record sequence number in bits
+0-3 and the fragment index in bits 4-7; the rest is the next 7 bytes of
+the record, laid out as in the serial log (see log_decode.py).
+
+Logging over CAN is off until enabled with the Set Log Config message.
+
+usage: can_log_decode.py [-i interface] [-f candump.log] [-b base_id] [-t tick_hz] build/main.elf
+
+Listens on SocketCAN interface can0 unless another interface, or a log
+file written by candump -l, is given.
+"""
+
+import getopt
+import re
+import socket
+import struct
+import sys
+
+import log_decode
+
+DEFAULT_BASE_ID = 0xE3600
+API_LOG_RECORD = 6
+FRAGMENT_BYTES = 7
+
+CAN_EFF_FLAG = 0x80000000
+CAN_EFF_MASK = 0x1FFFFFFF
+CAN_FRAME = struct.Struct('=IB3x8s')
+
+CANDUMP_LINE = re.compile(r'\S+\s+\S+\s+([0-9A-Fa-f]+)#([0-9A-Fa-f]*)')
+
+
+class Reassembler(object):
+    """Collects the fragments of each record, discarding incomplete ones"""
+
+    def __init__(self):
+        self.sequence = None
+        self.record = bytearray()
+        self.lost = 0
+
+    def add(self, data):
+        """Add a frame's data; returns a complete record or None"""
+        if not data:
+            return None
+        sequence = data[0] & 0x0F
+        fragment = data[0] >> 4
+        if fragment == 0:
+            if self.record:
+                self.lost += 1
+            self.sequence = sequence
+            self.record = bytearray()
+        elif sequence != self.sequence or len(self.record) != fragment * FRAGMENT_BYTES:
+            # a frame of this record went missing; count it once
+            if sequence != self.sequence or self.record:
+                self.lost += 1
+            self.sequence = sequence
+            self.record = bytearray()
+            return None
+        self.record += data[1:]
+
+        if len(self.record) < 4:
+            return None
+        header, = struct.unpack_from('<I', self.record)
+        length = log_decode.record_length(header)
+        if len(self.record) < length:
+            return None
+        record = bytes(self.record[:length])
+        self.sequence = None
+        self.record = bytearray()
+        return record
+
+
+def socketcan_frames(interface):
+    s = socket.socket(socket.AF_CAN, socket.SOCK_RAW, socket.CAN_RAW)
+    s.bind((interface,))
+    while True:
+        can_id, dlc, data = CAN_FRAME.unpack(s.recv(CAN_FRAME.size))
+        if can_id & CAN_EFF_FLAG:
+            yield can_id & CAN_EFF_MASK, data[:dlc]
+
+
+def candump_frames(path):
+    with open(path) as f:
+        for line in f:
+            m = CANDUMP_LINE.match(line.strip())
+            # extended frames are logged with 8 hex digit ids
+            if m and len(m.group(1)) == 8:
+                yield int(m.group(1), 16), bytes.fromhex(m.group(2))
+
+
+def usage():
+    print(__doc__)
+    sys.exit(2)
+
+
+def main():
+    try:
+        opts, args = getopt.getopt(sys.argv[1:], 'hi:f:b:t:')
+    except getopt.GetoptError:
+        usage()
+    interface = 'can0'
+    path = None
+    base_id = DEFAULT_BASE_ID
+    tick_hz = log_decode.DEFAULT_TICK_HZ
+    for o, a in opts:
+        if o == '-i':
+            interface = a
+        elif o == '-f':
+            path = a
+        elif o == '-b':
+            base_id = int(a, 0)
+        elif o == '-t':
+            tick_hz = int(a)
+        else:
+            usage()
+    if len(args) != 1:
+        usage()
+
+    formats = log_decode.read_log_formats(args[0])
+    frames = candump_frames(path) if path else socketcan_frames(interface)
+    reassembler = Reassembler()
+    lost = 0
+    for can_id, data in frames:
+        if can_id != base_id + API_LOG_RECORD:
+            continue
+        record = reassembler.add(data)
+        if reassembler.lost != lost:
+            print('%d incomplete log records discarded' % (reassembler.lost - lost))
+            lost = reassembler.lost
+        if record is None:
+            continue
+        try:
+            print(log_decode.decode_record(formats, record, tick_hz))
+        except ValueError as e:
+            print('undecodable record: %s' % e)
+        sys.stdout.flush()
+
+
+if __name__ == '__main__':
+    main()
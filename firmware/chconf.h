@@ -364,6 +364,19 @@
  */
 #define CH_DBG_ENABLE_TRACE                 FALSE
 
+/**
+ * @brief   Runtime profiling telemetry.
+ * @details Set by building with USE_PROFILING=yes. Fills the thread stacks
+ *          so their high water marks can be measured and accounts the run
+ *          time of each thread at every context switch.
+ * @note    @p CH_DBG_THREADS_PROFILING is not usable in tickless mode and
+ *          @p CH_DBG_STATISTICS needs a realtime counter the Cortex-M0
+ *          lacks, so the run time is accounted by the application instead.
+ */
+#if !defined(SHIFTX3_PROFILING)
+#define SHIFTX3_PROFILING                   FALSE
+#endif
+
 /**
  * @brief   Debug option, stack checks.
  * @details If enabled then a runtime stack check is performed.
@@ -384,7 +397,7 @@
  *
  * @note    The default is @p FALSE.
  */
-#define CH_DBG_FILL_THREADS                 FALSE
+#define CH_DBG_FILL_THREADS                 SHIFTX3_PROFILING
 
 /**
  * @brief   Debug option, threads profiling.
@@ -410,8 +423,21 @@
  * @brief   Threads descriptor structure extension.
  * @details User fields added to the end of the @p thread_t structure.
  */
+#if (SHIFTX3_PROFILING == TRUE) && !defined(_FROM_ASM_)
+struct ch_thread;
+void profiling_context_switch(struct ch_thread *otp);
+#define PROFILING_THREAD_FIELDS         uint32_t p_run_cycles;
+#define PROFILING_THREAD_INIT(tp)       (tp)->p_run_cycles = 0
+#define PROFILING_CONTEXT_SWITCH(otp)   profiling_context_switch(otp)
+#else
+#define PROFILING_THREAD_FIELDS
+#define PROFILING_THREAD_INIT(tp)
+#define PROFILING_CONTEXT_SWITCH(otp)
+#endif
+
 #define CH_CFG_THREAD_EXTRA_FIELDS                                          \
-  /* Add threads custom fields here.*/
+  /* Add threads custom fields here.*/                                      \
+  PROFILING_THREAD_FIELDS
 
 /**
  * @brief   Threads initialization hook.
@@ -422,6 +448,7 @@
  */
 #define CH_CFG_THREAD_INIT_HOOK(tp) {                                       \
   /* Add threads initialization code here.*/                                \
+  PROFILING_THREAD_INIT(tp);                                                \
 }
 
 /**
@@ -442,6 +469,7 @@
  */
 #define CH_CFG_CONTEXT_SWITCH_HOOK(ntp, otp) {                              \
   /* Context switch code here.*/                                            \
+  PROFILING_CONTEXT_SWITCH(otp);                                            \
 }
 
 /**
@@ -0,0 +1,151 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * ChibiOS/RT API subset for the host build, backed by the simulator in
+ * sim_kernel.c. Only what the application sources use is provided; the
+ * kernel configuration (tick rate etc.) comes from the firmware's own
+ * chconf.h so the host build keeps the target's timing.
+ */
+
+#ifndef CH_H_
+#define CH_H_
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define FALSE 0
+#define TRUE 1
+
+#include "chconf.h"
+
+#define CH_KERNEL_VERSION "host"
+
+typedef uint32_t systime_t;
+typedef int32_t msg_t;
+typedef uint32_t eventmask_t;
+typedef uint32_t eventflags_t;
+typedef int32_t tprio_t;
+typedef uint64_t stkalign_t;
+
+#define MSG_OK 0
+#define MSG_TIMEOUT -1
+#define MSG_RESET -2
+
+#define TIME_IMMEDIATE ((systime_t)0)
+#define TIME_INFINITE ((systime_t)-1)
+
+#define IDLEPRIO 1
+#define LOWPRIO 2
+#define NORMALPRIO 128
+#define HIGHPRIO 255
+
+#define ALL_EVENTS ((eventmask_t)-1)
+#define EVENT_MASK(eid) ((eventmask_t)1 << (eventmask_t)(eid))
+
+#define S2ST(sec) ((systime_t)((uint32_t)(sec) * (uint32_t)CH_CFG_ST_FREQUENCY))
+#define MS2ST(msec) ((systime_t)((((uint32_t)(msec)) * ((uint32_t)CH_CFG_ST_FREQUENCY) + 999UL) / 1000UL))
+#define US2ST(usec) ((systime_t)((((uint32_t)(usec)) * ((uint32_t)CH_CFG_ST_FREQUENCY) + 999999UL) / 1000000UL))
+#define ST2MS(n) (((n) * 1000UL + CH_CFG_ST_FREQUENCY - 1UL) / CH_CFG_ST_FREQUENCY)
+#define ST2US(n) (((n) * 1000000UL + CH_CFG_ST_FREQUENCY - 1UL) / CH_CFG_ST_FREQUENCY)
+
+#define chDbgAssert(c, r) ((void)(c))
+
+/* Threads */
+typedef struct sim_thread thread_t;
+typedef void (*tfunc_t)(void *p);
+
+#define THD_WORKING_AREA(s, n) stkalign_t s[((n) + sizeof(stkalign_t) - 1) / sizeof(stkalign_t)]
+#define THD_FUNCTION(tname, arg) void tname(void *arg)
+
+thread_t *chThdCreateStatic(void *wsp, size_t size, tprio_t prio, tfunc_t pf, void *arg);
+thread_t *chThdGetSelfX(void);
+void chThdSleep(systime_t time);
+#define chThdSleepMilliseconds(msec) chThdSleep(MS2ST(msec))
+#define chThdSleepMicroseconds(usec) chThdSleep(US2ST(usec))
+void chRegSetThreadName(const char *name);
+
+/* System; only one simulated thread runs at a time, so locking is a no-op */
+void chSysInit(void);
+#define chSysLock()
+#define chSysUnlock()
+#define chSysLockFromISR()
+#define chSysUnlockFromISR()
+
+/* Virtual timers */
+typedef void (*vtfunc_t)(void *p);
+typedef struct virtual_timer {
+    struct virtual_timer *next;
+    uint64_t due_us;
+    vtfunc_t func;
+    void *par;
+    bool armed;
+} virtual_timer_t;
+
+systime_t chVTGetSystemTimeX(void);
+#define chVTGetSystemTime() chVTGetSystemTimeX()
+#define chVTTimeElapsedSinceX(start) ((systime_t)(chVTGetSystemTimeX() - (start)))
+void chVTObjectInit(virtual_timer_t *vtp);
+void chVTSetI(virtual_timer_t *vtp, systime_t delay, vtfunc_t vtfunc, void *par);
+#define chVTSet(vtp, delay, vtfunc, par) chVTSetI(vtp, delay, vtfunc, par)
+void chVTResetI(virtual_timer_t *vtp);
+#define chVTReset(vtp) chVTResetI(vtp)
+#define chVTIsArmedI(vtp) ((vtp)->armed)
+
+/* Events */
+typedef struct event_listener {
+    struct event_listener *next;
+    thread_t *listener;
+    eventmask_t events;
+    eventflags_t flags;
+    eventflags_t wflags;
+} event_listener_t;
+
+typedef struct event_source {
+    event_listener_t *next;
+} event_source_t;
+
+void chEvtObjectInit(event_source_t *esp);
+void chEvtRegisterMaskWithFlags(event_source_t *esp, event_listener_t *elp, eventmask_t events, eventflags_t wflags);
+#define chEvtRegisterMask(esp, elp, events) chEvtRegisterMaskWithFlags(esp, elp, events, (eventflags_t)-1)
+#define chEvtRegister(esp, elp, event) chEvtRegisterMask(esp, elp, EVENT_MASK(event))
+void chEvtUnregister(event_source_t *esp, event_listener_t *elp);
+eventflags_t chEvtGetAndClearFlags(event_listener_t *elp);
+void chEvtBroadcastFlagsI(event_source_t *esp, eventflags_t flags);
+void chEvtSignalI(thread_t *tp, eventmask_t events);
+void chEvtSignal(thread_t *tp, eventmask_t events);
+eventmask_t chEvtWaitAnyTimeout(eventmask_t events, systime_t time);
+#define chEvtWaitAny(events) chEvtWaitAnyTimeout(events, TIME_INFINITE)
+
+/* Binary semaphores */
+typedef struct {
+    bool taken;
+} binary_semaphore_t;
+
+#define _BSEMAPHORE_DATA(name, taken) {taken}
+#define BSEMAPHORE_DECL(name, taken) binary_semaphore_t name = _BSEMAPHORE_DATA(name, taken)
+void chBSemObjectInit(binary_semaphore_t *bsp, bool taken);
+msg_t chBSemWaitTimeout(binary_semaphore_t *bsp, systime_t time);
+#define chBSemWait(bsp) chBSemWaitTimeout(bsp, TIME_INFINITE)
+void chBSemSignalI(binary_semaphore_t *bsp);
+void chBSemSignal(binary_semaphore_t *bsp);
+
+#endif /* CH_H_ */
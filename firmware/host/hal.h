@@ -0,0 +1,294 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * ChibiOS HAL subset for the host build: the driver types and calls the
+ * application uses, with configuration structures laid out as on the
+ * STM32 so the firmware's initializers compile unchanged. The drivers
+ * are simulated in sim_hal.c.
+ */
+
+#ifndef HAL_H_
+#define HAL_H_
+#include "ch.h"
+#include "stm32f042x6.h"
+
+#define STM32_PCLK 48000000
+
+/* PAL */
+typedef struct {
+    volatile uint32_t IDR;
+    volatile uint32_t ODR;
+} stm32_gpio_t;
+typedef stm32_gpio_t *ioportid_t;
+typedef uint32_t ioportmask_t;
+typedef uint32_t iomode_t;
+
+extern stm32_gpio_t sim_gpioa;
+extern stm32_gpio_t sim_gpiob;
+#define GPIOA (&sim_gpioa)
+#define GPIOB (&sim_gpiob)
+
+#define PAL_LOW 0U
+#define PAL_HIGH 1U
+#define PAL_PORT_BIT(n) ((ioportmask_t)(1U << (n)))
+
+#define PAL_STM32_MODE_MASK (3U << 0U)
+#define PAL_STM32_MODE_INPUT (0U << 0U)
+#define PAL_STM32_MODE_OUTPUT (1U << 0U)
+#define PAL_STM32_MODE_ALTERNATE (2U << 0U)
+#define PAL_STM32_MODE_ANALOG (3U << 0U)
+#define PAL_STM32_OTYPE_PUSHPULL (0U << 2U)
+#define PAL_STM32_OTYPE_OPENDRAIN (1U << 2U)
+#define PAL_STM32_OSPEED_HIGHEST (3U << 3U)
+#define PAL_STM32_PUPDR_MASK (3U << 5U)
+#define PAL_STM32_PUPDR_FLOATING (0U << 5U)
+#define PAL_STM32_PUPDR_PULLUP (1U << 5U)
+#define PAL_STM32_PUPDR_PULLDOWN (2U << 5U)
+#define PAL_STM32_ALTERNATE(n) ((n) << 7U)
+
+#define PAL_MODE_INPUT_ANALOG PAL_STM32_MODE_ANALOG
+#define PAL_MODE_OUTPUT_PUSHPULL (PAL_STM32_MODE_OUTPUT | PAL_STM32_OTYPE_PUSHPULL)
+#define PAL_MODE_OUTPUT_OPENDRAIN (PAL_STM32_MODE_OUTPUT | PAL_STM32_OTYPE_OPENDRAIN)
+#define PAL_MODE_ALTERNATE(n) (PAL_STM32_MODE_ALTERNATE | PAL_STM32_ALTERNATE(n))
+
+void palSetPadMode(ioportid_t port, uint8_t pad, iomode_t mode);
+void palSetGroupMode(ioportid_t port, ioportmask_t mask, uint32_t offset, iomode_t mode);
+unsigned palReadPad(ioportid_t port, uint8_t pad);
+void palWriteGroup(ioportid_t port, ioportmask_t mask, uint32_t offset, ioportmask_t bits);
+void palWritePad(ioportid_t port, uint8_t pad, unsigned bit);
+#define palSetPad(port, pad) palWritePad(port, pad, PAL_HIGH)
+#define palClearPad(port, pad) palWritePad(port, pad, PAL_LOW)
+
+/* Serial */
+typedef struct {
+    uint32_t speed;
+    uint16_t cr1;
+    uint16_t cr2;
+    uint16_t cr3;
+} SerialConfig;
+typedef struct {
+    const SerialConfig *config;
+} SerialDriver;
+extern SerialDriver SD2;
+
+void sdStart(SerialDriver *sdp, const SerialConfig *config);
+size_t sdWrite(SerialDriver *sdp, const uint8_t *b, size_t n);
+uint8_t sdGet(SerialDriver *sdp);
+
+/* CAN */
+typedef uint32_t canmbx_t;
+#define CAN_ANY_MAILBOX 0U
+#define CAN_MAILBOX_TO_MASK(mbx) (1U << ((mbx) - 1U))
+#define CAN_IDE_STD 0U
+#define CAN_IDE_EXT 1U
+#define CAN_RTR_DATA 0U
+#define CAN_RTR_REMOTE 1U
+#define CAN_LIMIT_WARNING 1U
+#define CAN_LIMIT_ERROR 2U
+#define CAN_BUS_OFF_ERROR 4U
+#define CAN_FRAMING_ERROR 8U
+#define CAN_OVERFLOW_ERROR 16U
+
+typedef struct {
+    uint8_t DLC:4;
+    uint8_t RTR:1;
+    uint8_t IDE:1;
+    union {
+        struct {
+            uint32_t SID:11;
+        };
+        struct {
+            uint32_t EID:29;
+        };
+    };
+    union {
+        uint8_t data8[8];
+        uint16_t data16[4];
+        uint32_t data32[2];
+        uint64_t data64[1];
+    };
+} CANTxFrame;
+
+typedef struct {
+    struct {
+        uint8_t FMI;
+        uint16_t TIME;
+    };
+    struct {
+        uint8_t DLC:4;
+        uint8_t RTR:1;
+        uint8_t IDE:1;
+    };
+    union {
+        struct {
+            uint32_t SID:11;
+        };
+        struct {
+            uint32_t EID:29;
+        };
+    };
+    union {
+        uint8_t data8[8];
+        uint16_t data16[4];
+        uint32_t data32[2];
+        uint64_t data64[1];
+    };
+} CANRxFrame;
+
+typedef struct {
+    uint32_t filter;
+    uint32_t mode:1;
+    uint32_t scale:1;
+    uint32_t assignment:1;
+    uint32_t register1;
+    uint32_t register2;
+} CANFilter;
+
+typedef struct {
+    uint32_t mcr;
+    uint32_t btr;
+} CANConfig;
+
+typedef struct {
+    volatile uint32_t RF0R;
+    volatile uint32_t RF1R;
+} CAN_TypeDef;
+
+typedef struct {
+    const CANConfig *config;
+    event_source_t rxfull_event;
+    event_source_t txempty_event;
+    event_source_t error_event;
+    CAN_TypeDef *can;
+} CANDriver;
+extern CANDriver CAND1;
+
+void canStart(CANDriver *canp, const CANConfig *config);
+msg_t canTransmit(CANDriver *canp, canmbx_t mailbox, const CANTxFrame *ctfp, systime_t timeout);
+msg_t canReceive(CANDriver *canp, canmbx_t mailbox, CANRxFrame *crfp, systime_t timeout);
+void canSTM32SetFilters(uint32_t can2sb, uint32_t num, const CANFilter *cfp);
+
+/* SPI */
+typedef struct SPIDriver SPIDriver;
+typedef void (*spicallback_t)(SPIDriver *spip);
+typedef struct {
+    spicallback_t end_cb;
+    ioportid_t ssport;
+    uint16_t sspad;
+    uint16_t cr1;
+    uint16_t cr2;
+} SPIConfig;
+struct SPIDriver {
+    const SPIConfig *config;
+};
+extern SPIDriver SPID1;
+
+void spiStart(SPIDriver *spip, const SPIConfig *config);
+void spiStartSend(SPIDriver *spip, size_t n, const void *txbuf);
+
+/* PWM */
+typedef struct PWMDriver PWMDriver;
+typedef void (*pwmcallback_t)(PWMDriver *pwmp);
+typedef uint32_t pwmcnt_t;
+typedef uint8_t pwmchannel_t;
+#define PWM_CHANNELS 4
+#define PWM_OUTPUT_DISABLED 0U
+#define PWM_OUTPUT_ACTIVE_HIGH 1U
+#define PWM_OUTPUT_ACTIVE_LOW 2U
+typedef struct {
+    uint32_t mode;
+    pwmcallback_t callback;
+} PWMChannelConfig;
+typedef struct {
+    uint32_t frequency;
+    pwmcnt_t period;
+    pwmcallback_t callback;
+    PWMChannelConfig channels[PWM_CHANNELS];
+    uint32_t cr2;
+    uint32_t dier;
+} PWMConfig;
+struct PWMDriver {
+    const PWMConfig *config;
+    pwmcnt_t widths[PWM_CHANNELS];
+    uint32_t notifications;
+    virtual_timer_t period_timer;
+    virtual_timer_t compare_timers[PWM_CHANNELS];
+};
+extern PWMDriver PWMD3;
+
+void pwmStart(PWMDriver *pwmp, const PWMConfig *config);
+void pwmEnableChannelI(PWMDriver *pwmp, pwmchannel_t channel, pwmcnt_t width);
+#define pwmEnableChannel(pwmp, channel, width) pwmEnableChannelI(pwmp, channel, width)
+void pwmEnableChannelNotification(PWMDriver *pwmp, pwmchannel_t channel);
+
+/* ADC */
+typedef uint16_t adcsample_t;
+typedef uint16_t adc_channels_num_t;
+typedef uint32_t adcerror_t;
+typedef struct ADCDriver ADCDriver;
+typedef void (*adccallback_t)(ADCDriver *adcp, adcsample_t *buffer, size_t n);
+typedef void (*adcerrorcallback_t)(ADCDriver *adcp, adcerror_t err);
+typedef struct {
+    bool circular;
+    adc_channels_num_t num_channels;
+    adccallback_t end_cb;
+    adcerrorcallback_t error_cb;
+    uint32_t cfgr1;
+    uint32_t tr;
+    uint32_t smpr;
+    uint32_t chselr;
+} ADCConversionGroup;
+struct ADCDriver {
+    const ADCConversionGroup *grpp;
+    adcsample_t *samples;
+    size_t depth;
+    size_t index;
+};
+extern ADCDriver ADCD1;
+
+#define ADC_TR(low, high) (((uint32_t)(high) << 16U) | (uint32_t)(low))
+
+void adcStart(ADCDriver *adcp, const void *config);
+void adcStartConversion(ADCDriver *adcp, const ADCConversionGroup *grpp, adcsample_t *samples, size_t depth);
+
+/* Watchdog */
+typedef struct {
+    uint32_t pr;
+    uint32_t rlr;
+    uint32_t winr;
+} WDGConfig;
+typedef struct {
+    const WDGConfig *config;
+} WDGDriver;
+extern WDGDriver WDGD1;
+
+#define STM32_IWDG_PR_64 4U
+#define STM32_IWDG_RL(n) (n)
+#define STM32_IWDG_WIN_DISABLED 0x0FFFU
+
+void wdgStart(WDGDriver *wdgp, const WDGConfig *config);
+void wdgReset(WDGDriver *wdgp);
+
+void halInit(void);
+void NVIC_SystemReset(void);
+
+#endif /* HAL_H_ */
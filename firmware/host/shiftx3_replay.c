@@ -0,0 +1,479 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Replays a CAN trace through the firmware on the host simulator and
+ * reports how it kept up. Frames are received at their logged times,
+ * relative to the first frame, and go through the real filters, receive
+ * service, dispatch and render path. The simulated CPU is infinitely
+ * fast, so latencies are those of the firmware's scheduling and frame
+ * rate limits; processing cost is measured separately, as the host CPU
+ * time the scheduler thread spends on each frame.
+ *
+ * Reports:
+ *  - CAN to SPI latency: from a frame's arrival to the start of the
+ *    first LED frame sent after it was handled. Frames whose render
+ *    changed nothing are counted instead.
+ *  - processing cost per frame, in host CPU time
+ *  - frames dropped by the receive FIFOs and queue, and live value
+ *    updates coalesced before they were rendered
+ *  - renders and LED frames per second
+ *
+ * Traces may be written by candump -l, by candump -ta, or be Vector ASC
+ * files with hexadecimal IDs.
+ *
+ * usage: shiftx3_replay [-q] [-a] [-f] [-o start_ms] [-t linger_ms] [-l light_level] trace
+ *
+ *  -q  print only the report, not the timeline of outputs
+ *  -o  when to receive the first frame, from power on; 0 by default
+ *  -t  how long to run after the last frame; 1000ms by default
+ */
+
+#include "sim_harness.h"
+#include "shiftx3_api.h"
+#include "system_CAN.h"
+#include "system_CAN_queue.h"
+#include "system_LED.h"
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_LINGER_MS 1000
+#define DEFAULT_LIGHT_LEVEL 2048
+#define TRACE_LINE_MAX 512
+#define CAN_EFF_ID_DIGITS 8
+#define CAN_SFF_MAX 0x7FF
+#define CAN_EFF_MAX 0x1FFFFFFF
+
+/* A growable array of samples, for percentiles */
+struct Samples {
+    uint32_t *values;
+    size_t count;
+    size_t capacity;
+};
+
+struct ReplayCounts {
+    uint64_t frames;
+    uint64_t accepted;
+    uint64_t unchanged;
+    uint64_t led_frames;
+    uint64_t led_changes;
+    uint64_t gpio_writes;
+    uint64_t can_tx;
+};
+
+static struct ReplayCounts g_counts;
+static bool g_quiet;
+
+static FILE *g_trace;
+static bool g_trace_started;
+static uint64_t g_trace_start_us;
+static uint64_t g_replay_start_us;
+static uint64_t g_linger_us = DEFAULT_LINGER_MS * 1000;
+static virtual_timer_t g_replay_timer;
+
+/* Next frame to receive */
+static bool g_have_next;
+static uint64_t g_next_us;
+static CANRxFrame g_next_frame;
+
+/* Arrival times of frames not yet sent out in an LED frame, oldest first */
+static struct Samples g_pending;
+static size_t g_pending_head;
+static struct Samples g_latencies_us;
+
+/* Host CPU time of the scheduler thread, split over the frames received since the last idle */
+static clockid_t g_main_cpu_clock;
+static uint64_t g_period_cpu_ns;
+static uint32_t g_period_frames;
+static struct Samples g_costs_ns;
+
+static uint32_t g_frames_skipped;
+static bool g_reset;
+
+static void _samples_add(struct Samples *samples, uint32_t value)
+{
+    if (samples->count == samples->capacity) {
+        samples->capacity = samples->capacity ? samples->capacity * 2 : 1024;
+        samples->values = realloc(samples->values, samples->capacity * sizeof(uint32_t));
+        if (!samples->values) {
+            perror("replay");
+            exit(1);
+        }
+    }
+    samples->values[samples->count++] = value;
+}
+
+static int _compare_samples(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Nearest rank percentile of sorted samples */
+static uint32_t _percentile(const struct Samples *samples, unsigned percent)
+{
+    size_t rank = (samples->count * percent + 99) / 100;
+    return samples->values[rank ? rank - 1 : 0];
+}
+
+static void _print_distribution(const char *name, struct Samples *samples, double scale)
+{
+    if (!samples->count) {
+        printf("%s: no samples\n", name);
+        return;
+    }
+    qsort(samples->values, samples->count, sizeof(uint32_t), _compare_samples);
+    printf("%s: p50 %.1f p99 %.1f max %.1f (%zu samples)\n", name,
+           _percentile(samples, 50) * scale, _percentile(samples, 99) * scale,
+           samples->values[samples->count - 1] * scale, samples->count);
+}
+
+/* Trace parsing */
+
+/* Seconds with up to microsecond decimals, without going through a double */
+static bool _parse_time(const char *s, uint64_t *time_us)
+{
+    char *end;
+    uint64_t seconds = strtoull(s, &end, 10);
+    if (end == s)
+        return false;
+    uint64_t us = 0;
+    if (*end == '.') {
+        const char *frac = end + 1;
+        unsigned digits = 0;
+        for (; *frac >= '0' && *frac <= '9'; frac++) {
+            if (digits++ < 6)
+                us = us * 10 + (*frac - '0');
+        }
+        for (; digits < 6; digits++) {
+            us *= 10;
+        }
+    }
+    *time_us = seconds * 1000000 + us;
+    return true;
+}
+
+static bool _set_id(CANRxFrame *frame, uint32_t id, bool extended)
+{
+    if (extended) {
+        if (id > CAN_EFF_MAX)
+            return false;
+        frame->IDE = CAN_IDE_EXT;
+        frame->EID = id;
+    } else {
+        if (id > CAN_SFF_MAX)
+            return false;
+        frame->IDE = CAN_IDE_STD;
+        frame->SID = id;
+    }
+    return true;
+}
+
+/* Up to 8 data bytes in hex, separated by spaces or not */
+static bool _parse_data(const char *s, CANRxFrame *frame, int dlc)
+{
+    size_t n = 0;
+    while (*s && n < 8) {
+        if (*s == ' ' || *s == '\t') {
+            s++;
+            continue;
+        }
+        unsigned byte;
+        if (sscanf(s, "%2x", &byte) != 1)
+            break;
+        frame->data8[n++] = (uint8_t)byte;
+        s += 2;
+    }
+    if (dlc >= 0 && (size_t)dlc != n)
+        return false;
+    frame->DLC = n;
+    return true;
+}
+
+/* (1536612345.123456) can0 000E3600#0102 or (1536612345.123456) can0 000E3600 [2] 01 02 */
+static bool _parse_candump(const char *line, uint64_t *time_us, CANRxFrame *frame)
+{
+    char id[16];
+    int consumed;
+    if (!_parse_time(line + 1, time_us))
+        return false;
+    const char *p = strchr(line, ')');
+    if (!p || sscanf(p + 1, "%*s %15[0-9A-Fa-f]%n", id, &consumed) != 1)
+        return false;
+    p += 1 + consumed;
+    if (!_set_id(frame, strtoul(id, NULL, 16), strlen(id) == CAN_EFF_ID_DIGITS))
+        return false;
+
+    if (*p == '#') {
+        if (p[1] == 'R' || p[1] == '#')
+            return false;
+        return _parse_data(p + 1, frame, -1);
+    }
+    int dlc;
+    if (sscanf(p, " [%d]%n", &dlc, &consumed) != 1 || strstr(p, "remote"))
+        return false;
+    return _parse_data(p + consumed, frame, dlc);
+}
+
+/* 0.123456 1 E3600x Rx d 2 01 02 */
+static bool _parse_asc(const char *line, uint64_t *time_us, CANRxFrame *frame)
+{
+    char time[32];
+    char id[16];
+    char type[4];
+    int dlc;
+    int consumed;
+    if (sscanf(line, " %31s %*d %15s %*s %3s %d%n", time, id, type, &dlc, &consumed) != 4 ||
+        strcmp(type, "d") || !_parse_time(time, time_us))
+        return false;
+    char *end;
+    uint32_t can_id = strtoul(id, &end, 16);
+    if (end == id || (*end && strcmp(end, "x")))
+        return false;
+    return _set_id(frame, can_id, *end == 'x') && _parse_data(line + consumed, frame, dlc);
+}
+
+/* Read the next data frame; lines that aren't one are skipped */
+static bool _read_frame(uint64_t *time_us, CANRxFrame *frame)
+{
+    char line[TRACE_LINE_MAX];
+    while (fgets(line, sizeof(line), g_trace)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        memset(frame, 0, sizeof(*frame));
+        const char *start = line + strspn(line, " \t");
+        bool parsed = *start == '(' ? _parse_candump(start, time_us, frame) : _parse_asc(line, time_us, frame);
+        if (parsed)
+            return true;
+    }
+    return false;
+}
+
+/* Replay */
+
+static void _read_next(void)
+{
+    uint64_t time_us;
+    g_have_next = _read_frame(&time_us, &g_next_frame);
+    if (!g_have_next)
+        return;
+    if (!g_trace_started) {
+        g_trace_start_us = time_us;
+        g_trace_started = true;
+    }
+    /* a trace stepping backwards is played as if simultaneous */
+    time_us = time_us < g_trace_start_us ? g_trace_start_us : time_us;
+    uint64_t next_us = g_replay_start_us + (time_us - g_trace_start_us);
+    g_next_us = next_us > g_next_us ? next_us : g_next_us;
+}
+
+/* Receive every frame now due, as the CAN interrupt would */
+static void _replay_frames(void *par)
+{
+    (void)par;
+    while (g_have_next && g_next_us <= sim_now_us()) {
+        g_counts.frames++;
+        if (sim_can_receive(&g_next_frame)) {
+            g_counts.accepted++;
+            g_period_frames++;
+            _samples_add(&g_pending, (uint32_t)sim_now_us());
+        }
+        _read_next();
+    }
+    if (g_have_next) {
+        sim_timer_set_at(&g_replay_timer, g_next_us, _replay_frames, NULL);
+    } else {
+        sim_set_end_time(sim_now_us() + g_linger_us);
+    }
+}
+
+static uint64_t _main_cpu_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(g_main_cpu_clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void _clear_pending(void)
+{
+    g_pending.count = 0;
+    g_pending_head = 0;
+}
+
+/* The firmware has finished with everything received so far */
+static uint64_t _idle(uint64_t next_us)
+{
+    uint64_t cpu_ns = _main_cpu_ns();
+    if (g_period_frames) {
+        uint64_t cost = (cpu_ns - g_period_cpu_ns) / g_period_frames;
+        for (uint32_t i = 0; i < g_period_frames; i++) {
+            _samples_add(&g_costs_ns, cost > UINT32_MAX ? UINT32_MAX : (uint32_t)cost);
+        }
+        g_period_frames = 0;
+    }
+    g_period_cpu_ns = cpu_ns;
+
+    /* a frame service found nothing to send, so the frames it handled changed nothing */
+    uint32_t frames_skipped = get_led_stats()->frames_skipped;
+    if (frames_skipped != g_frames_skipped) {
+        g_frames_skipped = frames_skipped;
+        g_counts.unchanged += g_pending.count - g_pending_head;
+        _clear_pending();
+    }
+    return next_us;
+}
+
+static void _spi_tx(const uint8_t *data, size_t length)
+{
+    g_counts.led_frames++;
+    bool changed = g_quiet ? length == TXBUF_LEN : sim_trace_led_frame(data, length);
+    if (changed)
+        g_counts.led_changes++;
+
+    uint32_t now = (uint32_t)sim_now_us();
+    for (size_t i = g_pending_head; i < g_pending.count; i++) {
+        _samples_add(&g_latencies_us, now - g_pending.values[i]);
+    }
+    _clear_pending();
+}
+
+static void _can_tx(const CANTxFrame *frame)
+{
+    g_counts.can_tx++;
+    if (!g_quiet)
+        sim_trace_can_tx(frame);
+}
+
+static void _gpio_write(ioportid_t port, uint32_t odr)
+{
+    g_counts.gpio_writes++;
+    if (!g_quiet)
+        sim_trace_gpio(port, odr);
+}
+
+static void _reset(void)
+{
+    g_reset = true;
+}
+
+static void _finish(void)
+{
+    uint64_t now = sim_now_us();
+    double seconds = (now - g_replay_start_us) / 1e6;
+    const struct CanStats *can_stats = get_can_stats();
+    const struct CanQueueStats *queue_stats = get_can_rx_queue_stats();
+    const struct ApiRenderStats *render_stats = get_api_render_stats();
+
+    if (g_reset)
+        printf("firmware reset at %.6fs; replay stopped\n", now / 1e6);
+    printf("replayed %" PRIu64 " frames over %.3fs, %" PRIu64 " accepted by the filters\n",
+           g_counts.frames, seconds, g_counts.accepted);
+    _print_distribution("CAN to SPI latency (us)", &g_latencies_us, 1);
+    printf("frames rendered without an LED change: %" PRIu64 "\n", g_counts.unchanged);
+    _print_distribution("processing cost per frame (host CPU us)", &g_costs_ns, 1e-3);
+    printf("dropped: %lu FIFO 0 overruns, %lu FIFO 1 overruns, %lu receive queue drops\n",
+           (unsigned long)can_stats->rx_fifo0_overruns, (unsigned long)can_stats->rx_fifo1_overruns,
+           (unsigned long)queue_stats->drops);
+    printf("coalesced: %lu live value updates superseded before rendering\n",
+           (unsigned long)render_stats->renders_skipped);
+    if (seconds > 0) {
+        printf("renders/s %.1f, LED frames/s %.1f (%.1f changed)\n", render_stats->renders / seconds,
+               g_counts.led_frames / seconds, g_counts.led_changes / seconds);
+    }
+    printf("%" PRIu64 " CAN frames sent, %" PRIu64 " GPIO writes\n", g_counts.can_tx, g_counts.gpio_writes);
+    fclose(g_trace);
+}
+
+static const struct SimHooks hooks = {
+    .can_tx = _can_tx,
+    .spi_tx = _spi_tx,
+    .gpio_write = _gpio_write,
+    .reset = _reset,
+    .finish = _finish,
+    .idle = _idle
+};
+
+static void _usage(void)
+{
+    fprintf(stderr, "usage: shiftx3_replay [-q] [-a] [-f] [-o start_ms] [-t linger_ms] [-l light_level] trace\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    bool adr1_cut = false;
+    bool adr2_cut = false;
+    adcsample_t light_level = DEFAULT_LIGHT_LEVEL;
+    int opt;
+    while ((opt = getopt(argc, argv, "qafo:t:l:")) != -1) {
+        switch (opt) {
+        case 'q':
+            g_quiet = true;
+            break;
+        case 'a':
+            adr1_cut = true;
+            break;
+        case 'f':
+            adr2_cut = true;
+            break;
+        case 'o':
+            g_replay_start_us = strtoull(optarg, NULL, 0) * 1000;
+            break;
+        case 't':
+            g_linger_us = strtoull(optarg, NULL, 0) * 1000;
+            break;
+        case 'l':
+            light_level = (adcsample_t)strtoul(optarg, NULL, 0);
+            break;
+        default:
+            _usage();
+        }
+    }
+    if (optind != argc - 1)
+        _usage();
+    g_trace = fopen(argv[optind], "r");
+    if (!g_trace) {
+        perror(argv[optind]);
+        return 1;
+    }
+    if (pthread_getcpuclockid(pthread_self(), &g_main_cpu_clock)) {
+        fprintf(stderr, "replay: no thread CPU clock\n");
+        return 1;
+    }
+
+    sim_start(&hooks);
+    sim_set_light_level(light_level);
+    sim_board_init(adr1_cut, adr2_cut);
+
+    chVTObjectInit(&g_replay_timer);
+    _read_next();
+    if (!g_have_next) {
+        fprintf(stderr, "%s: no CAN frames found\n", argv[optind]);
+        return 1;
+    }
+    sim_timer_set_at(&g_replay_timer, g_next_us, _replay_frames, NULL);
+    return shiftx3_main();
+}
@@ -0,0 +1,148 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Runs the firmware on the host simulator and prints what it drives:
+ * CAN frames sent (in candump format), LED frames sent over SPI and the
+ * GPIO outputs, which include the display segments. Each line starts
+ * with the simulated time in seconds.
+ *
+ * usage: shiftx3_sim [-d duration_ms] [-l light_level] [-a] [-f] [-s serial_log]
+ *
+ *  -a  cut the ADR1 jumper, moving the CAN base ID up by 256
+ *  -f  cut the ADR2 jumper, running the bus at 1Mbit
+ *  -s  write the binary log from the serial port to a file for log_decode.py
+ */
+
+#include "sim_harness.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define DEFAULT_DURATION_MS 5000
+#define DEFAULT_LIGHT_LEVEL 2048
+
+struct SimCounts {
+    uint32_t can_frames;
+    uint32_t led_frames;
+    uint32_t led_changes;
+    uint32_t gpio_writes;
+    uint32_t serial_bytes;
+};
+static struct SimCounts g_counts;
+static FILE *g_serial_log;
+
+static void _can_tx(const CANTxFrame *frame)
+{
+    g_counts.can_frames++;
+    sim_trace_can_tx(frame);
+}
+
+static void _spi_tx(const uint8_t *data, size_t length)
+{
+    g_counts.led_frames++;
+    if (sim_trace_led_frame(data, length))
+        g_counts.led_changes++;
+}
+
+static void _gpio_write(ioportid_t port, uint32_t odr)
+{
+    g_counts.gpio_writes++;
+    sim_trace_gpio(port, odr);
+}
+
+static void _serial_tx(const uint8_t *data, size_t length)
+{
+    g_counts.serial_bytes += length;
+    if (g_serial_log)
+        fwrite(data, 1, length, g_serial_log);
+}
+
+static void _reset(void)
+{
+    sim_trace_time();
+    printf("RESET\n");
+}
+
+static void _finish(void)
+{
+    printf("%lu CAN frames, %lu LED frames (%lu changed), %lu GPIO writes, %lu serial bytes\n",
+           (unsigned long)g_counts.can_frames, (unsigned long)g_counts.led_frames,
+           (unsigned long)g_counts.led_changes, (unsigned long)g_counts.gpio_writes,
+           (unsigned long)g_counts.serial_bytes);
+    if (g_serial_log)
+        fclose(g_serial_log);
+}
+
+static const struct SimHooks hooks = {
+    .can_tx = _can_tx,
+    .spi_tx = _spi_tx,
+    .gpio_write = _gpio_write,
+    .serial_tx = _serial_tx,
+    .reset = _reset,
+    .finish = _finish
+};
+
+static void _usage(void)
+{
+    fprintf(stderr, "usage: shiftx3_sim [-d duration_ms] [-l light_level] [-a] [-f] [-s serial_log]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t duration_ms = DEFAULT_DURATION_MS;
+    adcsample_t light_level = DEFAULT_LIGHT_LEVEL;
+    bool adr1_cut = false;
+    bool adr2_cut = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:l:afs:")) != -1) {
+        switch (opt) {
+        case 'd':
+            duration_ms = strtoull(optarg, NULL, 0);
+            break;
+        case 'l':
+            light_level = (adcsample_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'a':
+            adr1_cut = true;
+            break;
+        case 'f':
+            adr2_cut = true;
+            break;
+        case 's':
+            g_serial_log = fopen(optarg, "wb");
+            if (!g_serial_log) {
+                perror(optarg);
+                return 1;
+            }
+            break;
+        default:
+            _usage();
+        }
+    }
+
+    sim_start(&hooks);
+    sim_set_end_time(duration_ms * 1000);
+    sim_set_light_level(light_level);
+    sim_board_init(adr1_cut, adr2_cut);
+    return shiftx3_main();
+}
@@ -0,0 +1,447 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Runs the firmware in real time on a SocketCAN interface, such as a
+ * vcan, so host tools can talk to it as they would to a ShiftX3 on the
+ * bus. Frames from the interface are received by the simulated CAN
+ * controller, and frames the firmware sends go out on the interface.
+ * Virtual time is paced to the wall clock. A system reset restarts the
+ * program.
+ *
+ * The throughput test (-T) blasts live value updates at the firmware
+ * from a second socket, at increasing rates, and reports how many of
+ * them the receive service took in at each rate. The sustained
+ * acceptance rate is the highest rate with no frame lost. It measures
+ * the firmware's receive path as run on this host, where every frame
+ * arriving while the firmware is busy piles into the 3 deep FIFOs, as
+ * on the target; it does not model the target's CPU speed.
+ *
+ * usage: shiftx3_vcan [-q] [-T] [-a] [-f] [-d duration_ms] [-l light_level] [-s serial_log] [interface]
+ *
+ *  -q  don't print the LED and GPIO timeline
+ *  -T  run the throughput test
+ *
+ * The interface is vcan0 by default; to create it:
+ *   ip link add dev vcan0 type vcan && ip link set up vcan0
+ */
+
+/* for ppoll() */
+#define _GNU_SOURCE
+#include "sim_harness.h"
+#include "shiftx3_api.h"
+#include "system_CAN.h"
+#include "system_CAN_queue.h"
+#include <errno.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include <net/if.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_INTERFACE "vcan0"
+#define DEFAULT_LIGHT_LEVEL 2048
+#define INBOX_FRAMES 64
+#define BLAST_FRAME_DLC 2
+#define SOCKET_BUFFER_BYTES (1024 * 1024)
+
+/* Throughput test steps: blast at a rate, then let the firmware catch up */
+#define BLAST_STEP_MS 2000
+#define BLAST_SETTLE_MS 500
+#define BLAST_BATCH_US 1000
+#define BLAST_FIRST_RATE 250
+
+static char **g_argv;
+static bool g_quiet;
+static const char *g_interface = DEFAULT_INTERFACE;
+static int g_socket = -1;
+static uint64_t g_wall_start_us;
+static FILE *g_serial_log;
+
+/*
+ * Frames read from the interface, waiting to be received by the
+ * controller. They are received no closer together than their time on
+ * the bus, so a burst read at once reaches the FIFOs as it would over
+ * a real bus.
+ */
+static CANRxFrame g_inbox[INBOX_FRAMES];
+static size_t g_inbox_head;
+static size_t g_inbox_count;
+static virtual_timer_t g_inbox_timer;
+static uint64_t g_last_rx_us;
+
+static uint32_t g_tx_errors;
+
+/* Throughput test; the blaster thread sends at g_blast_rate frames per second */
+struct BlastCounts {
+    uint32_t sent;
+    uint32_t rx_frames;
+    uint32_t queue_drops;
+    uint32_t overruns;
+};
+static bool g_blast_test;
+static pthread_t g_blast_thread;
+static _Atomic uint32_t g_blast_rate;
+static _Atomic uint32_t g_blast_sent;
+static _Atomic uint32_t g_blast_can_id;
+static uint32_t g_blast_step_rate;
+static uint32_t g_blast_bus_rate;
+static uint64_t g_blast_stop_us;
+static uint64_t g_blast_step_end_us;
+static struct BlastCounts g_blast_start;
+static uint32_t g_blast_sustained;
+static bool g_blast_done;
+
+static uint64_t _wall_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000 - g_wall_start_us;
+}
+
+static int _open_socket(const char *interface)
+{
+    int s = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+    if (s < 0) {
+        perror("vcan: socket");
+        exit(1);
+    }
+    struct sockaddr_can addr = {0};
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = if_nametoindex(interface);
+    if (!addr.can_ifindex) {
+        fprintf(stderr, "vcan: no interface %s\n", interface);
+        exit(1);
+    }
+    int size = SOCKET_BUFFER_BYTES;
+    setsockopt(s, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("vcan: bind");
+        exit(1);
+    }
+    return s;
+}
+
+/* Socket frames to and from the controller's frames; error frames are ignored */
+static bool _from_socket(const struct can_frame *cf, CANRxFrame *frame)
+{
+    if (cf->can_id & CAN_ERR_FLAG)
+        return false;
+    memset(frame, 0, sizeof(*frame));
+    if (cf->can_id & CAN_EFF_FLAG) {
+        frame->IDE = CAN_IDE_EXT;
+        frame->EID = cf->can_id & CAN_EFF_MASK;
+    } else {
+        frame->IDE = CAN_IDE_STD;
+        frame->SID = cf->can_id & CAN_SFF_MASK;
+    }
+    frame->RTR = (cf->can_id & CAN_RTR_FLAG) ? CAN_RTR_REMOTE : CAN_RTR_DATA;
+    frame->DLC = cf->can_dlc > 8 ? 8 : cf->can_dlc;
+    memcpy(frame->data8, cf->data, frame->DLC);
+    return true;
+}
+
+static void _can_tx(const CANTxFrame *frame)
+{
+    struct can_frame cf = {0};
+    cf.can_id = frame->IDE == CAN_IDE_EXT ? (frame->EID | CAN_EFF_FLAG) : frame->SID;
+    if (frame->RTR)
+        cf.can_id |= CAN_RTR_FLAG;
+    cf.can_dlc = frame->DLC;
+    memcpy(cf.data, frame->data8, frame->DLC);
+    if (write(g_socket, &cf, sizeof(cf)) != sizeof(cf))
+        g_tx_errors++;
+}
+
+/* Receive the oldest frame read, then schedule the next one a frame time later */
+static void _receive_inbox(void *par)
+{
+    (void)par;
+    sim_can_receive(&g_inbox[g_inbox_head]);
+    g_inbox_head = (g_inbox_head + 1) % INBOX_FRAMES;
+    g_inbox_count--;
+    g_last_rx_us = sim_now_us();
+    if (g_inbox_count)
+        sim_timer_set_at(&g_inbox_timer, g_last_rx_us + sim_can_bus_time_us(&g_inbox[g_inbox_head]), _receive_inbox, NULL);
+}
+
+/* Read what has arrived without blocking */
+static void _read_socket(void)
+{
+    struct can_frame cf;
+    while (g_inbox_count < INBOX_FRAMES) {
+        ssize_t n = recv(g_socket, &cf, sizeof(cf), MSG_DONTWAIT);
+        if (n != sizeof(cf))
+            break;
+        if (_from_socket(&cf, &g_inbox[(g_inbox_head + g_inbox_count) % INBOX_FRAMES]))
+            g_inbox_count++;
+    }
+}
+
+/* Throughput test */
+
+static void * _blast(void *arg)
+{
+    (void)arg;
+    int s = _open_socket(g_interface);
+    struct can_frame cf = {0};
+    cf.can_dlc = BLAST_FRAME_DLC;
+    uint64_t sent = 0;
+    uint64_t batch_start = _wall_us();
+    uint32_t rate = 0;
+    while (true) {
+        uint32_t new_rate = atomic_load(&g_blast_rate);
+        if (new_rate != rate) {
+            rate = new_rate;
+            sent = 0;
+            batch_start = _wall_us();
+        }
+        /* send what is due by now, then sleep a batch */
+        uint64_t elapsed = _wall_us() - batch_start;
+        uint64_t due = elapsed * rate / 1000000;
+        cf.can_id = atomic_load(&g_blast_can_id) | CAN_EFF_FLAG;
+        for (; sent < due; sent++) {
+            cf.data[0] = sent & 0xFF;
+            cf.data[1] = (sent >> 8) & 0xFF;
+            if (write(s, &cf, sizeof(cf)) == sizeof(cf))
+                atomic_fetch_add(&g_blast_sent, 1);
+        }
+        struct timespec ts = {0, BLAST_BATCH_US * 1000};
+        nanosleep(&ts, NULL);
+    }
+    return NULL;
+}
+
+static struct BlastCounts _blast_counts(void)
+{
+    const struct CanStats *can_stats = get_can_stats();
+    struct BlastCounts counts = {
+        atomic_load(&g_blast_sent),
+        can_stats->rx_frames,
+        get_can_rx_queue_stats()->drops,
+        can_stats->rx_fifo0_overruns + can_stats->rx_fifo1_overruns
+    };
+    return counts;
+}
+
+static void _start_blast_step(uint64_t wall_us)
+{
+    g_blast_start = _blast_counts();
+    g_blast_stop_us = wall_us + BLAST_STEP_MS * 1000;
+    g_blast_step_end_us = g_blast_stop_us + BLAST_SETTLE_MS * 1000;
+    atomic_store(&g_blast_rate, g_blast_step_rate);
+}
+
+/* Called from the idle hook, so the firmware's counters are settled */
+static void _check_blast_step(uint64_t wall_us)
+{
+    if (g_blast_step_end_us == 0) {
+        atomic_store(&g_blast_can_id, get_can_base_id() + API_SET_CURRENT_LINEAR_GRAPH_VALUE);
+        /* the highest rate the bus could carry these frames at */
+        CANRxFrame frame = {.IDE = CAN_IDE_EXT, .DLC = BLAST_FRAME_DLC};
+        g_blast_bus_rate = 1000000 / sim_can_bus_time_us(&frame);
+        g_blast_step_rate = BLAST_FIRST_RATE;
+        printf("rate/s    sent  received  overruns  queue drops  lost\n");
+        _start_blast_step(wall_us);
+        return;
+    }
+    /* stop blasting and let the firmware settle before counting */
+    if (wall_us >= g_blast_stop_us && atomic_load(&g_blast_rate))
+        atomic_store(&g_blast_rate, 0);
+    if (wall_us < g_blast_step_end_us)
+        return;
+
+    struct BlastCounts end = _blast_counts();
+    uint32_t sent = end.sent - g_blast_start.sent;
+    uint32_t received = end.rx_frames - g_blast_start.rx_frames;
+    uint32_t queue_drops = end.queue_drops - g_blast_start.queue_drops;
+    uint32_t lost = sent - (received - queue_drops);
+    printf("%6lu  %6lu  %8lu  %8lu  %11lu  %4lu\n", (unsigned long)g_blast_step_rate,
+           (unsigned long)sent, (unsigned long)received,
+           (unsigned long)(end.overruns - g_blast_start.overruns), (unsigned long)queue_drops,
+           (unsigned long)lost);
+    fflush(stdout);
+    if (lost == 0)
+        g_blast_sustained = g_blast_step_rate;
+
+    /* double the rate each step, finishing at the bus's capacity */
+    if (g_blast_step_rate == g_blast_bus_rate || lost > sent / 2) {
+        printf("sustained acceptance rate: %lu frames/s, of %lu the bus can carry\n",
+               (unsigned long)g_blast_sustained, (unsigned long)g_blast_bus_rate);
+        sim_set_end_time(sim_now_us());
+        g_blast_done = true;
+        return;
+    }
+    g_blast_step_rate = g_blast_step_rate * 2 < g_blast_bus_rate ? g_blast_step_rate * 2 : g_blast_bus_rate;
+    _start_blast_step(wall_us);
+}
+
+/* Hooks */
+
+/* Wait in real time for the next timer or a frame from the interface */
+static uint64_t _idle(uint64_t next_us)
+{
+    while (true) {
+        uint64_t wall_us = _wall_us();
+        if (g_blast_test && !g_blast_done)
+            _check_blast_step(wall_us);
+        _read_socket();
+        if (g_inbox_count && !chVTIsArmedI(&g_inbox_timer)) {
+            uint64_t rx_us = g_last_rx_us + sim_can_bus_time_us(&g_inbox[g_inbox_head]);
+            rx_us = rx_us > wall_us ? rx_us : wall_us;
+            sim_timer_set_at(&g_inbox_timer, rx_us, _receive_inbox, NULL);
+            next_us = rx_us < next_us ? rx_us : next_us;
+        }
+        if (wall_us >= next_us || g_blast_done)
+            return next_us;
+
+        uint64_t wait_us = next_us - wall_us;
+        /* the throughput test checks its steps at least every millisecond */
+        wait_us = g_blast_test && wait_us > BLAST_BATCH_US ? BLAST_BATCH_US : wait_us;
+        struct timespec timeout = {wait_us / 1000000, (wait_us % 1000000) * 1000};
+        struct pollfd pfd = {g_socket, POLLIN, 0};
+        ppoll(&pfd, 1, &timeout, NULL);
+    }
+}
+
+static void _spi_tx(const uint8_t *data, size_t length)
+{
+    if (!g_quiet)
+        sim_trace_led_frame(data, length);
+}
+
+static void _gpio_write(ioportid_t port, uint32_t odr)
+{
+    if (!g_quiet)
+        sim_trace_gpio(port, odr);
+}
+
+static void _serial_tx(const uint8_t *data, size_t length)
+{
+    if (g_serial_log) {
+        fwrite(data, 1, length, g_serial_log);
+        fflush(g_serial_log);
+    }
+}
+
+/* Restart, as the MCU would */
+static void _reset(void)
+{
+    sim_trace_time();
+    printf("RESET\n");
+    fflush(NULL);
+    close(g_socket);
+    execv("/proc/self/exe", g_argv);
+    perror("vcan: restart");
+}
+
+static void _finish(void)
+{
+    if (g_tx_errors)
+        printf("%lu CAN frames could not be sent\n", (unsigned long)g_tx_errors);
+    if (g_serial_log)
+        fclose(g_serial_log);
+}
+
+static const struct SimHooks hooks = {
+    .can_tx = _can_tx,
+    .spi_tx = _spi_tx,
+    .gpio_write = _gpio_write,
+    .serial_tx = _serial_tx,
+    .reset = _reset,
+    .finish = _finish,
+    .idle = _idle
+};
+
+static void _usage(void)
+{
+    fprintf(stderr, "usage: shiftx3_vcan [-q] [-T] [-a] [-f] [-d duration_ms] [-l light_level] "
+                    "[-s serial_log] [interface]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    bool adr1_cut = false;
+    bool adr2_cut = false;
+    uint64_t duration_ms = 0;
+    adcsample_t light_level = DEFAULT_LIGHT_LEVEL;
+    int opt;
+    g_argv = argv;
+    while ((opt = getopt(argc, argv, "qTafd:l:s:")) != -1) {
+        switch (opt) {
+        case 'q':
+            g_quiet = true;
+            break;
+        case 'T':
+            g_blast_test = true;
+            g_quiet = true;
+            break;
+        case 'a':
+            adr1_cut = true;
+            break;
+        case 'f':
+            adr2_cut = true;
+            break;
+        case 'd':
+            duration_ms = strtoull(optarg, NULL, 0);
+            break;
+        case 'l':
+            light_level = (adcsample_t)strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            g_serial_log = fopen(optarg, "ab");
+            if (!g_serial_log) {
+                perror(optarg);
+                return 1;
+            }
+            break;
+        default:
+            _usage();
+        }
+    }
+    if (optind < argc - 1)
+        _usage();
+    if (optind == argc - 1)
+        g_interface = argv[optind];
+
+    g_socket = _open_socket(g_interface);
+    g_wall_start_us = _wall_us();
+    if (g_blast_test && pthread_create(&g_blast_thread, NULL, _blast, NULL)) {
+        perror("vcan: pthread_create");
+        return 1;
+    }
+
+    sim_start(&hooks);
+    if (duration_ms)
+        sim_set_end_time(duration_ms * 1000);
+    sim_set_light_level(light_level);
+    sim_board_init(adr1_cut, adr2_cut);
+    chVTObjectInit(&g_inbox_timer);
+    return shiftx3_main();
+}
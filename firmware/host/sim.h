@@ -0,0 +1,82 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host simulator for the application sources.
+ *
+ * Simulated threads run one at a time, each on its own pthread, handing
+ * over as the ChibiOS scheduler would. Time is virtual: it only moves
+ * when every thread is blocked, jumping to the next timer due, so code
+ * runs in zero simulated time and a run is repeatable. Timer and driver
+ * callbacks are called from that idle point, as interrupts would be.
+ *
+ * A harness starts the simulator, sets its hooks and inputs, and then
+ * runs the firmware's main(); the run ends at the configured end time,
+ * when nothing is left to happen, or on a system reset.
+ */
+
+#ifndef SIM_H_
+#define SIM_H_
+#include "ch.h"
+#include "hal.h"
+
+#define SIM_TIME_NEVER UINT64_MAX
+
+/* Hooks for the simulated hardware's outputs, called at the current simulated time */
+struct SimHooks {
+    void (*can_tx)(const CANTxFrame *frame);
+    void (*spi_tx)(const uint8_t *data, size_t length);
+    /* an SPI transfer ended; data is its buffer as the DMA left it */
+    void (*spi_done)(const uint8_t *data, size_t length);
+    /* a GPIO port's outputs changed */
+    void (*gpio_write)(ioportid_t port, uint32_t odr);
+    void (*serial_tx)(const uint8_t *data, size_t length);
+    void (*reset)(void);
+    /* the run is over; the process exits when this returns */
+    void (*finish)(void);
+    /*
+     * Called when every thread is blocked, with the time the next timer
+     * is due (SIM_TIME_NEVER if none). Returns the time to advance to,
+     * no later than next_us; inputs injected meanwhile are processed
+     * first. Without a hook time jumps straight to next_us.
+     */
+    uint64_t (*idle)(uint64_t next_us);
+};
+
+/* Turn the calling thread into the simulated main thread */
+void sim_start(const struct SimHooks *hooks);
+void sim_set_end_time(uint64_t end_us);
+const struct SimHooks *sim_hooks(void);
+void sim_finish(void) __attribute__((noreturn));
+
+uint64_t sim_now_us(void);
+/* Arm a timer for an absolute time, at microsecond resolution */
+void sim_timer_set_at(virtual_timer_t *vtp, uint64_t due_us, vtfunc_t func, void *par);
+const char *sim_thread_name(const thread_t *tp);
+
+/* Inputs */
+bool sim_can_receive(const CANRxFrame *frame);
+void sim_set_light_level(adcsample_t level);
+/* Make SPI transfers take this many times longer, as a longer LED chain would */
+void sim_set_spi_slowdown(uint32_t factor);
+void sim_set_pad_input(ioportid_t port, uint8_t pad, unsigned level);
+
+#endif /* SIM_H_ */
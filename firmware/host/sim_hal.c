@@ -0,0 +1,462 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sim.h"
+#include "sim_harness.h"
+#include <string.h>
+
+#define SIM_PORTS 2
+#define SIM_PADS 16
+#define SIM_CAN_FIFOS 2
+#define SIM_CAN_FIFO_DEPTH 3
+#define SIM_CAN_FILTERS 14
+#define SIM_CAN_TX_MAILBOXES 3
+
+/* bxCAN filter register layout for 32 bit scale */
+#define SIM_FILTER_STD_SHIFT 21
+#define SIM_FILTER_EXT_SHIFT 3
+#define SIM_FILTER_IDE 0x04
+#define SIM_FILTER_RTR 0x02
+#define SIM_FILTER_MODE_LIST 1
+
+stm32_gpio_t sim_gpioa;
+stm32_gpio_t sim_gpiob;
+SerialDriver SD2;
+CANDriver CAND1;
+SPIDriver SPID1;
+PWMDriver PWMD3;
+ADCDriver ADCD1;
+WDGDriver WDGD1;
+
+/* GPIO; inputs read their external level if one is set, else their pull */
+struct SimPort {
+    stm32_gpio_t *port;
+    iomode_t modes[SIM_PADS];
+    uint32_t driven;
+    uint32_t levels;
+};
+static struct SimPort g_ports[SIM_PORTS] = {{.port = &sim_gpioa}, {.port = &sim_gpiob}};
+
+static CAN_TypeDef g_can_registers;
+static CANRxFrame g_can_fifos[SIM_CAN_FIFOS][SIM_CAN_FIFO_DEPTH];
+static CANFilter g_can_filters[SIM_CAN_FILTERS];
+static size_t g_can_filter_count;
+/* when each transmit mailbox's frame will have left, and when the bus is free */
+static uint64_t g_can_tx_done_us[SIM_CAN_TX_MAILBOXES];
+static uint64_t g_can_bus_free_us;
+
+static virtual_timer_t g_spi_timer;
+/* the transfer in flight */
+static const uint8_t *g_spi_txbuf;
+static size_t g_spi_length;
+static uint32_t g_spi_slowdown = 1;
+static adcsample_t g_light_level;
+
+void halInit(void)
+{
+    CAND1.can = &g_can_registers;
+    chEvtObjectInit(&CAND1.rxfull_event);
+    chEvtObjectInit(&CAND1.txempty_event);
+    chEvtObjectInit(&CAND1.error_event);
+    chVTObjectInit(&g_spi_timer);
+    chVTObjectInit(&PWMD3.period_timer);
+    for (size_t i = 0; i < PWM_CHANNELS; i++) {
+        chVTObjectInit(&PWMD3.compare_timers[i]);
+    }
+}
+
+void NVIC_SystemReset(void)
+{
+    if (sim_hooks()->reset)
+        sim_hooks()->reset();
+    sim_finish();
+}
+
+/* PAL */
+
+static struct SimPort * _sim_port(ioportid_t port)
+{
+    return &g_ports[port == GPIOA ? 0 : 1];
+}
+
+static void _update_inputs(struct SimPort *sp)
+{
+    uint32_t idr = 0;
+    for (size_t pad = 0; pad < SIM_PADS; pad++) {
+        uint32_t bit = 1U << pad;
+        uint32_t pull = sp->modes[pad] & PAL_STM32_PUPDR_MASK;
+        if (sp->driven & bit) {
+            idr |= sp->levels & bit;
+        } else if (pull == PAL_STM32_PUPDR_PULLUP) {
+            idr |= bit;
+        }
+    }
+    sp->port->IDR = idr;
+}
+
+void sim_set_pad_input(ioportid_t port, uint8_t pad, unsigned level)
+{
+    struct SimPort *sp = _sim_port(port);
+    sp->driven |= 1U << pad;
+    sp->levels = (sp->levels & ~(1U << pad)) | ((level & 1U) << pad);
+    _update_inputs(sp);
+}
+
+void palSetPadMode(ioportid_t port, uint8_t pad, iomode_t mode)
+{
+    struct SimPort *sp = _sim_port(port);
+    sp->modes[pad] = mode;
+    _update_inputs(sp);
+}
+
+void palSetGroupMode(ioportid_t port, ioportmask_t mask, uint32_t offset, iomode_t mode)
+{
+    for (size_t pad = 0; pad < SIM_PADS; pad++) {
+        if ((mask << offset) & (1U << pad))
+            palSetPadMode(port, pad, mode);
+    }
+}
+
+unsigned palReadPad(ioportid_t port, uint8_t pad)
+{
+    struct SimPort *sp = _sim_port(port);
+    uint32_t reg = (sp->modes[pad] & PAL_STM32_MODE_MASK) == PAL_STM32_MODE_OUTPUT ? port->ODR : port->IDR;
+    return (reg >> pad) & 1U;
+}
+
+void palWriteGroup(ioportid_t port, ioportmask_t mask, uint32_t offset, ioportmask_t bits)
+{
+    uint32_t odr = (port->ODR & ~(mask << offset)) | ((bits & mask) << offset);
+    if (odr == port->ODR)
+        return;
+    port->ODR = odr;
+    if (sim_hooks()->gpio_write)
+        sim_hooks()->gpio_write(port, odr);
+}
+
+void palWritePad(ioportid_t port, uint8_t pad, unsigned bit)
+{
+    palWriteGroup(port, 1, pad, bit);
+}
+
+/* Serial */
+
+void sdStart(SerialDriver *sdp, const SerialConfig *config)
+{
+    sdp->config = config;
+}
+
+size_t sdWrite(SerialDriver *sdp, const uint8_t *b, size_t n)
+{
+    (void)sdp;
+    if (sim_hooks()->serial_tx)
+        sim_hooks()->serial_tx(b, n);
+    return n;
+}
+
+/* Nothing is ever received */
+uint8_t sdGet(SerialDriver *sdp)
+{
+    (void)sdp;
+    static binary_semaphore_t never = {true};
+    chBSemWait(&never);
+    return 0;
+}
+
+/* CAN */
+
+void canStart(CANDriver *canp, const CANConfig *config)
+{
+    canp->config = config;
+}
+
+void canSTM32SetFilters(uint32_t can2sb, uint32_t num, const CANFilter *cfp)
+{
+    (void)can2sb;
+    g_can_filter_count = num < SIM_CAN_FILTERS ? num : SIM_CAN_FILTERS;
+    memcpy(g_can_filters, cfp, g_can_filter_count * sizeof(CANFilter));
+}
+
+static uint32_t _filter_register(const CANRxFrame *frame)
+{
+    uint32_t rtr = frame->RTR ? SIM_FILTER_RTR : 0;
+    if (frame->IDE == CAN_IDE_EXT)
+        return ((uint32_t)frame->EID << SIM_FILTER_EXT_SHIFT) | SIM_FILTER_IDE | rtr;
+    return ((uint32_t)frame->SID << SIM_FILTER_STD_SHIFT) | rtr;
+}
+
+static bool _filter_matches(const CANFilter *filter, uint32_t reg)
+{
+    if (filter->mode == SIM_FILTER_MODE_LIST)
+        return reg == filter->register1 || reg == filter->register2;
+    return (reg & filter->register2) == (filter->register1 & filter->register2);
+}
+
+/*
+ * The FIFO the acceptance filters route a frame to, or -1. As on the
+ * bxCAN, list mode filters win over mask mode filters, then the lowest
+ * numbered filter; with no filters set the driver accepts everything
+ * into FIFO 0.
+ */
+static int _filter_fifo(const CANRxFrame *frame, uint8_t *fmi)
+{
+    if (g_can_filter_count == 0) {
+        *fmi = 0;
+        return 0;
+    }
+    uint32_t reg = _filter_register(frame);
+    for (int list = 1; list >= 0; list--) {
+        for (size_t i = 0; i < g_can_filter_count; i++) {
+            const CANFilter *filter = &g_can_filters[i];
+            if (filter->mode == (uint32_t)list && _filter_matches(filter, reg)) {
+                *fmi = filter->filter;
+                return filter->assignment;
+            }
+        }
+    }
+    return -1;
+}
+
+static volatile uint32_t * _fifo_register(int fifo)
+{
+    return fifo == 0 ? &g_can_registers.RF0R : &g_can_registers.RF1R;
+}
+
+/*
+ * Receive a frame from the bus, as the CAN interrupt would. Returns
+ * false if the filters rejected it. A full FIFO overwrites its newest
+ * frame and reports an overrun.
+ */
+bool sim_can_receive(const CANRxFrame *frame)
+{
+    uint8_t fmi;
+    int fifo = _filter_fifo(frame, &fmi);
+    if (fifo < 0)
+        return false;
+
+    volatile uint32_t *rfr = _fifo_register(fifo);
+    uint32_t pending = *rfr & CAN_RF0R_FMP0;
+    if (pending == SIM_CAN_FIFO_DEPTH) {
+        pending--;
+        chEvtBroadcastFlagsI(&CAND1.error_event, CAN_OVERFLOW_ERROR);
+    }
+    CANRxFrame *slot = &g_can_fifos[fifo][pending];
+    *slot = *frame;
+    slot->FMI = fmi;
+    slot->TIME = (uint16_t)chVTGetSystemTimeX();
+    *rfr = pending + 1;
+    chEvtBroadcastFlagsI(&CAND1.rxfull_event, CAN_MAILBOX_TO_MASK(fifo + 1));
+    return true;
+}
+
+static bool _fifo_pop(int fifo, CANRxFrame *crfp)
+{
+    volatile uint32_t *rfr = _fifo_register(fifo);
+    uint32_t pending = *rfr & CAN_RF0R_FMP0;
+    if (!pending)
+        return false;
+    *crfp = g_can_fifos[fifo][0];
+    memmove(&g_can_fifos[fifo][0], &g_can_fifos[fifo][1], (pending - 1) * sizeof(CANRxFrame));
+    *rfr = pending - 1;
+    return true;
+}
+
+/* Only polling receives are supported; a timeout is treated as immediate */
+msg_t canReceive(CANDriver *canp, canmbx_t mailbox, CANRxFrame *crfp, systime_t timeout)
+{
+    (void)canp;
+    (void)timeout;
+    if (mailbox == CAN_ANY_MAILBOX)
+        return _fifo_pop(0, crfp) || _fifo_pop(1, crfp) ? MSG_OK : MSG_TIMEOUT;
+    return _fifo_pop(mailbox - 1, crfp) ? MSG_OK : MSG_TIMEOUT;
+}
+
+static size_t _earliest_tx_mailbox(void)
+{
+    size_t earliest = 0;
+    for (size_t i = 1; i < SIM_CAN_TX_MAILBOXES; i++) {
+        if (g_can_tx_done_us[i] < g_can_tx_done_us[earliest])
+            earliest = i;
+    }
+    return earliest;
+}
+
+/*
+ * Frames are handed to one of the transmit mailboxes, which stays taken
+ * until its frame has been on the bus; the bus is otherwise never busy.
+ * Without a free mailbox, the caller waits up to its timeout for one.
+ */
+msg_t canTransmit(CANDriver *canp, canmbx_t mailbox, const CANTxFrame *ctfp, systime_t timeout)
+{
+    (void)canp;
+    (void)mailbox;
+    size_t free = _earliest_tx_mailbox();
+    uint64_t now = sim_now_us();
+    if (g_can_tx_done_us[free] > now) {
+        systime_t wait = US2ST(g_can_tx_done_us[free] - now);
+        if (timeout == TIME_IMMEDIATE)
+            return MSG_TIMEOUT;
+        if (timeout != TIME_INFINITE && wait > timeout) {
+            chThdSleep(timeout);
+            return MSG_TIMEOUT;
+        }
+        chThdSleep(wait);
+        now = sim_now_us();
+    }
+
+    CANRxFrame frame = {.IDE = ctfp->IDE, .DLC = ctfp->DLC};
+    uint64_t start = g_can_bus_free_us > now ? g_can_bus_free_us : now;
+    g_can_bus_free_us = start + sim_can_bus_time_us(&frame);
+    g_can_tx_done_us[free] = g_can_bus_free_us;
+    if (sim_hooks()->can_tx)
+        sim_hooks()->can_tx(ctfp);
+    return MSG_OK;
+}
+
+/* SPI */
+
+void spiStart(SPIDriver *spip, const SPIConfig *config)
+{
+    spip->config = config;
+}
+
+static void _spi_end(void *par)
+{
+    SPIDriver *spip = par;
+    if (sim_hooks()->spi_done)
+        sim_hooks()->spi_done(g_spi_txbuf, g_spi_length);
+    if (spip->config->end_cb)
+        spip->config->end_cb(spip);
+}
+
+/* The data is captured as the transfer starts; it ends after its time on the bus */
+void spiStartSend(SPIDriver *spip, size_t n, const void *txbuf)
+{
+    if (sim_hooks()->spi_tx)
+        sim_hooks()->spi_tx(txbuf, n);
+    g_spi_txbuf = txbuf;
+    g_spi_length = n;
+    uint32_t br = (spip->config->cr1 >> SPI_CR1_BR_Pos) & 7U;
+    uint64_t clock = STM32_PCLK >> (br + 1);
+    uint64_t transfer_us = (n * 8 * 1000000ULL * g_spi_slowdown + clock - 1) / clock;
+    sim_timer_set_at(&g_spi_timer, sim_now_us() + transfer_us, _spi_end, spip);
+}
+
+void sim_set_spi_slowdown(uint32_t factor)
+{
+    g_spi_slowdown = factor;
+}
+
+/* ADC; conversions are triggered by the PWM timer's update event */
+
+void sim_set_light_level(adcsample_t level)
+{
+    g_light_level = level;
+}
+
+void adcStart(ADCDriver *adcp, const void *config)
+{
+    (void)adcp;
+    (void)config;
+}
+
+void adcStartConversion(ADCDriver *adcp, const ADCConversionGroup *grpp, adcsample_t *samples, size_t depth)
+{
+    adcp->grpp = grpp;
+    adcp->samples = samples;
+    adcp->depth = depth;
+    adcp->index = 0;
+}
+
+/* Circular conversion of a single channel, calling back on each half */
+static void _adc_trigger(ADCDriver *adcp)
+{
+    if (!adcp->grpp)
+        return;
+    adcp->samples[adcp->index++] = g_light_level;
+    size_t half = adcp->depth / 2;
+    if (adcp->index == half) {
+        adcp->grpp->end_cb(adcp, adcp->samples, half);
+    } else if (adcp->index == adcp->depth) {
+        adcp->grpp->end_cb(adcp, adcp->samples + half, half);
+        adcp->index = 0;
+    }
+}
+
+/* PWM */
+
+static uint64_t _pwm_ticks_to_us(PWMDriver *pwmp, pwmcnt_t ticks)
+{
+    return (uint64_t)ticks * 1000000ULL / pwmp->config->frequency;
+}
+
+static void _pwm_compare(void *par)
+{
+    PWMDriver *pwmp = &PWMD3;
+    pwmchannel_t channel = (pwmchannel_t)(uintptr_t)par;
+    pwmp->config->channels[channel].callback(pwmp);
+}
+
+static void _pwm_period(void *par)
+{
+    PWMDriver *pwmp = par;
+    uint64_t start = sim_now_us();
+    sim_timer_set_at(&pwmp->period_timer, start + _pwm_ticks_to_us(pwmp, pwmp->config->period), _pwm_period, pwmp);
+
+    if (pwmp->config->cr2 & TIM_CR2_MMS_1)
+        _adc_trigger(&ADCD1);
+    if (pwmp->config->callback)
+        pwmp->config->callback(pwmp);
+    for (pwmchannel_t ch = 0; ch < PWM_CHANNELS; ch++) {
+        if (!(pwmp->notifications & (1U << ch)) || pwmp->widths[ch] >= pwmp->config->period)
+            continue;
+        sim_timer_set_at(&pwmp->compare_timers[ch], start + _pwm_ticks_to_us(pwmp, pwmp->widths[ch]),
+                         _pwm_compare, (void *)(uintptr_t)ch);
+    }
+}
+
+void pwmStart(PWMDriver *pwmp, const PWMConfig *config)
+{
+    pwmp->config = config;
+    sim_timer_set_at(&pwmp->period_timer, sim_now_us() + _pwm_ticks_to_us(pwmp, config->period), _pwm_period, pwmp);
+}
+
+void pwmEnableChannelI(PWMDriver *pwmp, pwmchannel_t channel, pwmcnt_t width)
+{
+    pwmp->widths[channel] = width;
+}
+
+void pwmEnableChannelNotification(PWMDriver *pwmp, pwmchannel_t channel)
+{
+    pwmp->notifications |= 1U << channel;
+}
+
+/* Watchdog; the simulation never stalls long enough to matter */
+
+void wdgStart(WDGDriver *wdgp, const WDGConfig *config)
+{
+    wdgp->config = config;
+}
+
+void wdgReset(WDGDriver *wdgp)
+{
+    (void)wdgp;
+}
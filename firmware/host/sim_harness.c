@@ -0,0 +1,138 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sim_harness.h"
+#include "system_CAN.h"
+#include "system_LED.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define ADR1_PAD 0
+#define ADR2_PAD 4
+#define LEFT_BUTTON_PAD 8
+#define RIGHT_BUTTON_PAD 7
+
+/* Frame length on the bus without stuffing, including the interframe space */
+#define CAN_STD_FRAME_BITS 47
+#define CAN_EXT_FRAME_BITS 67
+#define CAN_IFS_BITS 3
+
+static uint8_t g_last_leds[TXBUF_LEN];
+static unsigned g_checks;
+static unsigned g_checks_failed;
+
+/* A cut ADR1 jumper reads high and a cut ADR2 (baud) jumper low, as system_CAN.c expects */
+void sim_board_init(bool adr1_cut, bool adr2_cut)
+{
+    sim_set_pad_input(GPIOA, ADR1_PAD, adr1_cut ? PAL_HIGH : PAL_LOW);
+    sim_set_pad_input(GPIOA, ADR2_PAD, adr2_cut ? PAL_LOW : PAL_HIGH);
+    /* the left button reads high when pressed, the right one low */
+    sim_set_pad_input(GPIOB, LEFT_BUTTON_PAD, PAL_LOW);
+    sim_set_pad_input(GPIOB, RIGHT_BUTTON_PAD, PAL_HIGH);
+}
+
+void sim_trace_time(void)
+{
+    uint64_t now = sim_now_us();
+    printf("%4lu.%06lu ", (unsigned long)(now / 1000000), (unsigned long)(now % 1000000));
+}
+
+void sim_trace_can_tx(const CANTxFrame *frame)
+{
+    sim_trace_time();
+    if (frame->IDE == CAN_IDE_EXT)
+        printf("CAN  %08X#", (unsigned)frame->EID);
+    else
+        printf("CAN  %03X#", (unsigned)frame->SID);
+    for (size_t i = 0; i < frame->DLC; i++) {
+        printf("%02X", frame->data8[i]);
+    }
+    printf("\n");
+}
+
+bool sim_trace_led_frame(const uint8_t *data, size_t length)
+{
+    if (length != TXBUF_LEN || !memcmp(data, g_last_leds, length))
+        return false;
+    memcpy(g_last_leds, data, length);
+    sim_trace_time();
+    printf("LED ");
+    for (size_t i = 0; i < LED_COUNT; i++) {
+        const uint8_t *led = data + APA102_LED_DATA_START + i * APA102_BYTES_PER_LED;
+        printf(" %02u:%02X%02X%02X", led[0] & ~APA102_GLOBAL_PREAMBLE, led[3], led[2], led[1]);
+    }
+    printf("\n");
+    return true;
+}
+
+void sim_trace_gpio(ioportid_t port, uint32_t odr)
+{
+    sim_trace_time();
+    printf("GPIO %c %04X\n", port == GPIOA ? 'A' : 'B', (unsigned)odr);
+}
+
+uint64_t sim_can_bus_time_us(const CANRxFrame *frame)
+{
+    uint32_t bits = (frame->IDE == CAN_IDE_EXT ? CAN_EXT_FRAME_BITS : CAN_STD_FRAME_BITS) +
+                    CAN_IFS_BITS + 8 * frame->DLC;
+    uint32_t bitrate = get_can_bitrate();
+    return ((uint64_t)bits * 1000000 + bitrate - 1) / bitrate;
+}
+
+bool sim_api_receive(uint32_t api_id, const uint8_t *data, uint8_t length)
+{
+    CANRxFrame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.IDE = CAN_IDE_EXT;
+    frame.EID = get_can_base_id() + api_id;
+    frame.DLC = length;
+    memcpy(frame.data8, data, length);
+    return sim_can_receive(&frame);
+}
+
+uint64_t sim_thread_cpu_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void sim_check(bool passed, const char *format, ...)
+{
+    g_checks++;
+    if (passed)
+        return;
+    g_checks_failed++;
+    va_list args;
+    va_start(args, format);
+    printf("FAIL: ");
+    vprintf(format, args);
+    printf("\n");
+    va_end(args);
+}
+
+int sim_test_status(const char *name)
+{
+    printf("%s: %u of %u checks passed\n", name, g_checks - g_checks_failed, g_checks);
+    return g_checks_failed || !g_checks ? 1 : 0;
+}
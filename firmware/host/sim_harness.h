@@ -0,0 +1,58 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Shared by the host harnesses and tests: board setup, printing of the
+ * simulated hardware's outputs, each line starting with the simulated
+ * time in seconds, message injection and test checks.
+ */
+
+#ifndef SIM_HARNESS_H_
+#define SIM_HARNESS_H_
+#include "sim.h"
+
+/* The firmware's main(), renamed by the build */
+int shiftx3_main(void);
+
+/* Set the CAN jumpers (cut means open) and release the buttons */
+void sim_board_init(bool adr1_cut, bool adr2_cut);
+
+void sim_trace_time(void);
+/* CAN frames in candump format */
+void sim_trace_can_tx(const CANTxFrame *frame);
+/* LED frames as brightness:RRGGBB per LED; returns false, printing nothing, if unchanged */
+bool sim_trace_led_frame(const uint8_t *data, size_t length);
+void sim_trace_gpio(ioportid_t port, uint32_t odr);
+
+/* Time a frame takes on the bus at the firmware's bit rate, without bit stuffing */
+uint64_t sim_can_bus_time_us(const CANRxFrame *frame);
+
+/* Receive an API message at the firmware's CAN base ID; false if the filters dropped it */
+bool sim_api_receive(uint32_t api_id, const uint8_t *data, uint8_t length);
+
+/* Host CPU time used by the calling thread, for benchmarks */
+uint64_t sim_thread_cpu_ns(void);
+
+/* Tests: count a check, printing it if it failed; the exit status for the test run */
+void sim_check(bool passed, const char *format, ...) __attribute__((format(printf, 2, 3)));
+int sim_test_status(const char *name);
+
+#endif /* SIM_HARNESS_H_ */
@@ -0,0 +1,418 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sim.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SIM_TICK_US (1000000 / CH_CFG_ST_FREQUENCY)
+
+enum sim_thread_state {
+    SIM_READY = 0,
+    SIM_SLEEPING,
+    SIM_WTEVT,
+    SIM_WTSEM,
+    SIM_FINAL
+};
+
+struct sim_thread {
+    struct sim_thread *next;
+    pthread_t pthread;
+    pthread_cond_t wakeup;
+    const char *name;
+    tprio_t prio;
+    enum sim_thread_state state;
+    msg_t rdymsg;
+    eventmask_t epending;
+    eventmask_t ewmask;
+    binary_semaphore_t *wtsem;
+    virtual_timer_t timeout;
+    tfunc_t func;
+    void *arg;
+};
+
+/* Held by whichever simulated thread is running */
+static pthread_mutex_t g_kernel_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct SimHooks g_hooks;
+static thread_t g_main_thread;
+static thread_t *g_threads;
+static thread_t *g_current;
+
+static uint64_t g_now_us;
+static uint64_t g_end_us = SIM_TIME_NEVER;
+static virtual_timer_t *g_timers;
+
+void sim_start(const struct SimHooks *hooks)
+{
+    g_hooks = *hooks;
+    pthread_mutex_lock(&g_kernel_lock);
+    g_main_thread.pthread = pthread_self();
+    pthread_cond_init(&g_main_thread.wakeup, NULL);
+    g_main_thread.name = "main";
+    g_main_thread.prio = NORMALPRIO;
+    g_main_thread.state = SIM_READY;
+    chVTObjectInit(&g_main_thread.timeout);
+    g_threads = &g_main_thread;
+    g_current = &g_main_thread;
+}
+
+void sim_set_end_time(uint64_t end_us)
+{
+    g_end_us = end_us;
+}
+
+const struct SimHooks *sim_hooks(void)
+{
+    return &g_hooks;
+}
+
+void sim_finish(void)
+{
+    if (g_hooks.finish)
+        g_hooks.finish();
+    fflush(NULL);
+    exit(0);
+}
+
+uint64_t sim_now_us(void)
+{
+    return g_now_us;
+}
+
+const char *sim_thread_name(const thread_t *tp)
+{
+    return tp->name;
+}
+
+/* Timers */
+
+void chVTObjectInit(virtual_timer_t *vtp)
+{
+    vtp->armed = false;
+}
+
+void chVTResetI(virtual_timer_t *vtp)
+{
+    if (!vtp->armed)
+        return;
+    for (virtual_timer_t **p = &g_timers; *p; p = &(*p)->next) {
+        if (*p == vtp) {
+            *p = vtp->next;
+            break;
+        }
+    }
+    vtp->armed = false;
+}
+
+void sim_timer_set_at(virtual_timer_t *vtp, uint64_t due_us, vtfunc_t func, void *par)
+{
+    chVTResetI(vtp);
+    vtp->due_us = due_us;
+    vtp->func = func;
+    vtp->par = par;
+    vtp->armed = true;
+    vtp->next = g_timers;
+    g_timers = vtp;
+}
+
+systime_t chVTGetSystemTimeX(void)
+{
+    return (systime_t)(g_now_us / SIM_TICK_US);
+}
+
+void chVTSetI(virtual_timer_t *vtp, systime_t delay, vtfunc_t vtfunc, void *par)
+{
+    /* tickless mode can't arm closer than the minimum delta */
+    if (delay < CH_CFG_ST_TIMEDELTA)
+        delay = CH_CFG_ST_TIMEDELTA;
+    uint64_t due_us = (g_now_us / SIM_TICK_US + delay) * SIM_TICK_US;
+    sim_timer_set_at(vtp, due_us, vtfunc, par);
+}
+
+static virtual_timer_t * _next_timer(void)
+{
+    virtual_timer_t *next = NULL;
+    for (virtual_timer_t *vtp = g_timers; vtp; vtp = vtp->next) {
+        if (!next || vtp->due_us < next->due_us)
+            next = vtp;
+    }
+    return next;
+}
+
+/* Call the timers now due, earliest first, as the timer interrupt would */
+static void _fire_due_timers(void)
+{
+    virtual_timer_t *vtp;
+    while ((vtp = _next_timer()) && vtp->due_us <= g_now_us) {
+        chVTResetI(vtp);
+        vtp->func(vtp->par);
+    }
+}
+
+/* Scheduling */
+
+static void _ready(thread_t *tp, msg_t msg)
+{
+    chVTResetI(&tp->timeout);
+    tp->state = SIM_READY;
+    tp->rdymsg = msg;
+}
+
+static void _timeout_callback(void *par)
+{
+    _ready(par, MSG_TIMEOUT);
+}
+
+static thread_t * _highest_ready(void)
+{
+    thread_t *best = g_current->state == SIM_READY ? g_current : NULL;
+    for (thread_t *tp = g_threads; tp; tp = tp->next) {
+        if (tp->state == SIM_READY && (!best || tp->prio > best->prio))
+            best = tp;
+    }
+    return best;
+}
+
+/* Nothing can run: advance time to the next thing due and handle it */
+static void _idle(void)
+{
+    virtual_timer_t *next = _next_timer();
+    uint64_t next_us = next ? next->due_us : SIM_TIME_NEVER;
+    uint64_t until = g_hooks.idle ? g_hooks.idle(next_us) : next_us;
+
+    if (until > g_end_us) {
+        g_now_us = g_end_us;
+        sim_finish();
+    }
+    if (until == SIM_TIME_NEVER) {
+        fprintf(stderr, "sim: every thread is blocked and no timer is armed\n");
+        sim_finish();
+    }
+    if (until > g_now_us)
+        g_now_us = until;
+    _fire_due_timers();
+}
+
+/* Hand over to the highest priority ready thread, if that isn't us */
+static void _reschedule(void)
+{
+    thread_t *self = g_current;
+    thread_t *next;
+    while ((next = _highest_ready()) == NULL)
+        _idle();
+    if (next == self)
+        return;
+
+    g_current = next;
+    pthread_cond_signal(&next->wakeup);
+    while (g_current != self)
+        pthread_cond_wait(&self->wakeup, &g_kernel_lock);
+}
+
+/* Preempt the caller if a thread it readied outranks it */
+static void _reschedule_if_preempted(void)
+{
+    if (_highest_ready() != g_current)
+        _reschedule();
+}
+
+static msg_t _suspend(enum sim_thread_state state, systime_t timeout)
+{
+    thread_t *self = g_current;
+    self->state = state;
+    if (timeout != TIME_INFINITE)
+        chVTSetI(&self->timeout, timeout, _timeout_callback, self);
+    _reschedule();
+    return self->rdymsg;
+}
+
+/* Threads */
+
+static void * _thread_start(void *arg)
+{
+    thread_t *self = arg;
+    pthread_mutex_lock(&g_kernel_lock);
+    while (g_current != self)
+        pthread_cond_wait(&self->wakeup, &g_kernel_lock);
+    self->func(self->arg);
+
+    self->state = SIM_FINAL;
+    _reschedule();
+    return NULL;
+}
+
+thread_t *chThdCreateStatic(void *wsp, size_t size, tprio_t prio, tfunc_t pf, void *arg)
+{
+    (void)wsp;
+    (void)size;
+    thread_t *tp = calloc(1, sizeof(*tp));
+    if (!tp) {
+        perror("sim: thread");
+        exit(1);
+    }
+    pthread_cond_init(&tp->wakeup, NULL);
+    tp->name = "noname";
+    tp->prio = prio;
+    tp->state = SIM_READY;
+    tp->func = pf;
+    tp->arg = arg;
+    chVTObjectInit(&tp->timeout);
+    tp->next = g_threads;
+    g_threads = tp;
+    if (pthread_create(&tp->pthread, NULL, _thread_start, tp)) {
+        perror("sim: pthread_create");
+        exit(1);
+    }
+    _reschedule_if_preempted();
+    return tp;
+}
+
+thread_t *chThdGetSelfX(void)
+{
+    return g_current;
+}
+
+void chRegSetThreadName(const char *name)
+{
+    g_current->name = name;
+}
+
+void chThdSleep(systime_t time)
+{
+    _suspend(SIM_SLEEPING, time);
+}
+
+void chSysInit(void)
+{
+}
+
+/* Events */
+
+void chEvtObjectInit(event_source_t *esp)
+{
+    esp->next = NULL;
+}
+
+void chEvtRegisterMaskWithFlags(event_source_t *esp, event_listener_t *elp, eventmask_t events, eventflags_t wflags)
+{
+    elp->listener = g_current;
+    elp->events = events;
+    elp->flags = 0;
+    elp->wflags = wflags;
+    elp->next = esp->next;
+    esp->next = elp;
+}
+
+void chEvtUnregister(event_source_t *esp, event_listener_t *elp)
+{
+    for (event_listener_t **p = &esp->next; *p; p = &(*p)->next) {
+        if (*p == elp) {
+            *p = elp->next;
+            break;
+        }
+    }
+}
+
+eventflags_t chEvtGetAndClearFlags(event_listener_t *elp)
+{
+    eventflags_t flags = elp->flags;
+    elp->flags = 0;
+    return flags;
+}
+
+void chEvtSignalI(thread_t *tp, eventmask_t events)
+{
+    tp->epending |= events;
+    if (tp->state == SIM_WTEVT && (tp->epending & tp->ewmask))
+        _ready(tp, MSG_OK);
+}
+
+void chEvtSignal(thread_t *tp, eventmask_t events)
+{
+    chEvtSignalI(tp, events);
+    _reschedule_if_preempted();
+}
+
+void chEvtBroadcastFlagsI(event_source_t *esp, eventflags_t flags)
+{
+    for (event_listener_t *elp = esp->next; elp; elp = elp->next) {
+        elp->flags |= flags;
+        if (flags == 0 || (elp->wflags & flags))
+            chEvtSignalI(elp->listener, elp->events);
+    }
+}
+
+eventmask_t chEvtWaitAnyTimeout(eventmask_t events, systime_t time)
+{
+    thread_t *self = g_current;
+    eventmask_t m = self->epending & events;
+    if (!m) {
+        if (time == TIME_IMMEDIATE)
+            return 0;
+        self->ewmask = events;
+        if (_suspend(SIM_WTEVT, time) != MSG_OK)
+            return 0;
+        m = self->epending & events;
+    }
+    self->epending &= ~m;
+    return m;
+}
+
+/* Binary semaphores */
+
+void chBSemObjectInit(binary_semaphore_t *bsp, bool taken)
+{
+    bsp->taken = taken;
+}
+
+msg_t chBSemWaitTimeout(binary_semaphore_t *bsp, systime_t time)
+{
+    if (!bsp->taken) {
+        bsp->taken = true;
+        return MSG_OK;
+    }
+    if (time == TIME_IMMEDIATE)
+        return MSG_TIMEOUT;
+    g_current->wtsem = bsp;
+    return _suspend(SIM_WTSEM, time);
+}
+
+void chBSemSignalI(binary_semaphore_t *bsp)
+{
+    thread_t *waiter = NULL;
+    for (thread_t *tp = g_threads; tp; tp = tp->next) {
+        if (tp->state == SIM_WTSEM && tp->wtsem == bsp && (!waiter || tp->prio > waiter->prio))
+            waiter = tp;
+    }
+    /* a waiter takes the semaphore over; otherwise it is released */
+    if (waiter)
+        _ready(waiter, MSG_OK);
+    else
+        bsp->taken = false;
+}
+
+void chBSemSignal(binary_semaphore_t *bsp)
+{
+    chBSemSignalI(bsp);
+    _reschedule_if_preempted();
+}
@@ -0,0 +1,54 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Peripheral register bits used by the application, for the host build */
+
+#ifndef STM32F042X6_H_
+#define STM32F042X6_H_
+
+#define CAN_MCR_TXFP 0x04U
+#define CAN_MCR_NART 0x10U
+#define CAN_MCR_AWUM 0x20U
+#define CAN_MCR_ABOM 0x40U
+#define CAN_BTR_BRP(n) ((uint32_t)(n) << 0U)
+#define CAN_BTR_TS1(n) ((uint32_t)(n) << 16U)
+#define CAN_BTR_TS2(n) ((uint32_t)(n) << 20U)
+#define CAN_BTR_SJW(n) ((uint32_t)(n) << 24U)
+#define CAN_RF0R_FMP0 0x03U
+#define CAN_RF1R_FMP1 0x03U
+
+#define SPI_CR1_CPHA (1U << 0U)
+#define SPI_CR1_CPOL (1U << 1U)
+#define SPI_CR1_BR_Pos 3U
+#define SPI_CR1_BR_0 (1U << 3U)
+#define SPI_CR2_DS_0 (1U << 8U)
+#define SPI_CR2_DS_1 (1U << 9U)
+#define SPI_CR2_DS_2 (1U << 10U)
+
+#define TIM_CR2_MMS_1 (1U << 5U)
+
+#define ADC_CFGR1_RES_12BIT (0U << 3U)
+#define ADC_CFGR1_EXTSEL_SRC(n) ((n) << 6U)
+#define ADC_CFGR1_EXTEN_RISING (1U << 10U)
+#define ADC_SMPR_SMP_239P5 7U
+#define ADC_CHSELR_CHSEL1 (1U << 1U)
+
+#endif /* STM32F042X6_H_ */
@@ -0,0 +1,233 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * CAN acceptance filters. Checks the filter bank computation directly,
+ * then offers the firmware the same mix of foreign and API traffic with
+ * its filters programmed and with the driver's accept-all filter, and
+ * counts the frames that reach software each way.
+ */
+
+#include "sim_harness.h"
+#include "shiftx3_api.h"
+#include "system_CAN.h"
+#include "system_CAN_filter.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BASE_ID 0xE3600
+#define MAX_BANKS 8
+
+#define TRAFFIC_START_US 500000
+/* well apart, so the receive FIFOs never overrun */
+#define TRAFFIC_STEP_US 500
+
+/* Register layout for 32 bit scale filters: EXID[28:0] | IDE | RTR | 0 */
+#define ID_REGISTER(id) (((uint32_t)(id) << 3) | 0x04)
+#define MASK_REGISTER(mask) (((uint32_t)(mask) << 3) | 0x06)
+#define MODE_MASK 0
+#define MODE_LIST 1
+
+static void _check_bank(const CANFilter *bank, size_t index, uint32_t mode, uint32_t fifo,
+                        uint32_t register1, uint32_t register2)
+{
+    sim_check(bank->filter == index && bank->mode == mode && bank->scale == 1 &&
+              bank->assignment == fifo && bank->register1 == register1 && bank->register2 == register2,
+              "bank %zu: filter %u mode %u scale %u fifo %u registers %08X %08X, expected mode %u fifo %u registers %08X %08X",
+              index, (unsigned)bank->filter, (unsigned)bank->mode, (unsigned)bank->scale,
+              (unsigned)bank->assignment, (unsigned)bank->register1, (unsigned)bank->register2,
+              (unsigned)mode, (unsigned)fifo, (unsigned)register1, (unsigned)register2);
+}
+
+/* The firmware's layout: exact live value IDs into FIFO 0, the rest of the window into FIFO 1 */
+static void _test_api_window(void)
+{
+    static const uint32_t live[] = {10, 20, 22, 42, 50};
+    struct CanFilterSpec specs[6];
+    for (size_t i = 0; i < 5; i++) {
+        specs[i] = (struct CanFilterSpec) {BASE_ID + live[i], CAN_FILTER_EXACT_MASK, 0};
+    }
+    specs[5] = (struct CanFilterSpec) {BASE_ID, SHIFTX3_CAN_FILTER_MASK, 1};
+
+    CANFilter banks[MAX_BANKS];
+    size_t count = can_filter_build_banks(specs, 6, banks, MAX_BANKS);
+    sim_check(count == 4, "API window took %zu banks, expected 4", count);
+    if (count != 4)
+        return;
+    _check_bank(&banks[0], 0, MODE_MASK, 1, ID_REGISTER(BASE_ID), MASK_REGISTER(SHIFTX3_CAN_FILTER_MASK));
+    _check_bank(&banks[1], 1, MODE_LIST, 0, ID_REGISTER(BASE_ID + 10), ID_REGISTER(BASE_ID + 20));
+    _check_bank(&banks[2], 2, MODE_LIST, 0, ID_REGISTER(BASE_ID + 22), ID_REGISTER(BASE_ID + 42));
+    /* an odd ID out fills both slots of its bank */
+    _check_bank(&banks[3], 3, MODE_LIST, 0, ID_REGISTER(BASE_ID + 50), ID_REGISTER(BASE_ID + 50));
+}
+
+/* Exact IDs only share a bank with IDs bound for the same FIFO */
+static void _test_fifo_pairing(void)
+{
+    const struct CanFilterSpec specs[] = {
+        {0x100, CAN_FILTER_EXACT_MASK, 0},
+        {0x200, CAN_FILTER_EXACT_MASK, 1},
+        {0x300, CAN_FILTER_EXACT_MASK, 0},
+        {0x400, CAN_FILTER_EXACT_MASK, 1},
+        {0x500, CAN_FILTER_EXACT_MASK, 1},
+    };
+    CANFilter banks[MAX_BANKS];
+    size_t count = can_filter_build_banks(specs, 5, banks, MAX_BANKS);
+    sim_check(count == 3, "5 exact IDs over 2 FIFOs took %zu banks, expected 3", count);
+    if (count != 3)
+        return;
+    _check_bank(&banks[0], 0, MODE_LIST, 0, ID_REGISTER(0x100), ID_REGISTER(0x300));
+    _check_bank(&banks[1], 1, MODE_LIST, 1, ID_REGISTER(0x200), ID_REGISTER(0x400));
+    _check_bank(&banks[2], 2, MODE_LIST, 1, ID_REGISTER(0x500), ID_REGISTER(0x500));
+}
+
+/* Specs that do not fit, or name a FIFO that does not exist, fail open */
+static void _test_fail_open(void)
+{
+    struct CanFilterSpec specs[MAX_BANKS + 1];
+    for (size_t i = 0; i < MAX_BANKS + 1; i++) {
+        specs[i] = (struct CanFilterSpec) {BASE_ID + (i << 8), SHIFTX3_CAN_FILTER_MASK, 1};
+    }
+    CANFilter banks[MAX_BANKS];
+    size_t count = can_filter_build_banks(specs, MAX_BANKS + 1, banks, MAX_BANKS);
+    sim_check(count == 0, "%d ranges in %d banks returned %zu banks", MAX_BANKS + 1, MAX_BANKS, count);
+
+    /* 2 * MAX_BANKS exact IDs just fit; one more does not */
+    struct CanFilterSpec exact[2 * MAX_BANKS + 1];
+    for (size_t i = 0; i < 2 * MAX_BANKS + 1; i++) {
+        exact[i] = (struct CanFilterSpec) {BASE_ID + i, CAN_FILTER_EXACT_MASK, 0};
+    }
+    count = can_filter_build_banks(exact, 2 * MAX_BANKS, banks, MAX_BANKS);
+    sim_check(count == MAX_BANKS, "%d exact IDs took %zu banks", 2 * MAX_BANKS, count);
+    count = can_filter_build_banks(exact, 2 * MAX_BANKS + 1, banks, MAX_BANKS);
+    sim_check(count == 0, "%d exact IDs in %d banks returned %zu banks", 2 * MAX_BANKS + 1, MAX_BANKS, count);
+
+    const struct CanFilterSpec bad_fifo = {BASE_ID, CAN_FILTER_EXACT_MASK, CAN_FILTER_FIFO_COUNT};
+    count = can_filter_build_banks(&bad_fifo, 1, banks, MAX_BANKS);
+    sim_check(count == 0, "a spec for FIFO %d returned %zu banks", CAN_FILTER_FIFO_COUNT, count);
+}
+
+/*
+ * Bus traffic: an ECU's broadcast IDs, extended IDs just outside the
+ * API window, a remote frame, and the API messages for this device.
+ */
+struct TrafficFrame {
+    uint32_t id;
+    bool extended;
+    bool remote;
+    bool in_window;
+};
+
+static const struct TrafficFrame g_traffic[] = {
+    {0x100, false, false, false},
+    {0x360, false, false, false},
+    {0x7E8, false, false, false},
+    {BASE_ID + 42, false, false, false},
+    {BASE_ID - 1, true, false, false},
+    {BASE_ID + SHIFTX3_CAN_API_RANGE, true, false, false},
+    {BASE_ID ^ 0x10000, true, false, false},
+    {0x0CF00400, true, false, false},
+    {BASE_ID + 42, true, true, false},
+    {BASE_ID + API_SET_CURRENT_LINEAR_GRAPH_VALUE, true, false, true},
+    {BASE_ID + API_SET_CURRENT_ALERT_VALUE, true, false, true},
+    {BASE_ID + API_SET_DISPLAY_VALUE, true, false, true},
+    /* in the window, but not an API message */
+    {BASE_ID + 200, true, false, true},
+};
+#define TRAFFIC_FRAMES (sizeof(g_traffic) / sizeof(g_traffic[0]))
+/* passes of the traffic with filtering, then as many without */
+#define TRAFFIC_PASSES 20
+
+static virtual_timer_t g_traffic_timer;
+static size_t g_traffic_index;
+static uint32_t g_window_frames;
+static uint32_t g_filtered_rx_frames;
+static uint32_t g_unfiltered_rx_frames;
+static uint32_t g_foreign_accepted;
+
+static void _send_traffic(void *par)
+{
+    (void)par;
+    size_t pass = g_traffic_index / TRAFFIC_FRAMES;
+    const struct TrafficFrame *traffic = &g_traffic[g_traffic_index % TRAFFIC_FRAMES];
+    bool filtering = pass < TRAFFIC_PASSES;
+
+    if (g_traffic_index == TRAFFIC_PASSES * TRAFFIC_FRAMES) {
+        /* the driver's default, as with CAN_HARDWARE_FILTERING disabled */
+        g_filtered_rx_frames = get_can_stats()->rx_frames;
+        canSTM32SetFilters(1, 0, NULL);
+    }
+    if (g_traffic_index == 2 * TRAFFIC_PASSES * TRAFFIC_FRAMES) {
+        g_unfiltered_rx_frames = get_can_stats()->rx_frames - g_filtered_rx_frames;
+        sim_finish();
+    }
+
+    CANRxFrame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.IDE = traffic->extended ? CAN_IDE_EXT : CAN_IDE_STD;
+    if (traffic->extended)
+        frame.EID = traffic->id;
+    else
+        frame.SID = traffic->id;
+    frame.RTR = traffic->remote ? CAN_RTR_REMOTE : CAN_RTR_DATA;
+    frame.DLC = 8;
+    bool accepted = sim_can_receive(&frame);
+    if (filtering) {
+        g_window_frames += traffic->in_window;
+        if (accepted && !traffic->in_window)
+            g_foreign_accepted++;
+        sim_check(accepted || !traffic->in_window, "API window frame %08X was filtered out",
+                  (unsigned)traffic->id);
+    }
+    g_traffic_index++;
+    sim_timer_set_at(&g_traffic_timer, sim_now_us() + TRAFFIC_STEP_US, _send_traffic, NULL);
+}
+
+static void _finish(void)
+{
+    uint32_t offered = TRAFFIC_PASSES * TRAFFIC_FRAMES;
+    printf("frames reaching software: %u of %u with filtering, %u of %u without\n",
+           g_filtered_rx_frames, offered, g_unfiltered_rx_frames, offered);
+    sim_check(g_foreign_accepted == 0, "%u frames outside the API window were accepted", g_foreign_accepted);
+    sim_check(g_filtered_rx_frames == g_window_frames, "%u frames reached software with filtering, expected %u",
+              g_filtered_rx_frames, g_window_frames);
+    sim_check(g_unfiltered_rx_frames == offered, "%u frames reached software without filtering, expected %u",
+              g_unfiltered_rx_frames, offered);
+    exit(sim_test_status("test_can_filter"));
+}
+
+static const struct SimHooks hooks = {
+    .finish = _finish
+};
+
+int main(void)
+{
+    _test_api_window();
+    _test_fifo_pairing();
+    _test_fail_open();
+
+    sim_start(&hooks);
+    sim_board_init(false, false);
+    chVTObjectInit(&g_traffic_timer);
+    sim_timer_set_at(&g_traffic_timer, TRAFFIC_START_US, _send_traffic, NULL);
+    return shiftx3_main();
+}
@@ -0,0 +1,196 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * CAN receive flood. First hammers the receive queue from two host
+ * threads, a producer and a consumer preempting each other at arbitrary
+ * points, and checks every frame comes out once, whole and in order,
+ * with drops and the high water mark counted. Then runs the firmware on a 1Mbit bus saturated
+ * with live value updates, back to back for two seconds, and checks
+ * nothing is lost between the bus and the render stage.
+ */
+
+#include "sim_harness.h"
+#include "shiftx3_api.h"
+#include "system_CAN.h"
+#include "system_CAN_queue.h"
+#include "system_LED.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RING_FRAMES 1000000
+
+#define FLOOD_START_US 500000
+#define FLOOD_US 2000000
+#define FLOOD_END_US (FLOOD_START_US + FLOOD_US)
+
+/* Queue stress: the frame's sequence number travels in its data */
+
+static atomic_bool g_producer_done;
+static uint32_t g_pushed;
+static uint32_t g_push_failures;
+
+static void * _produce(void *arg)
+{
+    (void)arg;
+    CANRxFrame frame;
+    memset(&frame, 0, sizeof(frame));
+    for (uint32_t seq = 0; seq < RING_FRAMES; seq++) {
+        frame.data32[0] = seq;
+        frame.data32[1] = ~seq;
+        if (can_rx_queue_push(&frame)) {
+            g_pushed++;
+        } else {
+            /* full; let the consumer catch up */
+            g_push_failures++;
+            sched_yield();
+        }
+    }
+    atomic_store(&g_producer_done, true);
+    return NULL;
+}
+
+static void _test_queue(void)
+{
+    pthread_t producer;
+    pthread_create(&producer, NULL, _produce, NULL);
+
+    uint32_t popped = 0;
+    uint32_t out_of_order = 0;
+    uint32_t corrupt = 0;
+    int64_t last_seq = -1;
+    CANRxFrame frame;
+    for (;;) {
+        bool done = atomic_load(&g_producer_done);
+        if (!can_rx_queue_pop(&frame)) {
+            if (done)
+                break;
+            sched_yield();
+            continue;
+        }
+        popped++;
+        if ((int64_t)frame.data32[0] <= last_seq)
+            out_of_order++;
+        if (frame.data32[1] != ~frame.data32[0])
+            corrupt++;
+        last_seq = frame.data32[0];
+    }
+    pthread_join(producer, NULL);
+
+    const struct CanQueueStats *stats = get_can_rx_queue_stats();
+    printf("queue: %u frames pushed, %u popped, %u dropped, high water %u of %u\n",
+           g_pushed, popped, stats->drops, stats->high_water, CAN_RX_QUEUE_SIZE);
+    sim_check(g_pushed >= RING_FRAMES / 2, "only %u of %u frames pushed", g_pushed, RING_FRAMES);
+    sim_check(popped == g_pushed, "%u frames pushed but %u popped", g_pushed, popped);
+    sim_check(out_of_order == 0, "%u frames popped out of order", out_of_order);
+    sim_check(corrupt == 0, "%u frames popped torn", corrupt);
+    sim_check(stats->drops == g_push_failures, "%u drops counted for %u failed pushes",
+              stats->drops, g_push_failures);
+    sim_check(stats->high_water <= CAN_RX_QUEUE_SIZE, "high water %u beyond the queue size", stats->high_water);
+}
+
+/* Bus flood */
+
+static virtual_timer_t g_flood_timer;
+static uint32_t g_offered;
+static uint32_t g_accepted;
+static uint32_t g_led_frames;
+static uint32_t g_queue_drops_before;
+
+static void _flood(void *par)
+{
+    (void)par;
+    if (g_offered == 0)
+        g_queue_drops_before = get_can_rx_queue_stats()->drops;
+
+    /* mostly the linear graph, as an RPM stream would be, with alert and display values */
+    static const uint8_t api_ids[] = {API_SET_CURRENT_LINEAR_GRAPH_VALUE, API_SET_CURRENT_LINEAR_GRAPH_VALUE,
+                                      API_SET_CURRENT_ALERT_VALUE, API_SET_CURRENT_LINEAR_GRAPH_VALUE,
+                                      API_SET_DISPLAY_VALUE};
+    CANRxFrame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.IDE = CAN_IDE_EXT;
+    frame.EID = get_can_base_id() + api_ids[g_offered % sizeof(api_ids)];
+    frame.DLC = 3;
+    frame.data8[0] = frame.EID == get_can_base_id() + API_SET_CURRENT_ALERT_VALUE ? 0 : g_offered;
+    frame.data8[1] = g_offered >> 3;
+    frame.data8[2] = g_offered >> 8;
+    g_offered++;
+    g_accepted += sim_can_receive(&frame);
+
+    /* back to back: the next frame follows as soon as this one is off the bus */
+    uint64_t next = sim_now_us() + sim_can_bus_time_us(&frame);
+    if (next < FLOOD_END_US)
+        sim_timer_set_at(&g_flood_timer, next, _flood, NULL);
+}
+
+static void _spi_tx(const uint8_t *data, size_t length)
+{
+    uint64_t now = sim_now_us();
+    if (now >= FLOOD_START_US && now < FLOOD_END_US)
+        g_led_frames++;
+}
+
+static void _finish(void)
+{
+    const struct CanStats *can = get_can_stats();
+    const struct CanQueueStats *queue = get_can_rx_queue_stats();
+    const struct ApiRenderStats *render = get_api_render_stats();
+    double seconds = FLOOD_US / 1e6;
+    printf("flood: %u frames at %.0f/s on a %u bit/s bus, %u accepted, %u reached software\n",
+           g_offered, g_offered / seconds, get_can_bitrate(), g_accepted, can->rx_frames);
+    printf("flood: queue high water %u, %u dropped; %u FIFO 0 and %u FIFO 1 overruns\n",
+           queue->high_water, queue->drops - g_queue_drops_before,
+           can->rx_fifo0_overruns, can->rx_fifo1_overruns);
+    printf("flood: %u renders, %u updates coalesced, %.0f LED frames/s\n",
+           render->renders, render->renders_skipped, g_led_frames / seconds);
+
+    sim_check(get_can_bitrate() == 1000000, "bus at %u bit/s", get_can_bitrate());
+    sim_check(g_accepted == g_offered, "%u of %u frames accepted by the filters", g_accepted, g_offered);
+    sim_check(can->rx_frames == g_accepted, "%u frames reached software of %u accepted", can->rx_frames, g_accepted);
+    sim_check(can->rx_fifo0_overruns == 0 && can->rx_fifo1_overruns == 0, "receive FIFOs overran");
+    sim_check(queue->drops == g_queue_drops_before, "%u frames dropped by the receive queue",
+              queue->drops - g_queue_drops_before);
+    sim_check(render->renders > 0 && g_led_frames > 0, "nothing rendered during the flood");
+    exit(sim_test_status("test_can_flood"));
+}
+
+static const struct SimHooks hooks = {
+    .spi_tx = _spi_tx,
+    .finish = _finish
+};
+
+int main(void)
+{
+    _test_queue();
+
+    sim_start(&hooks);
+    sim_set_end_time(FLOOD_END_US + 100000);
+    /* ADR2 cut: 1Mbit */
+    sim_board_init(false, true);
+    chVTObjectInit(&g_flood_timer);
+    sim_timer_set_at(&g_flood_timer, FLOOD_START_US, _flood, NULL);
+    return shiftx3_main();
+}
@@ -0,0 +1,171 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Logging over CAN. Enables the CAN log at a low frame rate, then logs
+ * far more than it allows, with a message that logs an error every
+ * 10ms. Checks that:
+ *  - every record still reaches the serial port, with none dropped from
+ *    the log buffer
+ *  - CAN log frames are spaced by the frame rate, and use all of it
+ *  - each record sent over CAN is complete, and those that don't fit the
+ *    budget are counted
+ */
+
+#include "sim_harness.h"
+#include "shiftx3_api.h"
+#include "system_CAN_log.h"
+#include "logging.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CONFIG_US           1100000
+#define LOG_START_US        1200000
+#define LOG_INTERVAL_US     10000
+#define LOG_RECORDS         200
+#define END_US              (LOG_START_US + LOG_RECORDS * LOG_INTERVAL_US + 500000)
+
+#define LOG_FRAME_RATE      10
+#define LOG_FRAME_US        (1000000 / LOG_FRAME_RATE)
+/* tenths of a percent; the frame rate is the tighter limit */
+#define LOG_BUS_SHARE       255
+
+#define INVALID_ALERT_ID    0xFF
+#define FRAGMENT_SHIFT      4
+
+static virtual_timer_t g_step_timer;
+static uint32_t g_logged;
+
+static uint32_t g_serial_records;
+static uint32_t g_serial_records_at_start;
+
+static uint64_t g_last_frame_us;
+static uint64_t g_min_spacing_us = UINT64_MAX;
+static uint32_t g_frames;
+static uint32_t g_complete_records;
+static uint32_t g_broken_records;
+static int g_expected_fragment;
+static int g_fragments;
+static uint8_t g_sequence;
+
+static void _step(void *par)
+{
+    (void)par;
+    uint64_t now = sim_now_us();
+
+    if (now == CONFIG_US) {
+        const uint8_t config[] = {0, 51, 0};
+        sim_api_receive(API_SET_CONFIG_GROUP_1, config, sizeof(config));
+        /* info level, every subsystem */
+        const uint8_t log_config[] = {1, 0xFF, 0xFF, LOG_FRAME_RATE, LOG_BUS_SHARE};
+        sim_api_receive(API_SET_LOG_CONFIG, log_config, sizeof(log_config));
+        sim_timer_set_at(&g_step_timer, LOG_START_US, _step, NULL);
+        return;
+    }
+    if (now >= END_US) {
+        sim_finish();
+        return;
+    }
+    if (g_logged < LOG_RECORDS) {
+        if (!g_logged)
+            g_serial_records_at_start = g_serial_records;
+        const uint8_t value[] = {INVALID_ALERT_ID, 0, 0};
+        sim_api_receive(API_SET_CURRENT_ALERT_VALUE, value, sizeof(value));
+        g_logged++;
+        sim_timer_set_at(&g_step_timer, now + LOG_INTERVAL_US, _step, NULL);
+    } else {
+        sim_timer_set_at(&g_step_timer, END_US, _step, NULL);
+    }
+}
+
+/* Each record is written in one go, ending with its delimiter */
+static void _serial_tx(const uint8_t *data, size_t length)
+{
+    g_serial_records += length > 0 && data[length - 1] == 0;
+}
+
+static void _can_tx(const CANTxFrame *frame)
+{
+    if (frame->EID - get_can_base_id() != API_LOG_RECORD)
+        return;
+
+    uint64_t now = sim_now_us();
+    if (g_frames++ && now - g_last_frame_us < g_min_spacing_us)
+        g_min_spacing_us = now - g_last_frame_us;
+    g_last_frame_us = now;
+
+    /* the first fragment starts with the header word, the argument count in its third byte */
+    int fragment = frame->data8[0] >> FRAGMENT_SHIFT;
+    if (fragment == 0) {
+        g_broken_records += g_expected_fragment != 0;
+        g_sequence = frame->data8[0];
+        size_t length = (LOG_RECORD_HEADER_WORDS + frame->data8[3]) * sizeof(uint32_t);
+        g_fragments = (length + CAN_LOG_FRAGMENT_BYTES - 1) / CAN_LOG_FRAGMENT_BYTES;
+        g_expected_fragment = 1;
+    } else if (fragment == g_expected_fragment && frame->data8[0] == (g_sequence | fragment << FRAGMENT_SHIFT)) {
+        g_expected_fragment++;
+    } else {
+        g_broken_records++;
+        g_expected_fragment = 0;
+    }
+    if (g_expected_fragment && g_expected_fragment == g_fragments) {
+        g_complete_records++;
+        g_expected_fragment = 0;
+    }
+}
+
+static void _finish(void)
+{
+    const struct CanLogStats *stats = get_can_log_stats();
+    uint32_t serial_records = g_serial_records - g_serial_records_at_start;
+    /* frames are only wanted while records are logged */
+    uint32_t budget = LOG_RECORDS * LOG_INTERVAL_US / LOG_FRAME_US;
+    printf("%u records logged: %u to serial, %u dropped from the log buffer; "
+           "over CAN %u frames (%u complete records), %u records dropped, frames at least %.1fms apart\n",
+           g_logged, serial_records, get_log_drops(), g_frames, g_complete_records,
+           stats->records_dropped, g_min_spacing_us / 1000.0);
+    sim_check(serial_records >= LOG_RECORDS, "only %u of %u records reached the serial port",
+              serial_records, LOG_RECORDS);
+    sim_check(get_log_drops() == 0, "%u records dropped from the log buffer", get_log_drops());
+    sim_check(g_min_spacing_us >= LOG_FRAME_US, "CAN log frames %.1fms apart", g_min_spacing_us / 1000.0);
+    sim_check(g_frames >= budget && g_frames <= budget + 4, "%u CAN log frames for a budget of %u",
+              g_frames, budget);
+    sim_check(g_broken_records == 0, "%u incomplete records over CAN", g_broken_records);
+    sim_check(stats->frames_failed == 0, "%u CAN log frames not sent", stats->frames_failed);
+    sim_check(stats->records_dropped > 0 && stats->records_dropped + g_complete_records >= LOG_RECORDS,
+              "%u records dropped from CAN, %u sent", stats->records_dropped, g_complete_records);
+    exit(sim_test_status("test_can_log"));
+}
+
+static const struct SimHooks hooks = {
+    .can_tx = _can_tx,
+    .serial_tx = _serial_tx,
+    .finish = _finish
+};
+
+int main(void)
+{
+    sim_start(&hooks);
+    sim_board_init(false, false);
+    chVTObjectInit(&g_step_timer);
+    sim_timer_set_at(&g_step_timer, CONFIG_US, _step, NULL);
+    return shiftx3_main();
+}
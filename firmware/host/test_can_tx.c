@@ -0,0 +1,126 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * CAN transmit latency. Presses a button while the periodic statistics
+ * broadcast is going out, with the transmit mailboxes held for each
+ * frame's time on the bus. Checks that:
+ *  - the button state goes out from the tick that sees the press,
+ *    rather than waiting behind the broadcast
+ *  - the broadcast still sends every statistic, in order
+ *  - nothing is dropped from the transmit queue
+ */
+
+#include "sim_harness.h"
+#include "shiftx3_api.h"
+#include "system_CAN_queue.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CONFIG_US           1100000
+/* keeps the host active, so we aren't reset */
+#define KEEPALIVE_US        500000
+/* into the broadcast, while its frames are waiting for mailboxes */
+#define PRESS_DELAY_US      20000
+/* buttons are polled from the 100ms housekeeping tick */
+#define BUTTON_MAX_DELAY_US 101000
+#define LEFT_BUTTON_PAD     8
+
+static virtual_timer_t g_keepalive_timer;
+static virtual_timer_t g_press_timer;
+
+static uint64_t g_broadcast_start_us;
+static uint64_t g_broadcast_end_us;
+static uint64_t g_press_us;
+static uint64_t g_button_us;
+static uint32_t g_versions;
+static uint32_t g_stats;
+static uint32_t g_stats_out_of_order;
+
+static void _keepalive(void *par)
+{
+    (void)par;
+    if (sim_now_us() == CONFIG_US) {
+        const uint8_t config[] = {0, 51, 0};
+        sim_api_receive(API_SET_CONFIG_GROUP_1, config, sizeof(config));
+    } else {
+        const uint8_t value[] = {0, '8'};
+        sim_api_receive(API_SET_DISPLAY_VALUE, value, sizeof(value));
+    }
+    sim_timer_set_at(&g_keepalive_timer, sim_now_us() + KEEPALIVE_US, _keepalive, NULL);
+}
+
+static void _press(void *par)
+{
+    (void)par;
+    g_press_us = sim_now_us();
+    sim_set_pad_input(GPIOB, LEFT_BUTTON_PAD, PAL_HIGH);
+}
+
+static void _can_tx(const CANTxFrame *frame)
+{
+    uint32_t api_id = frame->EID - get_can_base_id();
+    uint64_t now = sim_now_us();
+
+    if (api_id == API_STATS && !g_versions++) {
+        g_broadcast_start_us = now;
+        sim_timer_set_at(&g_press_timer, now + PRESS_DELAY_US, _press, NULL);
+    } else if (api_id == API_STATS_EXTENDED && g_versions == 1) {
+        g_stats_out_of_order += frame->data8[0] != g_stats;
+        g_stats++;
+        g_broadcast_end_us = now;
+    } else if (api_id == API_ALERT_BUTTON_STATES && frame->data8[0] && !g_button_us) {
+        g_button_us = now;
+    }
+    if (g_button_us && g_stats == STATS_EXTENDED_COUNT)
+        sim_finish();
+}
+
+static void _finish(void)
+{
+    printf("broadcast of %u statistics took %.1fms; button sent %.1fms after the press\n",
+           g_stats, (g_broadcast_end_us - g_broadcast_start_us) / 1000.0, (g_button_us - g_press_us) / 1000.0);
+    sim_check(g_press_us > 0 && g_press_us < g_broadcast_end_us, "the button was not pressed during the broadcast");
+    sim_check(g_button_us > 0 && g_button_us - g_press_us <= BUTTON_MAX_DELAY_US,
+              "the button state went out %.1fms after the press", (g_button_us - g_press_us) / 1000.0);
+    sim_check(g_versions == 1, "%u version messages", g_versions);
+    sim_check(g_stats == STATS_EXTENDED_COUNT, "%u of %d statistics sent", g_stats, STATS_EXTENDED_COUNT);
+    sim_check(g_stats_out_of_order == 0, "%u statistics out of order", g_stats_out_of_order);
+    sim_check(get_can_tx_queue_stats()->drops == 0, "%u frames dropped from the transmit queue",
+              get_can_tx_queue_stats()->drops);
+    exit(sim_test_status("test_can_tx"));
+}
+
+static const struct SimHooks hooks = {
+    .can_tx = _can_tx,
+    .finish = _finish
+};
+
+int main(void)
+{
+    sim_start(&hooks);
+    sim_set_end_time(15000000);
+    sim_board_init(false, false);
+    chVTObjectInit(&g_keepalive_timer);
+    chVTObjectInit(&g_press_timer);
+    sim_timer_set_at(&g_keepalive_timer, CONFIG_US, _keepalive, NULL);
+    return shiftx3_main();
+}
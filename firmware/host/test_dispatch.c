@@ -0,0 +1,325 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * CAN API dispatch. Sends every offset in the API window through the
+ * render stage's queue and dispatcher, with the handlers wrapped at
+ * link time to record their calls. Checks that:
+ *  - each API message reaches its own handler, and nothing else does
+ *  - messages shorter than their handler needs are not passed on
+ *  - only configuration messages, short or not, mark the device as
+ *    provisioned
+ *
+ * Then measures the cost: passes a mix of live value, configuration,
+ * short and unknown messages through the dispatcher, and through the
+ * same queue and a switch over the API offset with per handler DLC
+ * checks, as dispatch worked before the handler table. Both call the
+ * same handlers; the cost of the queue alone is measured and
+ * subtracted. Reports host CPU time per frame.
+ */
+
+#include "sim_harness.h"
+#include "shiftx3_api.h"
+#include "system_CAN.h"
+#include "system_CAN_queue.h"
+#include <stdio.h>
+#include <string.h>
+
+#define BENCH_ROUNDS 20000
+/* frames queued between dispatches, within the queue's size */
+#define BENCH_BATCH 8
+
+#define BASE_ID 0xE3600
+
+struct BenchFrame {
+    uint8_t api_id;
+    uint8_t dlc;
+    uint8_t data[8];
+};
+
+static const struct BenchFrame g_mix[BENCH_BATCH] = {
+    {API_SET_CURRENT_LINEAR_GRAPH_VALUE, 2, {0x10, 0x17}},
+    {API_SET_CURRENT_ALERT_VALUE, 3, {0, 0xB8, 0x0B}},
+    {API_SET_CURRENT_LINEAR_GRAPH_VALUE, 2, {0x20, 0x17}},
+    {API_SET_CURRENT_ALERT_VALUE, 3, {1, 0x20, 0x03}},
+    {API_SET_LINEAR_THRESHOLD, 8, {2, 7, 0x58, 0x1B, 255, 0, 0, 5}},
+    {API_SET_CURRENT_LINEAR_GRAPH_VALUE, 2, {0x30, 0x17}},
+    /* too short, and not an API message */
+    {API_SET_CURRENT_ALERT_VALUE, 1, {0}},
+    {200, 8, {0}},
+};
+
+static CANRxFrame g_frames[BENCH_BATCH];
+
+/* Each handler, as the API documents it */
+struct ExpectedHandler {
+    uint8_t api_id;
+    uint8_t min_dlc;
+    bool config;
+};
+
+static const struct ExpectedHandler g_expected[] = {
+    {API_SET_CONFIG_GROUP_1, 1, true},
+    {API_SET_LOG_CONFIG, 5, true},
+    {API_SET_DISCRETE_LED, 6, false},
+    {API_SET_ALERT_LED, 5, false},
+    {API_SET_ALERT_THRESHOLD, 8, true},
+    {API_SET_CURRENT_ALERT_VALUE, 3, false},
+    {API_CONFIG_LINEAR_GRAPH, 6, true},
+    {API_SET_LINEAR_THRESHOLD, 8, true},
+    {API_SET_CURRENT_LINEAR_GRAPH_VALUE, 2, false},
+    {API_SET_DISPLAY_VALUE, 2, false},
+    {API_SET_DISPLAY_SEGMENT, 8, false},
+    {API_CONFIG_ANIMATION, 6, true},
+    {API_SET_ANIMATION_STEP, 8, true},
+    {API_PLAY_ANIMATION, 1, false},
+    {API_SET_ANIMATION_TRIGGER, 4, true},
+};
+#define EXPECTED_COUNT (sizeof(g_expected) / sizeof(g_expected[0]))
+
+/* The last handler called, by its API ID, and the number of calls */
+static int g_handled_id = -1;
+static uint32_t g_handled;
+
+/* Handlers wrapped with -Wl,--wrap, recording the call and passing it on */
+#define WRAP_HANDLER(name, api_id) \
+    void __real_##name(CANRxFrame *rx_msg); \
+    void __wrap_##name(CANRxFrame *rx_msg); \
+    void __wrap_##name(CANRxFrame *rx_msg) \
+    { \
+        g_handled_id = api_id; \
+        g_handled++; \
+        __real_##name(rx_msg); \
+    }
+
+WRAP_HANDLER(api_set_config_group_1, API_SET_CONFIG_GROUP_1)
+WRAP_HANDLER(api_set_log_config, API_SET_LOG_CONFIG)
+WRAP_HANDLER(api_set_discrete_led, API_SET_DISCRETE_LED)
+WRAP_HANDLER(api_set_alert_led, API_SET_ALERT_LED)
+WRAP_HANDLER(api_set_alert_threshold, API_SET_ALERT_THRESHOLD)
+WRAP_HANDLER(api_set_current_alert_value, API_SET_CURRENT_ALERT_VALUE)
+WRAP_HANDLER(api_config_linear_graph, API_CONFIG_LINEAR_GRAPH)
+WRAP_HANDLER(api_set_linear_threshold, API_SET_LINEAR_THRESHOLD)
+WRAP_HANDLER(api_set_current_linear_graph_value, API_SET_CURRENT_LINEAR_GRAPH_VALUE)
+WRAP_HANDLER(api_set_display_value, API_SET_DISPLAY_VALUE)
+WRAP_HANDLER(api_set_display_segment, API_SET_DISPLAY_SEGMENT)
+WRAP_HANDLER(api_config_animation, API_CONFIG_ANIMATION)
+WRAP_HANDLER(api_set_animation_step, API_SET_ANIMATION_STEP)
+WRAP_HANDLER(api_play_animation, API_PLAY_ANIMATION)
+WRAP_HANDLER(api_set_animation_trigger, API_SET_ANIMATION_TRIGGER)
+
+static const struct ExpectedHandler * _expected_handler(size_t api_id)
+{
+    for (size_t i = 0; i < EXPECTED_COUNT; i++) {
+        if (g_expected[i].api_id == api_id)
+            return &g_expected[i];
+    }
+    return NULL;
+}
+
+/* Dispatch one message through the queue, from an unprovisioned device */
+static void _dispatch_one(size_t api_id, uint8_t dlc)
+{
+    CANRxFrame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.IDE = CAN_IDE_EXT;
+    frame.EID = BASE_ID + api_id;
+    frame.DLC = dlc;
+    set_api_is_provisioned(false);
+    g_handled_id = -1;
+    can_rx_queue_push(&frame);
+    can_dispatch_queued_rx();
+}
+
+/* Every offset in the API window, at its handler's minimum length and one byte short */
+static void _check_routing(void)
+{
+    for (size_t api_id = 0; api_id < SHIFTX3_CAN_API_RANGE; api_id++) {
+        const struct ExpectedHandler *expected = _expected_handler(api_id);
+        if (!expected) {
+            _dispatch_one(api_id, 8);
+            sim_check(g_handled_id < 0, "API %zu reached the handler for API %d", api_id, g_handled_id);
+            sim_check(!api_is_provisoned(), "API %zu, which has no handler, provisioned the device", api_id);
+            continue;
+        }
+
+        _dispatch_one(api_id, expected->min_dlc);
+        sim_check(g_handled_id == (int)api_id, "API %zu with %u bytes reached the handler for API %d",
+                  api_id, expected->min_dlc, g_handled_id);
+        sim_check(api_is_provisoned() == expected->config, "API %zu %s the device", api_id,
+                  expected->config ? "did not provision" : "provisioned");
+
+        _dispatch_one(api_id, expected->min_dlc - 1);
+        sim_check(g_handled_id < 0, "API %zu with %u bytes reached the handler for API %d",
+                  api_id, expected->min_dlc - 1, g_handled_id);
+        sim_check(api_is_provisoned() == expected->config, "API %zu, too short, %s the device", api_id,
+                  expected->config ? "did not provision" : "provisioned");
+    }
+}
+
+/* Dispatch as it was before the handler table, with each handler's own DLC check */
+static bool _switch_dispatch(CANRxFrame *rx_msg)
+{
+    int32_t can_id = rx_msg->IDE == CAN_IDE_EXT ? rx_msg->EID : rx_msg->SID;
+    bool got_config_message = false;
+    switch (can_id - BASE_ID) {
+    case API_SET_CONFIG_GROUP_1:
+        if (rx_msg->DLC >= 1)
+            api_set_config_group_1(rx_msg);
+        got_config_message = true;
+        break;
+    case API_SET_DISCRETE_LED:
+        if (rx_msg->DLC >= 6)
+            api_set_discrete_led(rx_msg);
+        break;
+    case API_SET_ALERT_LED:
+        if (rx_msg->DLC >= 5)
+            api_set_alert_led(rx_msg);
+        break;
+    case API_SET_ALERT_THRESHOLD:
+        if (rx_msg->DLC >= 8)
+            api_set_alert_threshold(rx_msg);
+        got_config_message = true;
+        break;
+    case API_SET_CURRENT_ALERT_VALUE:
+        if (rx_msg->DLC >= 3)
+            api_set_current_alert_value(rx_msg);
+        break;
+    case API_CONFIG_LINEAR_GRAPH:
+        if (rx_msg->DLC >= 6)
+            api_config_linear_graph(rx_msg);
+        got_config_message = true;
+        break;
+    case API_SET_LINEAR_THRESHOLD:
+        if (rx_msg->DLC >= 8)
+            api_set_linear_threshold(rx_msg);
+        got_config_message = true;
+        break;
+    case API_SET_CURRENT_LINEAR_GRAPH_VALUE:
+        if (rx_msg->DLC >= 2)
+            api_set_current_linear_graph_value(rx_msg);
+        break;
+    case API_SET_DISPLAY_VALUE:
+        if (rx_msg->DLC >= 2)
+            api_set_display_value(rx_msg);
+        break;
+    case API_SET_DISPLAY_SEGMENT:
+        if (rx_msg->DLC >= 8)
+            api_set_display_segment(rx_msg);
+        break;
+    default:
+        return false;
+    }
+    if (got_config_message)
+        set_api_is_provisioned(got_config_message);
+    return true;
+}
+
+static void _push_batch(void)
+{
+    for (size_t i = 0; i < BENCH_BATCH; i++) {
+        can_rx_queue_push(&g_frames[i]);
+    }
+}
+
+static uint64_t _bench_queue(void)
+{
+    CANRxFrame rx_msg;
+    uint64_t start_ns = sim_thread_cpu_ns();
+    for (size_t round = 0; round < BENCH_ROUNDS; round++) {
+        _push_batch();
+        while (can_rx_queue_pop(&rx_msg))
+            ;
+    }
+    return sim_thread_cpu_ns() - start_ns;
+}
+
+static uint64_t _bench_table(void)
+{
+    uint64_t start_ns = sim_thread_cpu_ns();
+    for (size_t round = 0; round < BENCH_ROUNDS; round++) {
+        _push_batch();
+        can_dispatch_queued_rx();
+    }
+    return sim_thread_cpu_ns() - start_ns;
+}
+
+static uint64_t _bench_switch(uint32_t *accepted)
+{
+    CANRxFrame rx_msg;
+    uint64_t start_ns = sim_thread_cpu_ns();
+    for (size_t round = 0; round < BENCH_ROUNDS; round++) {
+        _push_batch();
+        while (can_rx_queue_pop(&rx_msg))
+            *accepted += _switch_dispatch(&rx_msg);
+    }
+    return sim_thread_cpu_ns() - start_ns;
+}
+
+/* the firmware is not started; its code is called directly */
+static const struct SimHooks hooks;
+
+int main(void)
+{
+    sim_start(&hooks);
+    api_initialize();
+    for (size_t i = 0; i < BENCH_BATCH; i++) {
+        CANRxFrame *frame = &g_frames[i];
+        memset(frame, 0, sizeof(*frame));
+        frame->IDE = CAN_IDE_EXT;
+        frame->EID = BASE_ID + g_mix[i].api_id;
+        frame->DLC = g_mix[i].dlc;
+        memcpy(frame->data8, g_mix[i].data, sizeof(frame->data8));
+    }
+    sim_check(get_can_base_id() == BASE_ID, "CAN base ID %u, expected %u", get_can_base_id(), BASE_ID);
+    _check_routing();
+
+    uint32_t accepted = 0;
+    /* warm up, then alternate so both see the same caches */
+    _bench_table();
+    uint64_t queue_ns = _bench_queue();
+    g_handled = 0;
+    uint64_t table_ns = _bench_table();
+    uint32_t table_handled = g_handled;
+    g_handled = 0;
+    uint64_t switch_ns = _bench_switch(&accepted);
+    uint32_t switch_handled = g_handled;
+    queue_ns = (queue_ns + _bench_queue()) / 2;
+    table_ns = (table_ns + _bench_table()) / 2;
+    switch_ns = (switch_ns + _bench_switch(&accepted)) / 2;
+
+    double frames = (double)BENCH_ROUNDS * BENCH_BATCH;
+    double table = (table_ns - (double)queue_ns) / frames;
+    double reference = (switch_ns - (double)queue_ns) / frames;
+    printf("dispatch per frame (host CPU ns, queue excluded): table %.1f, switch %.1f; queue %.1f\n",
+           table, reference, queue_ns / frames);
+
+    CANRxFrame rx_msg;
+    sim_check(!can_rx_queue_pop(&rx_msg), "frames left in the queue after dispatch");
+    sim_check(get_can_rx_queue_stats()->drops == 0, "%u frames dropped by the queue",
+              get_can_rx_queue_stats()->drops);
+    sim_check(accepted == 2 * BENCH_ROUNDS * (BENCH_BATCH - 1), "the switch accepted %u frames", accepted);
+    /* everything but the short and the unknown message is handled */
+    sim_check(table_handled == BENCH_ROUNDS * (BENCH_BATCH - 2), "the table handled %u frames", table_handled);
+    sim_check(table_handled == switch_handled, "the table handled %u frames, the switch %u",
+              table_handled, switch_handled);
+    return sim_test_status("test_dispatch");
+}
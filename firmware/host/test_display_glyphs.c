@@ -0,0 +1,234 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * 7 segment glyphs. Shows every character value in both orientations
+ * and reads the segment pins back from the GPIO ports, against the
+ * character map and per segment pin mapping the glyph table replaced.
+ * Checks that:
+ *  - every character in the old map lights the same segments
+ *  - characters without a glyph leave the display as it was
+ *  - the decimal point is lit only by '.' and by characters with the
+ *    high bit set, which otherwise show their glyph
+ *  - Set Segment lights the segments it names
+ */
+
+#include "sim_harness.h"
+#include "shiftx3_api.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CONFIG_US       1100000
+/* a frame to render, then a refresh period or two to reach the pins */
+#define SETTLE_US       12000
+
+#define CHARACTERS      256
+/* shown before each character, to tell an unchanged display apart */
+#define BACKGROUND      '8'
+
+/* The reference: the character map and pin mapping as they were */
+
+struct char_segment {
+    char character;
+    uint8_t bitmask;
+};
+
+static const struct char_segment g_character_mappings[] = {
+    {'0', 0x7E}, {'1', 0x30}, {'2', 0x6D}, {'3', 0x79}, {'4', 0x33},
+    {'5', 0x5B}, {'6', 0x5F}, {'7', 0x70}, {'8', 0x7F}, {'9', 0x7B},
+    {' ', 0x00}, {'A', 0x77}, {'a', 0x7D}, {'B', 0x7F}, {'b', 0x1F},
+    {'C', 0x4E}, {'c', 0x0D}, {'D', 0x7E}, {'d', 0x3D}, {'E', 0x4F},
+    {'e', 0x6f}, {'F', 0x47}, {'f', 0x47}, {'G', 0x5E}, {'g', 0x7B},
+    {'H', 0x37}, {'h', 0x17}, {'I', 0x30}, {'i', 0x10}, {'J', 0x3C},
+    {'j', 0x38}, {'K', 0x37}, {'k', 0x17}, {'L', 0x0E}, {'l', 0x06},
+    {'M', 0x55}, {'m', 0x55}, {'N', 0x15}, {'n', 0x15}, {'O', 0x7E},
+    {'o', 0x1D}, {'P', 0x67}, {'p', 0x67}, {'Q', 0x73}, {'q', 0x73},
+    {'R', 0x77}, {'r', 0x05}, {'S', 0x5B}, {'s', 0x5B}, {'T', 0x46},
+    {'t', 0x0F}, {'U', 0x3E}, {'u', 0x1C}, {'V', 0x27}, {'v', 0x23},
+    {'W', 0x3F}, {'w', 0x2B}, {'X', 0x25}, {'x', 0x25}, {'Y', 0x3B},
+    {'y', 0x33}, {'Z', 0x6D}, {'z', 0x6D}, {'-', 0x01}, {'=', 0x41},
+    {'_', 0x08}, {'~', 0x49}
+};
+#define CHARMAP_COUNT (sizeof(g_character_mappings) / sizeof(g_character_mappings[0]))
+
+struct port_pin {
+    stm32_gpio_t *port;
+    uint8_t pin;
+};
+
+#define SEGMENT_COUNT 7
+#define SEGMENT_A {GPIOB, 6}
+#define SEGMENT_B {GPIOB, 5}
+#define SEGMENT_C {GPIOB, 4}
+#define SEGMENT_D {GPIOA, 15}
+#define SEGMENT_E {GPIOB, 3}
+#define SEGMENT_F {GPIOB, 1}
+#define SEGMENT_G {GPIOA, 6}
+
+/* segments A - G by orientation; upside down, A and D, B and E, C and F trade places */
+static const struct port_pin g_segment_pins[DISPLAY_ORIENTATIONS][SEGMENT_COUNT] = {
+    {SEGMENT_A, SEGMENT_B, SEGMENT_C, SEGMENT_D, SEGMENT_E, SEGMENT_F, SEGMENT_G},
+    {SEGMENT_D, SEGMENT_E, SEGMENT_F, SEGMENT_A, SEGMENT_B, SEGMENT_C, SEGMENT_G},
+};
+static const struct port_pin g_dp_pin = {GPIOA, 8};
+
+/* segment A in bit 6 through G in bit 0; -1 if the character has no glyph */
+static int _reference_glyph(char character)
+{
+    for (size_t i = 0; i < CHARMAP_COUNT; i++) {
+        if (g_character_mappings[i].character == character)
+            return g_character_mappings[i].bitmask;
+    }
+    return -1;
+}
+
+/* Lit segments as read from the pins, which are lit when driven low */
+
+static bool _lit(const struct port_pin *pin)
+{
+    return !((pin->port->ODR >> pin->pin) & 1);
+}
+
+static uint8_t _read_segments(enum orientation orientation)
+{
+    uint8_t segments = 0;
+    for (size_t i = 0; i < SEGMENT_COUNT; i++) {
+        segments = (segments << 1) | _lit(&g_segment_pins[orientation][i]);
+    }
+    return segments;
+}
+
+/* The run: each character over CAN, after the background */
+
+static virtual_timer_t g_step_timer;
+static enum orientation g_orientation;
+/* per orientation: the configuration, then the background, an item and its check for each item */
+static size_t g_step;
+
+static uint32_t g_characters_checked;
+static uint32_t g_wrong_segments;
+static uint32_t g_wrong_dp;
+
+static void _show(uint8_t character)
+{
+    const uint8_t data[] = {0, character};
+    sim_api_receive(API_SET_DISPLAY_VALUE, data, sizeof(data));
+}
+
+static void _check_character(uint8_t character)
+{
+    bool dp = character & 0x80;
+    int glyph = _reference_glyph(character & 0x7F);
+    if ((character & 0x7F) == '.') {
+        /* new: the decimal point alone */
+        glyph = 0;
+        dp = true;
+    }
+    int expected = glyph >= 0 ? glyph : _reference_glyph(BACKGROUND);
+    dp = dp && glyph >= 0;
+
+    uint8_t segments = _read_segments(g_orientation);
+    if (segments != expected) {
+        g_wrong_segments++;
+        sim_check(false, "orientation %d: character 0x%02X lit segments 0x%02X, expected 0x%02X",
+                  g_orientation, character, segments, expected);
+    }
+    if (_lit(&g_dp_pin) != dp) {
+        g_wrong_dp++;
+        sim_check(false, "orientation %d: character 0x%02X %s the decimal point",
+                  g_orientation, character, dp ? "did not light" : "lit");
+    }
+    g_characters_checked++;
+}
+
+/* Set Segment, with each segment alone */
+static void _show_segment(size_t segment)
+{
+    uint8_t data[8] = {0};
+    data[1 + segment] = 1;
+    sim_api_receive(API_SET_DISPLAY_SEGMENT, data, sizeof(data));
+}
+
+static void _check_segment(size_t segment)
+{
+    uint8_t segments = _read_segments(g_orientation);
+    sim_check(segments == 1 << (SEGMENT_COUNT - 1 - segment) && !_lit(&g_dp_pin),
+              "orientation %d: Set Segment %zu lit segments 0x%02X", g_orientation, segment, segments);
+}
+
+static void _step(void *par)
+{
+    (void)par;
+
+    if (g_step == 0) {
+        /* user brightness, orientation */
+        const uint8_t config[] = {100, 0, g_orientation};
+        sim_api_receive(API_SET_CONFIG_GROUP_1, config, sizeof(config));
+    } else {
+        size_t item = (g_step - 1) / 3;
+        switch ((g_step - 1) % 3) {
+        case 0:
+            _show(BACKGROUND);
+            break;
+        case 1:
+            if (item < CHARACTERS)
+                _show(item);
+            else
+                _show_segment(item - CHARACTERS);
+            break;
+        default:
+            if (item < CHARACTERS)
+                _check_character(item);
+            else
+                _check_segment(item - CHARACTERS);
+            break;
+        }
+    }
+
+    if (++g_step > 3 * (CHARACTERS + SEGMENT_COUNT)) {
+        g_step = 0;
+        if (++g_orientation == DISPLAY_ORIENTATIONS)
+            sim_finish();
+    }
+    sim_timer_set_at(&g_step_timer, sim_now_us() + SETTLE_US, _step, NULL);
+}
+
+static void _finish(void)
+{
+    printf("%u characters over %d orientations: %u lit the wrong segments, %u the wrong decimal point\n",
+           g_characters_checked, DISPLAY_ORIENTATIONS, g_wrong_segments, g_wrong_dp);
+    sim_check(g_characters_checked == DISPLAY_ORIENTATIONS * CHARACTERS, "%u characters checked",
+              g_characters_checked);
+    exit(sim_test_status("test_display_glyphs"));
+}
+
+static const struct SimHooks hooks = {
+    .finish = _finish
+};
+
+int main(void)
+{
+    sim_start(&hooks);
+    sim_board_init(false, false);
+    chVTObjectInit(&g_step_timer);
+    sim_timer_set_at(&g_step_timer, CONFIG_US, _step, NULL);
+    return shiftx3_main();
+}
@@ -0,0 +1,153 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Fade curves and cost. Steps the fade engine tick by tick, as the
+ * flash worker does, and checks that:
+ *  - a fade follows an exponential approach with its time constant, as
+ *    stepped once per tick
+ *  - fades up and down take the same time to finish, without a slow tail
+ *  - only LEDs whose color changed are reported changed
+ * then reports the host CPU time of one tick with every LED fading.
+ */
+
+#include "sim_harness.h"
+#include "system_LED.h"
+#include "system_LED_fade.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CURVE_TOLERANCE 2
+#define MAX_FADE_TICKS 10000
+#define BENCH_ROUNDS 2000
+#define BENCH_TICKS 100
+/* a generous bound; the target's budget is a small part of a flash tick */
+#define BENCH_MAX_NS_PER_TICK 20000
+
+/* Fraction of the remaining change covered per tick, as a backward Euler step */
+static double _fade_alpha(uint16_t time_constant_ms)
+{
+    return (double)FLASH_TICK_INTERVAL_MS / (time_constant_ms + FLASH_TICK_INTERVAL_MS);
+}
+
+/* Fade one LED from a grey to a color; returns the ticks taken to reach it */
+static uint32_t _fade(uint8_t from, uint8_t to, uint16_t time_constant_ms, bool check_curve)
+{
+    const uint8_t from_color[3] = {from, from, from};
+    const uint8_t to_color[3] = {to, 0, from};
+    fade_start(0, from_color, to_color, time_constant_ms);
+
+    uint8_t last[3] = {from, from, from};
+    uint32_t misreported = 0;
+    double worst = 0;
+    uint32_t tick;
+    for (tick = 1; tick <= MAX_FADE_TICKS; tick++) {
+        uint32_t changed = fade_advance();
+        uint8_t color[3];
+        fade_get_color(0, &color[0], &color[1], &color[2]);
+        bool color_changed = memcmp(color, last, sizeof(color)) != 0;
+        if (color_changed != ((changed & 1) != 0) || (changed & ~1))
+            misreported++;
+        memcpy(last, color, sizeof(color));
+
+        if (check_curve) {
+            double expected = to + (from - to) * pow(1 - _fade_alpha(time_constant_ms), tick);
+            double error = fabs(color[0] - expected);
+            worst = error > worst ? error : worst;
+        }
+        if (!memcmp(color, to_color, sizeof(color)))
+            break;
+    }
+    /* let a fade still running on fractions finish, quietly */
+    for (size_t i = 0; i < MAX_FADE_TICKS; i++) {
+        if (fade_advance())
+            misreported++;
+    }
+    sim_check(misreported == 0, "%u -> %u over %ums: %u ticks reported the wrong LEDs changed",
+              from, to, time_constant_ms, misreported);
+    if (check_curve) {
+        sim_check(worst <= CURVE_TOLERANCE, "%u -> %u over %ums strays %.1f from an exponential",
+                  from, to, time_constant_ms, worst);
+    }
+    return tick;
+}
+
+static void _test_curves(void)
+{
+    static const uint16_t time_constants_ms[] = {20, 100, 500, 2550};
+    for (size_t i = 0; i < sizeof(time_constants_ms) / sizeof(time_constants_ms[0]); i++) {
+        uint16_t time_constant_ms = time_constants_ms[i];
+        uint32_t up = _fade(0, 255, time_constant_ms, true);
+        uint32_t down = _fade(255, 0, time_constant_ms, true);
+        printf("%4ums fade: %4ums up, %4ums down\n", time_constant_ms,
+               up * FLASH_TICK_INTERVAL_MS, down * FLASH_TICK_INTERVAL_MS);
+
+        /* until the remaining change rounds away; steps rounded toward zero slow the end a little */
+        double settle = log(0.5 / 255) / log(1 - _fade_alpha(time_constant_ms));
+        sim_check(abs((int)up - (int)down) <= 2, "%ums fade: %u ticks up but %u down",
+                  time_constant_ms, up, down);
+        sim_check(up <= settle * 1.1 + 2, "%ums fade took %u ticks to finish, expected %.0f",
+                  time_constant_ms, up, settle);
+    }
+}
+
+/* Small fades end on their target, and one that changes nothing reports nothing */
+static void _test_small_fades(void)
+{
+    _fade(100, 101, 2550, false);
+    _fade(101, 100, 2550, false);
+    const uint8_t grey[3] = {50, 50, 50};
+    fade_start(0, grey, grey, 500);
+    sim_check(fade_advance() == 0, "a fade to the same color reported a change");
+}
+
+static void _bench(void)
+{
+    const uint8_t from[3] = {0, 255, 0};
+    const uint8_t to[3] = {255, 0, 128};
+    uint64_t elapsed_ns = 0;
+    for (size_t round = 0; round < BENCH_ROUNDS; round++) {
+        for (size_t i = 0; i < LED_COUNT; i++) {
+            fade_start(i, from, to, 2550);
+        }
+        uint64_t start_ns = sim_thread_cpu_ns();
+        for (size_t tick = 0; tick < BENCH_TICKS; tick++) {
+            fade_advance();
+        }
+        elapsed_ns += sim_thread_cpu_ns() - start_ns;
+        for (size_t i = 0; i < LED_COUNT; i++) {
+            fade_cancel(i);
+        }
+    }
+    double ns_per_tick = (double)elapsed_ns / (BENCH_ROUNDS * BENCH_TICKS);
+    printf("fade tick with %u LEDs fading: %.1f host CPU ns\n", LED_COUNT, ns_per_tick);
+    sim_check(ns_per_tick < BENCH_MAX_NS_PER_TICK, "fade tick took %.1fns", ns_per_tick);
+}
+
+int main(void)
+{
+    _test_curves();
+    _test_small_fades();
+    _bench();
+    return sim_test_status("test_fade");
+}
@@ -0,0 +1,157 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Flash engine timeline. Steps the flash engine tick by tick, as the
+ * flash worker does, and checks each LED's on/off timeline against the
+ * rate, duty cycle and phase requested: the number of flashes, the time
+ * on, that LEDs at the same rate flash in step, and that rates beyond
+ * the API's range are limited rather than wrapping.
+ */
+
+#include "sim_harness.h"
+#include "system_LED.h"
+#include "system_LED_flash.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TIMELINE_S 10
+#define TIMELINE_TICKS (TIMELINE_S * 1000 / FLASH_TICK_INTERVAL_MS)
+
+struct Timeline {
+    uint32_t flashes;
+    uint32_t ticks_on;
+    uint8_t states[TIMELINE_TICKS];
+};
+
+static struct Timeline g_timelines[LED_COUNT];
+
+static void _run(void)
+{
+    for (size_t i = 0; i < LED_COUNT; i++) {
+        g_timelines[i].flashes = 0;
+        g_timelines[i].ticks_on = 0;
+    }
+    for (size_t tick = 0; tick < TIMELINE_TICKS; tick++) {
+        flash_advance();
+        for (size_t i = 0; i < LED_COUNT; i++) {
+            struct Timeline *timeline = &g_timelines[i];
+            bool on = flash_is_on(i);
+            if (on && tick > 0 && !timeline->states[tick - 1])
+                timeline->flashes++;
+            timeline->ticks_on += on;
+            timeline->states[tick] = on;
+        }
+    }
+}
+
+/* A timeline flashes at a rate, in 1/FLASH_RATE_SCALE Hz, with a duty cycle in 1/256ths */
+static void _check_timeline(size_t led, uint32_t rate, uint8_t duty)
+{
+    const struct Timeline *timeline = &g_timelines[led];
+    double expected_flashes = (double)rate * TIMELINE_S / FLASH_RATE_SCALE;
+    sim_check(fabs(timeline->flashes - expected_flashes) <= 1,
+              "%.2fHz: %u flashes in %us, expected %.1f",
+              (double)rate / FLASH_RATE_SCALE, timeline->flashes, TIMELINE_S, expected_flashes);
+
+    /* each flash may be a tick longer or shorter than its exact duty */
+    double on = (double)timeline->ticks_on / TIMELINE_TICKS;
+    double tolerance = (expected_flashes + 1) / TIMELINE_TICKS;
+    sim_check(fabs(on - duty / 256.0) <= tolerance,
+              "%.2fHz: on %.3f of the time, expected %.3f",
+              (double)rate / FLASH_RATE_SCALE, on, duty / 256.0);
+}
+
+static void _test_rates(void)
+{
+    /* includes rates the 100ms toggle could not produce */
+    static const uint16_t rates[LED_COUNT] = {50, 100, 250, 400, 700, 1000, 1500, 2000, 2500};
+    for (size_t i = 0; i < LED_COUNT; i++) {
+        flash_set_pattern(i, rates[i], FLASH_DEFAULT_DUTY, 0);
+    }
+    _run();
+    for (size_t i = 0; i < LED_COUNT; i++) {
+        _check_timeline(i, rates[i], FLASH_DEFAULT_DUTY);
+    }
+}
+
+static void _test_duty(void)
+{
+    static const uint8_t duties[] = {32, 64, 192, 240};
+    for (size_t i = 0; i < LED_COUNT; i++) {
+        flash_set_pattern(i, 200, duties[i % 4], 0);
+    }
+    _run();
+    for (size_t i = 0; i < 4; i++) {
+        _check_timeline(i, 200, duties[i]);
+    }
+}
+
+/* LEDs set at different times flash in step; a phase offset of half a period inverts */
+static void _test_phase(void)
+{
+    flash_set_hz(0, 0);
+    flash_set_hz(1, 0);
+    flash_set_hz(2, 0);
+    flash_set_pattern(0, 300, FLASH_DEFAULT_DUTY, 0);
+    for (size_t i = 0; i < 37; i++) {
+        flash_advance();
+    }
+    flash_set_pattern(1, 300, FLASH_DEFAULT_DUTY, 0);
+    flash_set_pattern(2, 300, FLASH_DEFAULT_DUTY, 128);
+    _run();
+
+    size_t same = 0;
+    size_t inverted = 0;
+    for (size_t tick = 0; tick < TIMELINE_TICKS; tick++) {
+        same += g_timelines[0].states[tick] == g_timelines[1].states[tick];
+        inverted += g_timelines[0].states[tick] != g_timelines[2].states[tick];
+    }
+    sim_check(same == TIMELINE_TICKS, "LEDs set 37 ticks apart differ for %zu ticks", TIMELINE_TICKS - same);
+    /* a period of 3Hz is not a whole number of ticks, so edges may be a tick apart */
+    sim_check(inverted >= TIMELINE_TICKS - 2 * g_timelines[0].flashes,
+              "half a period offset matches the reference for %zu ticks", TIMELINE_TICKS - inverted);
+}
+
+/* Rates beyond 25Hz are limited, not wrapped by the phase increment */
+static void _test_limits(void)
+{
+    flash_set_hz(0, 0);
+    flash_set_hz(1, FLASH_MAX_HZ);
+    flash_set_hz(2, 200);
+    flash_set_hz(3, 255);
+    flash_set_pattern(4, UINT16_MAX, FLASH_DEFAULT_DUTY, 0);
+    _run();
+    sim_check(g_timelines[0].ticks_on == TIMELINE_TICKS, "a rate of 0 is not on all the time");
+    for (size_t i = 1; i < 5; i++) {
+        _check_timeline(i, FLASH_MAX_RATE, FLASH_DEFAULT_DUTY);
+    }
+}
+
+int main(void)
+{
+    _test_rates();
+    _test_duty();
+    _test_phase();
+    _test_limits();
+    return sim_test_status("test_flash");
+}
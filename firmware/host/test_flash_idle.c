@@ -0,0 +1,164 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Flash tick while idle. Lights an LED steadily, then flashing, then
+ * steadily again, then fades it, and counts the flash ticks serviced in
+ * each phase. Checks that:
+ *  - the flash tick does not run while nothing flashes or fades
+ *  - it runs at its full rate while an LED flashes, and while it fades
+ *  - an LED that stops flashing is left lit, at the current brightness
+ *  - a fade still reaches its color
+ */
+
+#include "sim_harness.h"
+#include "shiftx3_api.h"
+#include "system_LED.h"
+#include "system_scheduler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CONFIG_US       1100000
+#define PHASE_US        1000000
+#define FLASH_HZ        5
+/* in 10ms units */
+#define FADE_TIME       10
+
+enum phase {
+    PHASE_STEADY = 0,
+    PHASE_FLASHING,
+    PHASE_STOPPED,
+    PHASE_FADING,
+    PHASE_FADED,
+    PHASES
+};
+
+static const char *g_phase_names[PHASES] = {
+    "steady", "flashing", "stopped", "fading", "faded"
+};
+
+static virtual_timer_t g_step_timer;
+static size_t g_phase;
+static uint32_t g_ticks_at_start;
+static uint32_t g_ticks[PHASES];
+static uint8_t g_frame[TXBUF_LEN];
+
+static uint32_t _flash_ticks(void)
+{
+    return get_scheduler_stats(SCHEDULER_EVENT_FLASH)->serviced;
+}
+
+/* LED 0 only, steady or flashing, optionally fading */
+static void _set_led(uint8_t red, uint8_t green, uint8_t flash_hz, uint8_t fade)
+{
+    const uint8_t data[] = {0, 1, red, green, 0, flash_hz, fade};
+    sim_api_receive(API_SET_DISCRETE_LED, data, sizeof(data));
+}
+
+static const uint8_t * _led(void)
+{
+    return &g_frame[APA102_LED_DATA_START];
+}
+
+static void _start_phase(enum phase phase)
+{
+    switch (phase) {
+    case PHASE_STEADY:
+        _set_led(255, 0, 0, 0);
+        break;
+    case PHASE_FLASHING:
+        _set_led(255, 0, FLASH_HZ, 0);
+        break;
+    case PHASE_STOPPED:
+        _set_led(255, 0, 0, 0);
+        break;
+    case PHASE_FADING:
+        _set_led(0, 255, 0, FADE_TIME);
+        break;
+    default:
+        break;
+    }
+}
+
+static void _step(void *par)
+{
+    (void)par;
+    uint64_t now = sim_now_us();
+
+    if (now == CONFIG_US) {
+        /* provisions us, ending the startup demo */
+        const uint8_t config[] = {0, 51, 0};
+        sim_api_receive(API_SET_CONFIG_GROUP_1, config, sizeof(config));
+        sim_timer_set_at(&g_step_timer, now + PHASE_US, _step, NULL);
+        return;
+    }
+    if (g_phase > 0)
+        g_ticks[g_phase - 1] = _flash_ticks() - g_ticks_at_start;
+    if (g_phase == PHASE_STOPPED + 1) {
+        sim_check((_led()[0] & ~APA102_GLOBAL_PREAMBLE) > 0, "the LED was left off after flashing");
+    }
+    if (g_phase == PHASES) {
+        sim_finish();
+        return;
+    }
+    _start_phase(g_phase++);
+    sim_timer_set_at(&g_step_timer, now + PHASE_US, _step, NULL);
+    g_ticks_at_start = _flash_ticks();
+}
+
+static void _spi_tx(const uint8_t *data, size_t length)
+{
+    if (length == TXBUF_LEN)
+        memcpy(g_frame, data, TXBUF_LEN);
+}
+
+static void _finish(void)
+{
+    for (size_t i = 0; i < PHASES; i++) {
+        printf("%s: %u flash ticks\n", g_phase_names[i], g_ticks[i]);
+    }
+    uint32_t rate = 1000 / FLASH_TICK_INTERVAL_MS;
+    sim_check(g_ticks[PHASE_STEADY] == 0, "%u flash ticks with nothing flashing", g_ticks[PHASE_STEADY]);
+    sim_check(g_ticks[PHASE_FLASHING] >= rate - 2, "only %u flash ticks while flashing", g_ticks[PHASE_FLASHING]);
+    /* ticks due before the message is dispatched, then one to turn the LED back on */
+    sim_check(g_ticks[PHASE_STOPPED] <= 2, "%u flash ticks after flashing stopped", g_ticks[PHASE_STOPPED]);
+    /* the approach takes several time constants to settle */
+    sim_check(g_ticks[PHASE_FADING] > 0 && g_ticks[PHASE_FADING] < rate,
+              "%u flash ticks for a %ums fade", g_ticks[PHASE_FADING], FADE_TIME * 10);
+    sim_check(g_ticks[PHASE_FADED] == 0, "%u flash ticks after the fade", g_ticks[PHASE_FADED]);
+    sim_check(_led()[3] == 0 && _led()[2] == 255, "the fade ended at %u, %u", _led()[3], _led()[2]);
+    exit(sim_test_status("test_flash_idle"));
+}
+
+static const struct SimHooks hooks = {
+    .spi_tx = _spi_tx,
+    .finish = _finish
+};
+
+int main(void)
+{
+    sim_start(&hooks);
+    sim_board_init(false, false);
+    chVTObjectInit(&g_step_timer);
+    sim_timer_set_at(&g_step_timer, CONFIG_US, _step, NULL);
+    return shiftx3_main();
+}
@@ -0,0 +1,212 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * LED frame tearing. Flips the linear graph between two states that
+ * differ on every graph LED, one green LED and seven red ones, faster
+ * than frames go out, while the light level swings the brightness the
+ * flash service applies to every LED. SPI transfers are stretched to
+ * outlast a frame interval, so renders land while a frame is in flight.
+ * Checks that:
+ *  - every frame sent shows one state or the other, never a mix
+ *  - every frame carries one brightness for all its LEDs
+ *  - a frame's buffer is not touched while the SPI DMA is sending it
+ *  - frames held back for the one in flight are counted as busy
+ */
+
+#include "sim_harness.h"
+#include "shiftx3_api.h"
+#include "system_LED.h"
+#include "system_SPI.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CONFIG_US       500000
+#define CONFIG_STEP_US  10000
+#define FLIP_START_US   1000000
+#define FLIP_US         2000000
+#define FLIP_END_US     (FLIP_START_US + FLIP_US)
+/* well inside a frame interval, and not a multiple of it */
+#define FLIP_STEP_US    300
+#define LIGHT_STEP_US   3700
+/* about 2.4ms a frame */
+#define SPI_SLOWDOWN    40
+
+#define RANGE           7000
+#define ONE_LED_VALUE   1000
+#define RED_THRESHOLD   5000
+
+enum frame_state {
+    FRAME_BLANK = 0,
+    FRAME_ONE_GREEN,
+    FRAME_ALL_RED,
+    FRAME_TORN
+};
+
+static virtual_timer_t g_flip_timer;
+static virtual_timer_t g_light_timer;
+static size_t g_config_step;
+static uint32_t g_flips;
+
+static uint8_t g_sending[TXBUF_LEN];
+static uint32_t g_frames[FRAME_TORN + 1];
+static uint32_t g_mixed_brightness;
+static uint8_t g_brightness_min = UINT8_MAX;
+static uint8_t g_brightness_max;
+static uint32_t g_touched_in_flight;
+static bool g_rendered;
+
+static void _configure(size_t step)
+{
+    if (step == 0) {
+        /* left to right, smooth, 0 - RANGE */
+        const uint8_t config[] = {RENDER_STYLE_LEFT_RIGHT, LINEAR_STYLE_SMOOTH, 0, 0, RANGE & 0xFF, RANGE >> 8};
+        sim_api_receive(API_CONFIG_LINEAR_GRAPH, config, sizeof(config));
+    } else {
+        /* green from 0, red from RED_THRESHOLD; the others disabled */
+        uint8_t id = step - 1;
+        uint16_t value = id == 1 ? RED_THRESHOLD : 0;
+        const uint8_t threshold[] = {id, 0, value & 0xFF, value >> 8, id == 1 ? 255 : 0, id == 0 ? 255 : 0, 0, 0};
+        sim_api_receive(API_SET_LINEAR_THRESHOLD, threshold, sizeof(threshold));
+    }
+}
+
+static void _flip(void *par)
+{
+    (void)par;
+    uint64_t now = sim_now_us();
+    if (now < FLIP_START_US) {
+        _configure(g_config_step++);
+        sim_timer_set_at(&g_flip_timer, g_config_step <= LINEAR_GRAPH_THRESHOLDS ? now + CONFIG_STEP_US : FLIP_START_US,
+                         _flip, NULL);
+        return;
+    }
+    uint16_t value = g_flips++ & 1 ? RANGE : ONE_LED_VALUE;
+    const uint8_t update[] = {value & 0xFF, value >> 8};
+    sim_api_receive(API_SET_CURRENT_LINEAR_GRAPH_VALUE, update, sizeof(update));
+    if (now + FLIP_STEP_US < FLIP_END_US)
+        sim_timer_set_at(&g_flip_timer, now + FLIP_STEP_US, _flip, NULL);
+}
+
+/* Swing the light level between dark and bright */
+static void _swing_light(void *par)
+{
+    (void)par;
+    static bool bright;
+    bright = !bright;
+    sim_set_light_level(bright ? 4095 : 0);
+    if (sim_now_us() < FLIP_END_US)
+        sim_timer_set_at(&g_light_timer, sim_now_us() + LIGHT_STEP_US, _swing_light, NULL);
+}
+
+static bool _led_is(const uint8_t *data, size_t index, uint8_t red, uint8_t green, uint8_t blue)
+{
+    const uint8_t *led = &data[APA102_LED_DATA_START + index * APA102_BYTES_PER_LED];
+    return led[1] == blue && led[2] == green && led[3] == red;
+}
+
+static enum frame_state _frame_state(const uint8_t *data)
+{
+    bool blank = true;
+    bool one_green = _led_is(data, LINEAR_GRAPH_OFFSET, 0, 255, 0);
+    bool all_red = true;
+    for (size_t i = 0; i < LINEAR_GRAPH_COUNT; i++) {
+        size_t index = LINEAR_GRAPH_OFFSET + i;
+        blank = blank && _led_is(data, index, 0, 0, 0);
+        if (i > 0)
+            one_green = one_green && _led_is(data, index, 0, 0, 0);
+        all_red = all_red && _led_is(data, index, 255, 0, 0);
+    }
+    if (blank)
+        return FRAME_BLANK;
+    if (one_green)
+        return FRAME_ONE_GREEN;
+    return all_red ? FRAME_ALL_RED : FRAME_TORN;
+}
+
+static void _spi_tx(const uint8_t *data, size_t length)
+{
+    if (length != TXBUF_LEN)
+        return;
+    memcpy(g_sending, data, TXBUF_LEN);
+    if (sim_now_us() < FLIP_START_US)
+        return;
+
+    enum frame_state state = _frame_state(data);
+    /* blank only until the first update is rendered */
+    if (state == FRAME_BLANK && g_rendered)
+        state = FRAME_TORN;
+    g_rendered = g_rendered || state != FRAME_BLANK;
+    g_frames[state]++;
+
+    uint8_t brightness = data[APA102_LED_DATA_START] & ~APA102_GLOBAL_PREAMBLE;
+    g_brightness_min = brightness < g_brightness_min ? brightness : g_brightness_min;
+    g_brightness_max = brightness > g_brightness_max ? brightness : g_brightness_max;
+    for (size_t i = 1; i < LED_COUNT; i++) {
+        if (data[APA102_LED_DATA_START + i * APA102_BYTES_PER_LED] != data[APA102_LED_DATA_START]) {
+            g_mixed_brightness++;
+            break;
+        }
+    }
+}
+
+static void _spi_done(const uint8_t *data, size_t length)
+{
+    if (length == TXBUF_LEN && memcmp(data, g_sending, TXBUF_LEN) != 0)
+        g_touched_in_flight++;
+}
+
+static void _finish(void)
+{
+    printf("frames: %u one green, %u all red, %u blank, %u torn, %u held back; %u graph updates, brightness %u - %u\n",
+           g_frames[FRAME_ONE_GREEN], g_frames[FRAME_ALL_RED], g_frames[FRAME_BLANK],
+           g_frames[FRAME_TORN], get_spi_stats()->frames_busy, g_flips, g_brightness_min, g_brightness_max);
+    sim_check(g_frames[FRAME_ONE_GREEN] > 100 && g_frames[FRAME_ALL_RED] > 100,
+              "the graph state rarely changed: %u and %u frames",
+              g_frames[FRAME_ONE_GREEN], g_frames[FRAME_ALL_RED]);
+    sim_check(g_brightness_max > g_brightness_min, "the brightness never changed");
+    sim_check(g_frames[FRAME_TORN] == 0, "%u frames mixed the two graph states", g_frames[FRAME_TORN]);
+    sim_check(g_mixed_brightness == 0, "%u frames mixed brightness levels", g_mixed_brightness);
+    sim_check(get_spi_stats()->frames_busy > 0, "no frames were counted as held back");
+    sim_check(g_touched_in_flight == 0, "%u frames changed while the DMA sent them", g_touched_in_flight);
+    exit(sim_test_status("test_frame_tearing"));
+}
+
+static const struct SimHooks hooks = {
+    .spi_tx = _spi_tx,
+    .spi_done = _spi_done,
+    .finish = _finish
+};
+
+int main(void)
+{
+    sim_start(&hooks);
+    sim_set_end_time(FLIP_END_US + 100000);
+    sim_board_init(false, false);
+    sim_set_spi_slowdown(SPI_SLOWDOWN);
+
+    chVTObjectInit(&g_flip_timer);
+    chVTObjectInit(&g_light_timer);
+    sim_timer_set_at(&g_flip_timer, CONFIG_US, _flip, NULL);
+    sim_timer_set_at(&g_light_timer, FLIP_START_US, _swing_light, NULL);
+    return shiftx3_main();
+}
@@ -0,0 +1,414 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Linear graph renderer against the percent based renderer it replaced,
+ * kept here as the golden reference. Sweeps values over left to right,
+ * right to left and center graphs, smooth and stepped, with a range of
+ * spans, and reads each frame back from the LEDs. Checks that:
+ *  - frames match the reference but for the dimmed LED at the graph's
+ *    edge, where the reference rounds to whole percent
+ *  - frames match it exactly at either end of the range and when stepped
+ *  - the graph position is within a dimming step of the exact value
+ * then reports the host CPU time of a render each way.
+ */
+
+#include "sim_harness.h"
+#include "shiftx3_api.h"
+#include "system_LED.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* after the startup demo would begin, which the configuration ends */
+#define CONFIG_US       1100000
+#define CONFIG_STEP_US  10000
+/* an update, then its frame read back after it has rendered */
+#define VALUE_STEP_US   3000
+#define CHECK_DELAY_US  2000
+#define VALUES_PER_CONFIG 400
+
+#define BENCH_ROUNDS 200
+/* a generous bound; either way it is a small part of a frame */
+#define BENCH_MAX_NS_PER_RENDER 20000
+
+/* threshold color, with channels far apart to show rounding per channel */
+#define RED 255
+#define GREEN 128
+#define BLUE 37
+#define SEGMENT_LENGTH 4
+
+struct GraphConfig {
+    enum render_style rstyle;
+    enum linear_style lstyle;
+    uint16_t low_range;
+    uint16_t high_range;
+};
+
+static const struct GraphConfig g_configs[] = {
+    {RENDER_STYLE_LEFT_RIGHT, LINEAR_STYLE_SMOOTH, 0, 10000},
+    {RENDER_STYLE_RIGHT_LEFT, LINEAR_STYLE_SMOOTH, 1000, 8000},
+    {RENDER_STYLE_CENTER, LINEAR_STYLE_SMOOTH, 0, 10000},
+    {RENDER_STYLE_CENTER, LINEAR_STYLE_SMOOTH, 500, 7501},
+    {RENDER_STYLE_LEFT_RIGHT, LINEAR_STYLE_SMOOTH, 100, 107},
+    {RENDER_STYLE_LEFT_RIGHT, LINEAR_STYLE_SMOOTH, 0, UINT16_MAX},
+    {RENDER_STYLE_RIGHT_LEFT, LINEAR_STYLE_STEPPED, 0, 10000},
+};
+#define CONFIG_COUNT (sizeof(g_configs) / sizeof(g_configs[0]))
+
+/*
+ * The reference: the percent based renderer, as it was. LED writes go to
+ * g_expected, and also to the LEDs when benchmarking.
+ */
+
+static uint8_t g_expected[LED_COUNT][3];
+static bool g_reference_to_leds;
+
+static void _reference_set_led(size_t index, uint8_t red, uint8_t green, uint8_t blue)
+{
+    g_expected[index][0] = red;
+    g_expected[index][1] = green;
+    g_expected[index][2] = blue;
+    if (g_reference_to_leds)
+        set_led(index, red, green, blue);
+}
+
+static void _reference_set_flash_config(size_t index, uint8_t flash_hz)
+{
+    if (g_reference_to_leds)
+        set_flash_config(index, flash_hz);
+}
+
+static void _reference_linear_graph(uint16_t value, uint16_t range, const struct LinearGraphThreshold * threshold, uint8_t graph_size, uint8_t start_offset, enum linear_style lstyle, bool left_right)
+{
+    uint8_t graph_length = 0;
+
+    if (lstyle == LINEAR_STYLE_STEPPED) {
+        graph_length = threshold->segment_length;
+    } else {
+        /* percentage of range */
+        uint32_t pct = (value * 100) / range;
+        graph_length = (graph_size * pct) / 100;
+    }
+
+    /* rail to max number of LEDs, for safety */
+    graph_length = graph_length > graph_size ? graph_size : graph_length;
+
+    uint32_t red = threshold->red;
+    uint32_t green = threshold->green;
+    uint32_t blue = threshold->blue;
+    uint8_t flash = threshold->flash_hz;
+
+    size_t i;
+    uint8_t led_index = 0;
+    bool render_lr = left_right != (get_orientation() == DISPLAY_TOP); // Logical XOR
+    for (i = 0; i < graph_size; i++) {
+        if (render_lr) {
+            led_index = start_offset + i;
+        } else {
+            led_index = (start_offset + graph_size - 1) - i;
+        }
+
+        if (i < graph_length) {
+            _reference_set_led(led_index, red, green, blue);
+        } else {
+            _reference_set_led(led_index, 0, 0, 0);
+        }
+        _reference_set_flash_config(led_index, flash);
+    }
+    /* linerally dim the next LED based on the fractional amount */
+    if (lstyle == LINEAR_STYLE_SMOOTH && graph_length < graph_size) {
+        uint32_t pct = (value * 100) / range;
+        uint32_t remainder = (graph_size * pct) % 100;
+        red = red * remainder / 100;
+        green = green * remainder / 100;
+        blue = blue * remainder / 100;
+        led_index = (render_lr) ?
+                    start_offset + graph_length :
+                    (start_offset + graph_size - 1) - graph_length;
+        _reference_set_led(led_index, red, green, blue);
+        _reference_set_flash_config(led_index, flash);
+    }
+}
+
+static void _reference_center_graph(uint16_t value, uint16_t range, const struct LinearGraphThreshold * threshold, enum linear_style lstyle)
+{
+    /* assuming odd number of LEDs */
+    uint8_t center_led = (LINEAR_GRAPH_COUNT / 2);
+    uint8_t graph_count = center_led + 1;
+    uint32_t center_value = range / 2;
+
+    size_t index;
+
+    if (value > center_value) { /* left to right rendering */
+        /*turn off LEDs left of center */
+        for (index = 0; index < center_led; index++) {
+            _reference_set_led(index, 0, 0, 0);
+        }
+        uint8_t offset = (get_orientation() == DISPLAY_BOTTOM) ? center_led : 0;
+        _reference_linear_graph(value - center_value, range / 2, threshold, graph_count, offset, lstyle, true);
+    } else { /* right to left rendering */
+        /* turn off LEDs right of center */
+        for (index = center_led; index < LINEAR_GRAPH_COUNT; index++) {
+            _reference_set_led(index, 0, 0, 0);
+        }
+        uint8_t offset = (get_orientation() == DISPLAY_BOTTOM) ? 0 : center_led;
+        _reference_linear_graph(center_value - value, range / 2, threshold, graph_count, offset, lstyle, false);
+    }
+}
+
+static void _reference_render(const struct GraphConfig *config, uint16_t current_value)
+{
+    static const struct LinearGraphThreshold threshold = {
+        .segment_length = SEGMENT_LENGTH, .red = RED, .green = GREEN, .blue = BLUE
+    };
+    uint32_t low_range = config->low_range;
+    uint32_t range = config->high_range - low_range;
+    uint16_t range_adj_value = current_value < low_range ? 0 : current_value - low_range;
+    if (config->rstyle == RENDER_STYLE_CENTER) {
+        _reference_center_graph(range_adj_value, range, &threshold, config->lstyle);
+    } else {
+        _reference_linear_graph(range_adj_value, range, &threshold, LINEAR_GRAPH_COUNT, LINEAR_GRAPH_OFFSET,
+                                config->lstyle, config->rstyle == RENDER_STYLE_LEFT_RIGHT);
+    }
+}
+
+/* Where the graph should be, in LEDs lit from its start */
+static double _exact_position(const struct GraphConfig *config, uint16_t current_value)
+{
+    double range = config->high_range - config->low_range;
+    double value = current_value < config->low_range ? 0 : current_value - config->low_range;
+    value = value > range ? range : value;
+    if (config->rstyle != RENDER_STYLE_CENTER)
+        return value * LINEAR_GRAPH_COUNT / range;
+    /* the center graph's ranges are whole halves, as rendered */
+    double center_value = floor(range / 2);
+    return fabs(value - center_value) * (LINEAR_GRAPH_COUNT / 2 + 1) / center_value;
+}
+
+static uint16_t _test_value(const struct GraphConfig *config, size_t index)
+{
+    /* from below the range to beyond it */
+    uint32_t span = config->high_range - config->low_range;
+    int32_t value = (int32_t)config->low_range - (int32_t)(span / 8) +
+                    (int32_t)((uint64_t)index * (span + span / 4) / (VALUES_PER_CONFIG - 1));
+    return (uint16_t)max(0, min(UINT16_MAX, value));
+}
+
+/* Golden run: the firmware renders over CAN, read back from the LED frames */
+
+static virtual_timer_t g_step_timer;
+static size_t g_config_step;
+static size_t g_config_index;
+static size_t g_value_index;
+static uint16_t g_value;
+static bool g_checking;
+static uint8_t g_frame[TXBUF_LEN];
+
+static uint32_t g_frames_checked;
+static uint32_t g_mismatched_frames;
+static uint32_t g_inexact_frames;
+static double g_reference_diff_max;
+static double g_error_max;
+static double g_reference_error_max;
+
+static void _send_config(const struct GraphConfig *config)
+{
+    const uint8_t data[] = {config->rstyle, config->lstyle,
+                            config->low_range & 0xFF, config->low_range >> 8,
+                            config->high_range & 0xFF, config->high_range >> 8};
+    sim_api_receive(API_CONFIG_LINEAR_GRAPH, data, sizeof(data));
+}
+
+/* One threshold from 0; the power up thresholds are disabled */
+static void _send_threshold(uint8_t id)
+{
+    const uint8_t data[] = {id, id == 0 ? SEGMENT_LENGTH : 0, 0, 0,
+                            id == 0 ? RED : 0, id == 0 ? GREEN : 0, id == 0 ? BLUE : 0, 0};
+    sim_api_receive(API_SET_LINEAR_THRESHOLD, data, sizeof(data));
+}
+
+static void _check_frame(const struct GraphConfig *config, uint16_t value)
+{
+    memset(g_expected, 0, sizeof(g_expected));
+    _reference_render(config, value);
+
+    size_t differing = 0;
+    double position = 0;
+    double reference_position = 0;
+    for (size_t i = LINEAR_GRAPH_OFFSET; i < LINEAR_GRAPH_OFFSET + LINEAR_GRAPH_COUNT; i++) {
+        const uint8_t *led = &g_frame[APA102_LED_DATA_START + i * APA102_BYTES_PER_LED];
+        uint8_t color[3] = {led[3], led[2], led[1]};
+        differing += memcmp(color, g_expected[i], sizeof(color)) != 0;
+        position += color[0] / (double)RED;
+        reference_position += g_expected[i][0] / (double)RED;
+    }
+    g_frames_checked++;
+
+    /* the edge may move by a LED where the reference rounds a percent down */
+    if (differing > 2)
+        g_mismatched_frames++;
+    bool at_end = value <= config->low_range || value >= config->high_range;
+    if (differing && (at_end || config->lstyle == LINEAR_STYLE_STEPPED))
+        g_inexact_frames++;
+    if (config->lstyle == LINEAR_STYLE_STEPPED)
+        return;
+
+    double exact = _exact_position(config, value);
+    double diff = fabs(position - reference_position);
+    double error = fabs(position - exact);
+    double reference_error = fabs(reference_position - exact);
+    g_reference_diff_max = diff > g_reference_diff_max ? diff : g_reference_diff_max;
+    g_error_max = error > g_error_max ? error : g_error_max;
+    g_reference_error_max = reference_error > g_reference_error_max ? reference_error : g_reference_error_max;
+}
+
+static void _step(void *par)
+{
+    (void)par;
+    uint64_t now = sim_now_us();
+    const struct GraphConfig *config = &g_configs[g_config_index];
+
+    if (g_config_step <= LINEAR_GRAPH_THRESHOLDS) {
+        /* configure a frame at a time, so the receive FIFO never overruns */
+        if (g_config_step == 0)
+            _send_config(config);
+        else if (g_config_index == 0)
+            _send_threshold(g_config_step - 1);
+        g_config_step++;
+        sim_timer_set_at(&g_step_timer, now + CONFIG_STEP_US, _step, NULL);
+        return;
+    }
+    if (g_checking) {
+        _check_frame(config, g_value);
+        g_checking = false;
+        if (++g_value_index == VALUES_PER_CONFIG) {
+            g_value_index = 0;
+            g_config_step = 0;
+            if (++g_config_index == CONFIG_COUNT)
+                sim_finish();
+        }
+        sim_timer_set_at(&g_step_timer, now + VALUE_STEP_US - CHECK_DELAY_US, _step, NULL);
+        return;
+    }
+    g_value = _test_value(config, g_value_index);
+    const uint8_t update[] = {g_value & 0xFF, g_value >> 8};
+    sim_api_receive(API_SET_CURRENT_LINEAR_GRAPH_VALUE, update, sizeof(update));
+    g_checking = true;
+    sim_timer_set_at(&g_step_timer, now + CHECK_DELAY_US, _step, NULL);
+}
+
+static void _spi_tx(const uint8_t *data, size_t length)
+{
+    if (length == TXBUF_LEN)
+        memcpy(g_frame, data, TXBUF_LEN);
+}
+
+/* Benchmark: renders called directly, before the firmware starts */
+
+static CANRxFrame _message(const uint8_t *data, uint8_t length)
+{
+    CANRxFrame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.DLC = length;
+    memcpy(frame.data8, data, length);
+    return frame;
+}
+
+static void _bench(void)
+{
+    const struct GraphConfig *config = &g_configs[0];
+    api_initialize();
+    const uint8_t config_data[] = {config->rstyle, config->lstyle,
+                                   config->low_range & 0xFF, config->low_range >> 8,
+                                   config->high_range & 0xFF, config->high_range >> 8};
+    CANRxFrame message = _message(config_data, sizeof(config_data));
+    api_config_linear_graph(&message);
+    for (uint8_t id = 0; id < LINEAR_GRAPH_THRESHOLDS; id++) {
+        const uint8_t data[] = {id, 0, 0, 0, id == 0 ? RED : 0, id == 0 ? GREEN : 0, id == 0 ? BLUE : 0, 0};
+        message = _message(data, sizeof(data));
+        api_set_linear_threshold(&message);
+    }
+
+    uint64_t firmware_ns = 0;
+    uint64_t reference_ns = 0;
+    g_reference_to_leds = true;
+    for (size_t round = 0; round < BENCH_ROUNDS; round++) {
+        uint64_t start_ns = sim_thread_cpu_ns();
+        for (size_t i = 0; i < VALUES_PER_CONFIG; i++) {
+            uint16_t value = _test_value(config, i);
+            const uint8_t update[] = {value & 0xFF, value >> 8};
+            message = _message(update, sizeof(update));
+            api_set_current_linear_graph_value(&message);
+            api_render_pending();
+        }
+        firmware_ns += sim_thread_cpu_ns() - start_ns;
+
+        start_ns = sim_thread_cpu_ns();
+        for (size_t i = 0; i < VALUES_PER_CONFIG; i++) {
+            _reference_render(config, _test_value(config, i));
+        }
+        reference_ns += sim_thread_cpu_ns() - start_ns;
+    }
+    g_reference_to_leds = false;
+
+    double renders = (double)BENCH_ROUNDS * VALUES_PER_CONFIG;
+    printf("render per value (host CPU ns): fixed point %.1f, percent %.1f\n",
+           firmware_ns / renders, reference_ns / renders);
+    sim_check(firmware_ns / renders < BENCH_MAX_NS_PER_RENDER, "a render took %.1fns", firmware_ns / renders);
+}
+
+static void _finish(void)
+{
+    printf("%u frames: %u differ beyond the edge LED, %u inexact where they should match\n",
+           g_frames_checked, g_mismatched_frames, g_inexact_frames);
+    printf("graph position error (LEDs): max %.4f, percent renderer %.4f; max difference %.4f\n",
+           g_error_max, g_reference_error_max, g_reference_diff_max);
+
+    sim_check(g_frames_checked == CONFIG_COUNT * VALUES_PER_CONFIG, "%u of %zu frames checked",
+              g_frames_checked, CONFIG_COUNT * VALUES_PER_CONFIG);
+    sim_check(g_mismatched_frames == 0, "%u frames differ from the reference beyond the edge LED",
+              g_mismatched_frames);
+    sim_check(g_inexact_frames == 0, "%u frames differ at the ends of the range or stepped", g_inexact_frames);
+    /* a percent of the graph, and a dimming step either way */
+    sim_check(g_reference_diff_max <= LINEAR_GRAPH_COUNT / 100.0 + 2.0 / RED,
+              "graph position differs from the reference by %.4f LEDs", g_reference_diff_max);
+    /* the dimming fraction is truncated, and so is each channel */
+    sim_check(g_error_max <= 2.0 / RED, "graph position off by up to %.4f LEDs", g_error_max);
+    exit(sim_test_status("test_linear_graph"));
+}
+
+static const struct SimHooks hooks = {
+    .spi_tx = _spi_tx,
+    .finish = _finish
+};
+
+int main(void)
+{
+    sim_start(&hooks);
+    _bench();
+
+    sim_board_init(false, false);
+    chVTObjectInit(&g_step_timer);
+    sim_timer_set_at(&g_step_timer, CONFIG_US, _step, NULL);
+    return shiftx3_main();
+}
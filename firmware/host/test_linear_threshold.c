@@ -0,0 +1,290 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Linear graph threshold lookup. Programs random sets of thresholds,
+ * with repeated values, disabled thresholds and thresholds out of order,
+ * into a stepped graph where every threshold draws a segment of its own
+ * length and color. Sweeps values around each threshold and checks the
+ * segment drawn against a scan of the thresholds, as selection worked
+ * before the breakpoint table. Then reports the host CPU time of a graph
+ * update with one threshold and with all of them enabled.
+ */
+
+#include "sim_harness.h"
+#include "shiftx3_api.h"
+#include "system_LED.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* after the startup demo would begin, which the configuration ends */
+#define CONFIG_US       1100000
+#define CONFIG_STEP_US  10000
+#define VALUE_STEP_US   3000
+#define CHECK_DELAY_US  2000
+
+#define THRESHOLD_SETS  40
+/* values around each threshold, then some anywhere */
+#define RANDOM_VALUES   8
+#define MAX_VALUES      (3 * LINEAR_GRAPH_THRESHOLDS + RANDOM_VALUES + 2)
+
+#define BENCH_ROUNDS 2000
+#define BENCH_VALUES 256
+/* a generous bound; either way it is a small part of a frame */
+#define BENCH_MAX_NS_PER_UPDATE 20000
+
+static uint32_t g_random = 12345;
+
+static uint32_t _random(void)
+{
+    g_random = g_random * 1103515245 + 12345;
+    return g_random >> 8;
+}
+
+/* Each threshold draws its id + 1 LEDs in a color of its own */
+static struct LinearGraphThreshold g_thresholds[LINEAR_GRAPH_THRESHOLDS];
+
+static void _random_thresholds(void)
+{
+    static const uint16_t pool[] = {0, 0, 1000, 2000, 2000, 3000, 3001, UINT16_MAX};
+    for (size_t i = 0; i < LINEAR_GRAPH_THRESHOLDS; i++) {
+        struct LinearGraphThreshold *t = &g_thresholds[i];
+        t->threshold = _random() % 2 ? pool[_random() % (sizeof(pool) / sizeof(pool[0]))] : _random() % 8000;
+        t->segment_length = i + 1;
+        t->red = 40 * (i + 1);
+        t->green = 255 - 40 * i;
+        t->blue = i;
+        t->flash_hz = 0;
+    }
+}
+
+/* The reference: every threshold scanned, the last one matching wins */
+static const struct LinearGraphThreshold * _reference_select(uint16_t value)
+{
+    const struct LinearGraphThreshold *t = NULL;
+    for (size_t i = 0; i < LINEAR_GRAPH_THRESHOLDS; i++) {
+        const struct LinearGraphThreshold *ttest = &g_thresholds[i];
+        if (value >= ttest->threshold && (ttest->threshold > 0 || i == 0)) {
+            t = ttest;
+        }
+    }
+    return t;
+}
+
+static CANRxFrame _threshold_message(size_t id)
+{
+    const struct LinearGraphThreshold *t = &g_thresholds[id];
+    CANRxFrame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.DLC = 8;
+    frame.data8[0] = id;
+    frame.data8[1] = t->segment_length;
+    frame.data16[1] = t->threshold;
+    frame.data8[4] = t->red;
+    frame.data8[5] = t->green;
+    frame.data8[6] = t->blue;
+    frame.data8[7] = t->flash_hz;
+    return frame;
+}
+
+/* Lookup run: the firmware renders over CAN, read back from the LED frames */
+
+static virtual_timer_t g_step_timer;
+static size_t g_set;
+static size_t g_config_step;
+static uint16_t g_values[MAX_VALUES];
+static size_t g_value_count;
+static size_t g_value_index;
+static bool g_checking;
+static uint8_t g_frame[TXBUF_LEN];
+
+static uint32_t g_checked;
+static uint32_t g_wrong;
+
+static void _pick_values(void)
+{
+    g_value_count = 0;
+    g_values[g_value_count++] = 0;
+    g_values[g_value_count++] = UINT16_MAX;
+    for (size_t i = 0; i < LINEAR_GRAPH_THRESHOLDS; i++) {
+        uint16_t threshold = g_thresholds[i].threshold;
+        g_values[g_value_count++] = threshold;
+        g_values[g_value_count++] = threshold > 0 ? threshold - 1 : threshold;
+        g_values[g_value_count++] = threshold < UINT16_MAX ? threshold + 1 : threshold;
+    }
+    for (size_t i = 0; i < RANDOM_VALUES; i++) {
+        g_values[g_value_count++] = _random() % 9000;
+    }
+}
+
+static void _check_frame(uint16_t value)
+{
+    const struct LinearGraphThreshold *t = _reference_select(value);
+    size_t wrong_leds = 0;
+    for (size_t i = 0; i < LINEAR_GRAPH_COUNT; i++) {
+        const uint8_t *led = &g_frame[APA102_LED_DATA_START + (LINEAR_GRAPH_OFFSET + i) * APA102_BYTES_PER_LED];
+        bool lit = t && i < t->segment_length;
+        uint8_t red = lit ? t->red : 0;
+        uint8_t green = lit ? t->green : 0;
+        uint8_t blue = lit ? t->blue : 0;
+        wrong_leds += led[3] != red || led[2] != green || led[1] != blue;
+    }
+    g_checked++;
+    if (wrong_leds) {
+        g_wrong++;
+        sim_check(false, "set %zu: value %u drew the wrong threshold, expected %d",
+                  g_set, value, t ? (int)(t - g_thresholds) : -1);
+    }
+}
+
+static void _step(void *par)
+{
+    (void)par;
+    uint64_t now = sim_now_us();
+
+    /* configure a frame at a time, so the receive FIFO never overruns */
+    if (g_set == 0 && g_config_step == 0) {
+        /* stepped, left to right */
+        const uint8_t config[] = {RENDER_STYLE_LEFT_RIGHT, LINEAR_STYLE_STEPPED, 0, 0, 0x10, 0x27};
+        sim_api_receive(API_CONFIG_LINEAR_GRAPH, config, sizeof(config));
+        _random_thresholds();
+        g_config_step++;
+        sim_timer_set_at(&g_step_timer, now + CONFIG_STEP_US, _step, NULL);
+        return;
+    }
+    if (g_config_step <= LINEAR_GRAPH_THRESHOLDS) {
+        CANRxFrame message = _threshold_message(g_config_step - 1);
+        sim_api_receive(API_SET_LINEAR_THRESHOLD, message.data8, message.DLC);
+        if (++g_config_step > LINEAR_GRAPH_THRESHOLDS)
+            _pick_values();
+        sim_timer_set_at(&g_step_timer, now + CONFIG_STEP_US, _step, NULL);
+        return;
+    }
+    if (g_checking) {
+        _check_frame(g_values[g_value_index]);
+        g_checking = false;
+        if (++g_value_index == g_value_count) {
+            g_value_index = 0;
+            if (++g_set == THRESHOLD_SETS)
+                sim_finish();
+            _random_thresholds();
+            g_config_step = 1;
+        }
+        sim_timer_set_at(&g_step_timer, now + VALUE_STEP_US - CHECK_DELAY_US, _step, NULL);
+        return;
+    }
+    uint16_t value = g_values[g_value_index];
+    const uint8_t update[] = {value & 0xFF, value >> 8};
+    sim_api_receive(API_SET_CURRENT_LINEAR_GRAPH_VALUE, update, sizeof(update));
+    g_checking = true;
+    sim_timer_set_at(&g_step_timer, now + CHECK_DELAY_US, _step, NULL);
+}
+
+static void _spi_tx(const uint8_t *data, size_t length)
+{
+    if (length == TXBUF_LEN)
+        memcpy(g_frame, data, TXBUF_LEN);
+}
+
+/* Benchmark: updates rendered directly, before the firmware starts */
+
+static uint64_t _bench_updates(size_t enabled)
+{
+    for (size_t i = 0; i < LINEAR_GRAPH_THRESHOLDS; i++) {
+        struct LinearGraphThreshold *t = &g_thresholds[i];
+        t->threshold = i < enabled ? i * (8000 / LINEAR_GRAPH_THRESHOLDS) : 0;
+        t->segment_length = i + 1;
+        t->red = t->green = t->blue = 255;
+        t->flash_hz = 0;
+        CANRxFrame message = _threshold_message(i);
+        api_set_linear_threshold(&message);
+    }
+
+    CANRxFrame update;
+    memset(&update, 0, sizeof(update));
+    update.DLC = 2;
+    uint64_t start_ns = sim_thread_cpu_ns();
+    for (size_t round = 0; round < BENCH_ROUNDS; round++) {
+        for (size_t i = 0; i < BENCH_VALUES; i++) {
+            update.data16[0] = i * (10000 / BENCH_VALUES);
+            api_set_current_linear_graph_value(&update);
+            api_render_pending();
+        }
+    }
+    return sim_thread_cpu_ns() - start_ns;
+}
+
+static void _bench(void)
+{
+    api_initialize();
+    CANRxFrame config;
+    memset(&config, 0, sizeof(config));
+    config.DLC = 6;
+    config.data8[0] = RENDER_STYLE_LEFT_RIGHT;
+    config.data8[1] = LINEAR_STYLE_SMOOTH;
+    config.data16[2] = 10000;
+    api_config_linear_graph(&config);
+
+    double updates = (double)BENCH_ROUNDS * BENCH_VALUES;
+    _bench_updates(LINEAR_GRAPH_THRESHOLDS);
+    double one = _bench_updates(1) / updates;
+    double all = _bench_updates(LINEAR_GRAPH_THRESHOLDS) / updates;
+
+    /* the scan it replaced, on its own */
+    volatile uintptr_t sink = 0;
+    uint64_t start_ns = sim_thread_cpu_ns();
+    for (size_t round = 0; round < BENCH_ROUNDS; round++) {
+        for (size_t i = 0; i < BENCH_VALUES; i++) {
+            sink = (uintptr_t)_reference_select(i * (10000 / BENCH_VALUES));
+        }
+    }
+    (void)sink;
+    double scan = (sim_thread_cpu_ns() - start_ns) / updates;
+
+    printf("graph update (host CPU ns): %.1f with 1 threshold, %.1f with %d; threshold scan alone %.1f\n",
+           one, all, LINEAR_GRAPH_THRESHOLDS, scan);
+    sim_check(all < BENCH_MAX_NS_PER_UPDATE, "a graph update took %.1fns", all);
+}
+
+static void _finish(void)
+{
+    printf("%u values over %d threshold sets, %u drew the wrong threshold\n",
+           g_checked, THRESHOLD_SETS, g_wrong);
+    sim_check(g_set == THRESHOLD_SETS, "%zu of %d threshold sets checked", g_set, THRESHOLD_SETS);
+    exit(sim_test_status("test_linear_threshold"));
+}
+
+static const struct SimHooks hooks = {
+    .spi_tx = _spi_tx,
+    .finish = _finish
+};
+
+int main(void)
+{
+    sim_start(&hooks);
+    _bench();
+
+    sim_board_init(false, false);
+    chVTObjectInit(&g_step_timer);
+    sim_timer_set_at(&g_step_timer, CONFIG_US, _step, NULL);
+    return shiftx3_main();
+}
@@ -0,0 +1,198 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Linear graph prediction error. Replays an RPM sweep, sampled at a
+ * jittery ~30Hz, to a smooth graph with prediction enabled and reads the
+ * graph position back from the LED frames every millisecond.
+ *
+ * Checks that the graph:
+ *  - never steps back while the value rises, even when a sample is late
+ *  - tracks the sweep at least twice as closely as showing the last
+ *    sample received would
+ *  - settles on the last sample once updates stop
+ */
+
+#include "sim_harness.h"
+#include "shiftx3_api.h"
+#include "system_LED.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CONFIG_US       500000
+#define CONFIG_STEP_US  10000
+#define SWEEP_START_US  1000000
+#define RISE_US         2000000
+#define FALL_US         1000000
+#define SWEEP_END_US    (SWEEP_START_US + RISE_US + FALL_US)
+#define END_US          (SWEEP_END_US + 1000000)
+#define SAMPLE_STEP_US  1000
+
+#define RANGE           7000
+#define PEAK_VALUE      7000
+#define FINAL_VALUE     2000
+
+/* Time between updates, cycled: mostly 33ms, some early, some late */
+static const uint32_t g_update_intervals_ms[] = {33, 33, 45, 33, 25, 33, 60, 33, 40, 28};
+
+/* The graph may step back by a dimming level without counting as a reversal */
+#define REVERSAL_TOLERANCE_LEDS 0.02
+
+static virtual_timer_t g_update_timer;
+static virtual_timer_t g_sample_timer;
+static size_t g_config_step;
+static size_t g_update_count;
+static uint16_t g_last_update;
+static double g_position_leds;
+
+static double g_error_sum;
+static double g_error_max;
+static double g_hold_error_sum;
+static uint32_t g_error_samples;
+static double g_rise_position;
+static uint32_t g_reversals;
+static double g_reversal_max;
+
+static uint16_t _sweep_value(uint64_t now)
+{
+    if (now < SWEEP_START_US)
+        return 0;
+    if (now < SWEEP_START_US + RISE_US)
+        return (uint16_t)((now - SWEEP_START_US) * PEAK_VALUE / RISE_US);
+    if (now < SWEEP_END_US)
+        return (uint16_t)(PEAK_VALUE - (now - SWEEP_START_US - RISE_US) * (PEAK_VALUE - FINAL_VALUE) / FALL_US);
+    return FINAL_VALUE;
+}
+
+static double _value_leds(uint16_t value)
+{
+    return (double)value * LINEAR_GRAPH_COUNT / RANGE;
+}
+
+/* Configuration is sent a frame at a time, so the receive FIFO never overruns */
+static void _configure(size_t step)
+{
+    if (step == 0) {
+        /* left to right, smooth, 0 - RANGE, with prediction */
+        const uint8_t config[] = {0, 0, 0, 0, RANGE & 0xFF, RANGE >> 8, 1};
+        sim_api_receive(API_CONFIG_LINEAR_GRAPH, config, sizeof(config));
+    } else {
+        /* one green threshold from 0; the power up thresholds are disabled */
+        uint8_t id = step - 1;
+        const uint8_t threshold[] = {id, 0, 0, 0, 0, id == 0 ? 255 : 0, 0, 0};
+        sim_api_receive(API_SET_LINEAR_THRESHOLD, threshold, sizeof(threshold));
+    }
+}
+
+static void _send_update(void *par)
+{
+    (void)par;
+    uint64_t now = sim_now_us();
+    if (now < SWEEP_START_US) {
+        _configure(g_config_step++);
+        sim_timer_set_at(&g_update_timer, g_config_step <= LINEAR_GRAPH_THRESHOLDS ? now + CONFIG_STEP_US : SWEEP_START_US,
+                         _send_update, NULL);
+        return;
+    }
+    g_last_update = _sweep_value(now);
+    const uint8_t update[] = {g_last_update & 0xFF, g_last_update >> 8};
+    sim_api_receive(API_SET_CURRENT_LINEAR_GRAPH_VALUE, update, sizeof(update));
+
+    /* the last update is the final value, then updates stop */
+    if (now >= SWEEP_END_US)
+        return;
+    size_t interval = g_update_count++ % (sizeof(g_update_intervals_ms) / sizeof(g_update_intervals_ms[0]));
+    uint64_t next = now + g_update_intervals_ms[interval] * 1000;
+    sim_timer_set_at(&g_update_timer, next < SWEEP_END_US ? next : SWEEP_END_US, _send_update, NULL);
+}
+
+/* Compare what the graph shows with the sweep */
+static void _sample(void *par)
+{
+    (void)par;
+    uint64_t now = sim_now_us();
+    bool started = g_update_count >= 2;
+
+    if (started && now < SWEEP_END_US) {
+        double error = fabs(g_position_leds - _value_leds(_sweep_value(now)));
+        g_error_sum += error;
+        g_error_max = error > g_error_max ? error : g_error_max;
+        g_hold_error_sum += fabs(_value_leds(g_last_update) - _value_leds(_sweep_value(now)));
+        g_error_samples++;
+    }
+    if (started && now < SWEEP_START_US + RISE_US) {
+        double step_back = g_rise_position - g_position_leds;
+        if (step_back > REVERSAL_TOLERANCE_LEDS) {
+            g_reversals++;
+            g_reversal_max = step_back > g_reversal_max ? step_back : g_reversal_max;
+        }
+        g_rise_position = g_position_leds;
+    }
+    sim_timer_set_at(&g_sample_timer, now + SAMPLE_STEP_US, _sample, NULL);
+}
+
+/* Graph position in LEDs: the lit LEDs plus the dimmed one's fraction */
+static void _spi_tx(const uint8_t *data, size_t length)
+{
+    if (length != TXBUF_LEN)
+        return;
+    unsigned green = 0;
+    for (size_t i = 0; i < LINEAR_GRAPH_COUNT; i++) {
+        green += data[APA102_LED_DATA_START + (LINEAR_GRAPH_OFFSET + i) * APA102_BYTES_PER_LED + 2];
+    }
+    g_position_leds = green / 255.0;
+}
+
+static void _finish(void)
+{
+    double mean_error = g_error_sum / g_error_samples;
+    double hold_error = g_hold_error_sum / g_error_samples;
+    printf("prediction error (LEDs): mean %.3f, max %.3f; holding the last update: mean %.3f\n",
+           mean_error, g_error_max, hold_error);
+
+    sim_check(g_reversals == 0, "graph stepped back %u times while rising, by up to %.3f LEDs",
+              g_reversals, g_reversal_max);
+    sim_check(mean_error * 2 < hold_error, "mean error %.3f LEDs is not half of %.3f without prediction",
+              mean_error, hold_error);
+    sim_check(fabs(g_position_leds - _value_leds(FINAL_VALUE)) < 0.01,
+              "graph at %.3f LEDs after updates stopped, expected %.3f",
+              g_position_leds, _value_leds(FINAL_VALUE));
+    exit(sim_test_status("test_prediction"));
+}
+
+static const struct SimHooks hooks = {
+    .spi_tx = _spi_tx,
+    .finish = _finish
+};
+
+int main(void)
+{
+    sim_start(&hooks);
+    sim_set_end_time(END_US);
+    sim_board_init(false, false);
+
+    chVTObjectInit(&g_update_timer);
+    chVTObjectInit(&g_sample_timer);
+    sim_timer_set_at(&g_update_timer, CONFIG_US, _send_update, NULL);
+    sim_timer_set_at(&g_sample_timer, SWEEP_START_US, _sample, NULL);
+    return shiftx3_main();
+}
@@ -0,0 +1,200 @@
+#!/usr/bin/env python3
+#
+# ShiftX3 firmware
+#
+# Copyright (C) 2018 Autosport Labs
+#
+# This file is part of the Race Capture firmware suite
+#
+# This is free software: you can redistribute it and/or modify it
+# under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This software is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+#
+# See the GNU General Public License for more details. You should
+# have received a copy of the GNU General Public License along with
+# this code. If not, see <http://www.gnu.org/licenses/>.
+
+"""
+Decode the ShiftX3 binary log.
+
+The firmware writes each log record as a COBS encoded frame ending in a
+zero byte. A record is little endian words: a header (format id in bits
+0-15, argument count in bits 16-23), the system time in ticks and then
+the arguments. Format ids are offsets into the firmware ELF's .logfmt
+section, so the ELF the firmware was built from is needed to decode;
+that may also be the host build's executable.
+
+usage: log_decode.py [-b baud] [-t tick_hz] build/main.elf [port_or_file]
+
+Reads stdin when no port or file is given.
+"""
+
+import getopt
+import re
+import struct
+import sys
+
+LOG_FORMAT_ID_MASK = 0xFFFF
+LOG_FORMAT_DROPPED = 0xFFFF
+LOG_ARG_COUNT_SHIFT = 16
+
+# matches CH_CFG_ST_FREQUENCY
+DEFAULT_TICK_HZ = 10000
+
+CONVERSION = re.compile(r'%[-+ #0]*\d*(?:\.\d+)?l?([diuxXcs%])')
+
+
+def read_log_formats(elf_path):
+    """Return the .logfmt section of a little endian ELF file"""
+    with open(elf_path, 'rb') as f:
+        elf = f.read()
+    if elf[:4] != b'\x7fELF' or elf[4] not in (1, 2) or elf[5] != 1:
+        raise ValueError('%s is not a little endian ELF file' % elf_path)
+
+    # the host build (firmware/host) is ELF64
+    if elf[4] == 2:
+        shoff, = struct.unpack_from('<Q', elf, 0x28)
+        shentsize, shnum, shstrndx = struct.unpack_from('<HHH', elf, 0x3A)
+        header = '<IIQQQQ'
+    else:
+        shoff, = struct.unpack_from('<I', elf, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from('<HHH', elf, 0x2E)
+        header = '<IIIIII'
+
+    def section(index):
+        name, _, _, addr, offset, size = struct.unpack_from(header, elf, shoff + index * shentsize)
+        return name, addr, offset, size
+
+    _, _, names_offset, _ = section(shstrndx)
+    for i in range(shnum):
+        name, addr, offset, size = section(i)
+        end = elf.index(b'\0', names_offset + name)
+        if elf[names_offset + name:end] == b'.logfmt':
+            return addr, elf[offset:offset + size]
+    raise ValueError('%s has no .logfmt section' % elf_path)
+
+
+def cobs_decode(frame):
+    out = bytearray()
+    i = 0
+    while i < len(frame):
+        code = frame[i]
+        if code == 0 or i + code > len(frame) + 1:
+            raise ValueError('bad COBS frame')
+        out += frame[i + 1:i + code]
+        i += code
+        if code < 0xFF and i < len(frame):
+            out.append(0)
+    return bytes(out)
+
+
+def format_record(formats, fmt_id, args):
+    addr, strings = formats
+    # format ids are the low 16 bits of the string's address
+    offset = (fmt_id - addr) & LOG_FORMAT_ID_MASK
+    if offset < 0 or offset >= len(strings):
+        return 'unknown log format %d %s' % (fmt_id, args)
+    end = strings.index(b'\0', offset)
+    fmt = strings[offset:end].decode('ascii', 'replace').rstrip('\r\n')
+
+    # the firmware passes every argument as a 32 bit word
+    values = []
+    it = iter(args)
+    for m in CONVERSION.finditer(fmt):
+        conv = m.group(1)
+        if conv == '%':
+            continue
+        value = next(it, 0)
+        if conv in 'di' and value & 0x80000000:
+            value -= 1 << 32
+        elif conv == 's':
+            value = '0x%08X' % value
+        values.append(value)
+    fmt = fmt.replace('%l', '%').replace('%u', '%d')
+    try:
+        return fmt % tuple(values)
+    except (TypeError, ValueError):
+        return '%s %s' % (fmt, args)
+
+
+def record_length(header):
+    """Length in bytes of a record, from its header word"""
+    return 4 * (2 + (header >> LOG_ARG_COUNT_SHIFT))
+
+
+def decode_record(formats, record, tick_hz):
+    if len(record) < 8 or len(record) % 4:
+        raise ValueError('bad record length %d' % len(record))
+    words = struct.unpack('<%dI' % (len(record) // 4), record)
+    header, ticks = words[0], words[1]
+    fmt_id = header & 0xFFFF
+    args = words[2:2 + (header >> LOG_ARG_COUNT_SHIFT)]
+    if fmt_id == LOG_FORMAT_DROPPED:
+        text = '%d log records dropped' % args[0]
+    else:
+        text = format_record(formats, fmt_id, args)
+    return '%d %s' % (ticks * 1000 // tick_hz, text)
+
+
+def decode_frame(formats, frame, tick_hz):
+    return decode_record(formats, cobs_decode(frame), tick_hz)
+
+
+def open_input(path, baud):
+    if path is None:
+        return sys.stdin.buffer
+    if path.startswith('/dev/') or path.upper().startswith('COM'):
+        import serial
+        return serial.Serial(path, baud)
+    return open(path, 'rb')
+
+
+def usage():
+    print(__doc__)
+    sys.exit(2)
+
+
+def main():
+    try:
+        opts, args = getopt.getopt(sys.argv[1:], 'hb:t:')
+    except getopt.GetoptError:
+        usage()
+    baud = 115200
+    tick_hz = DEFAULT_TICK_HZ
+    for o, a in opts:
+        if o == '-b':
+            baud = int(a)
+        elif o == '-t':
+            tick_hz = int(a)
+        else:
+            usage()
+    if len(args) not in (1, 2):
+        usage()
+
+    formats = read_log_formats(args[0])
+    stream = open_input(args[1] if len(args) > 1 else None, baud)
+
+    frame = bytearray()
+    while True:
+        data = stream.read(1)
+        if not data:
+            break
+        if data[0] != 0:
+            frame += data
+            continue
+        if frame:
+            try:
+                print(decode_frame(formats, bytes(frame), tick_hz))
+            except ValueError as e:
+                print('undecodable record: %s' % e)
+            sys.stdout.flush()
+        frame = bytearray()
+
+
+if __name__ == '__main__':
+    main()
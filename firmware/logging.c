@@ -19,53 +19,152 @@
  * this code. If not, see <http://www.gnu.org/licenses/>.
  */
 #include "logging.h"
+#include "system_CAN_log.h"
+#include <stdint.h>
 
-static enum logging_levels logging_level = logging_level_info;
+/*
+ * Single producer / single consumer ring of log records, in words.
+ * Log calls are made from the scheduler thread and the log worker is
+ * the only writer of tail, so no locking is needed; the indexes run
+ * freely and are masked on access.
+ *
+ * A record is a header word (format ID in bits 0-15, argument count in
+ * bits 16-23), the system time in ticks and then the arguments. On the
+ * wire each record is COBS encoded and ends with a zero byte.
+ */
+#define LOG_RING_WORDS 128
+#define LOG_RING_MASK (LOG_RING_WORDS - 1)
+#define LOG_FORMAT_ID_MASK 0xFFFF
+#define LOG_ARG_COUNT_SHIFT 16
+
+/* Format ID of the record reporting how many records were dropped */
+#define LOG_FORMAT_DROPPED 0xFFFF
+
+#define compiler_barrier() __asm__ volatile("" ::: "memory")
+
+enum logging_levels g_logging_level = logging_level_info;
+uint16_t g_logging_subsystems = LOG_SUBSYSTEMS;
+
+static uint32_t g_log_ring[LOG_RING_WORDS];
+static volatile uint32_t g_log_head;
+static volatile uint32_t g_log_tail;
+static volatile uint32_t g_log_drops;
+
+/* Wakes the log worker */
+static BSEMAPHORE_DECL(g_log_sem, true);
 
 void set_logging_level(enum logging_levels level)
 {
     if (level > logging_level_trace)
         return;
-    logging_level = level;
+    g_logging_level = level;
 }
 
 enum logging_levels get_logging_level(void)
 {
-    return logging_level;
+    return g_logging_level;
 }
 
-static void _log_trace_can_frame(uint8_t dlc, uint8_t ide, uint32_t sid, uint32_t eid, uint8_t * data_bytes)
+/* Enable logging for a mask of LOG_SUBSYSTEM_MASK() bits; those not built in stay off */
+void set_logging_subsystems(uint16_t mask)
 {
-    uint32_t can_id = ide == CAN_IDE_EXT ? eid : sid;
-    log_trace_b(" ID(%i) ", can_id);
+    g_logging_subsystems = mask;
+}
 
-    size_t i;
-    for (i = 0; i < dlc; i++) {
-        log_trace_b("%02X ", data_bytes[i]);
-    }
+uint16_t get_logging_subsystems(void)
+{
+    return g_logging_subsystems;
 }
-void log_CAN_rx_message(char* log_pfx, CANRxFrame * can_frame)
+
+uint32_t get_log_drops(void)
 {
-    if (get_logging_level() < logging_level_trace)
-        return;
+    return g_log_drops;
+}
 
-    log_trace(log_pfx);
-    log_trace_b("CAN Rx");
+void log_record(const char *format, const uint32_t *args, size_t count)
+{
+    count = count > LOG_MAX_ARGS ? LOG_MAX_ARGS : count;
+    uint32_t words = LOG_RECORD_HEADER_WORDS + count;
+    uint32_t head = g_log_head;
+    if (LOG_RING_WORDS - (head - g_log_tail) < words) {
+        g_log_drops++;
+        return;
+    }
+    g_log_ring[head++ & LOG_RING_MASK] = ((uintptr_t)format & LOG_FORMAT_ID_MASK) | count << LOG_ARG_COUNT_SHIFT;
+    g_log_ring[head++ & LOG_RING_MASK] = chVTGetSystemTimeX();
+    for (size_t i = 0; i < count; i++) {
+        g_log_ring[head++ & LOG_RING_MASK] = args[i];
+    }
+    compiler_barrier();
+    g_log_head = head;
+    chBSemSignal(&g_log_sem);
+}
 
-    _log_trace_can_frame(can_frame->DLC, can_frame->IDE, can_frame->SID, can_frame->EID, can_frame->data8);
+/* COBS encode a record and append the frame delimiter; returns the encoded length */
+static size_t _cobs_encode(const uint8_t *src, size_t length, uint8_t *dst)
+{
+    size_t code_index = 0;
+    size_t out = 1;
+    uint8_t code = 1;
+    for (size_t i = 0; i < length; i++) {
+        if (src[i] != 0) {
+            dst[out++] = src[i];
+            code++;
+        }
+        if (src[i] == 0 || code == 0xFF) {
+            dst[code_index] = code;
+            code_index = out++;
+            code = 1;
+        }
+    }
+    dst[code_index] = code;
+    dst[out++] = 0;
+    return out;
 }
 
+static void _write_record(const uint32_t *record, size_t words)
+{
+    uint8_t frame[LOG_RECORD_MAX_BYTES + LOG_RECORD_MAX_BYTES / 254 + 2];
+    size_t length = _cobs_encode((const uint8_t *)record, words * sizeof(uint32_t), frame);
+    sdWrite(&SD2, frame, length);
+    can_log_write_record(record, words);
+}
 
-void log_CAN_tx_message(char *log_pfx, CANTxFrame * can_frame)
+/*
+ * Drain the log records to the serial port and CAN; runs at the lowest
+ * priority. CAN frames are paced by waking for the next one that is due,
+ * so the serial port never waits on the CAN budget.
+ */
+void log_worker(void)
 {
-    if (get_logging_level() < logging_level_info)
-        return;
+    chRegSetThreadName("log");
+    uint32_t drops_reported = 0;
+    while (true) {
+        chBSemWaitTimeout(&g_log_sem, can_log_service());
 
-    log_info(log_pfx);
-    log_info_b("CAN Tx");
+        uint32_t tail = g_log_tail;
+        while (tail != g_log_head) {
+            uint32_t record[LOG_RECORD_MAX_WORDS];
+            uint32_t header = g_log_ring[tail & LOG_RING_MASK];
+            size_t words = LOG_RECORD_HEADER_WORDS + (header >> LOG_ARG_COUNT_SHIFT);
+            for (size_t i = 0; i < words; i++) {
+                record[i] = g_log_ring[tail++ & LOG_RING_MASK];
+            }
+            /* free the space before the slow part */
+            compiler_barrier();
+            g_log_tail = tail;
+            _write_record(record, words);
+        }
 
-    if (get_logging_level() >= logging_level_trace) {
-        _log_trace_can_frame(can_frame->DLC, can_frame->IDE, can_frame->SID, can_frame->EID, can_frame->data8);
+        uint32_t drops = g_log_drops;
+        if (drops != drops_reported) {
+            uint32_t record[LOG_RECORD_HEADER_WORDS + 1] = {
+                LOG_FORMAT_DROPPED | 1 << LOG_ARG_COUNT_SHIFT,
+                chVTGetSystemTimeX(),
+                drops - drops_reported
+            };
+            drops_reported = drops;
+            _write_record(record, LOG_RECORD_HEADER_WORDS + 1);
+        }
     }
-    log_info_b("\r\n");
 }
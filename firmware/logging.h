@@ -23,7 +23,6 @@
 #define LOGGING_H_
 #include "ch.h"
 #include "hal.h"
-#include "chprintf.h"
 
 
 enum logging_levels {
@@ -32,19 +31,91 @@ enum logging_levels {
     logging_level_trace
 };
 
-#define log_info(msg, ...) if (get_logging_level() >= logging_level_info) {chprintf((BaseSequentialStream *)&SD2, "%i ", ST2MS(chVTGetSystemTimeX())); chprintf((BaseSequentialStream *)&SD2, msg, ##__VA_ARGS__);}
-#define log_trace(msg, ...) if (get_logging_level() >= logging_level_trace) {chprintf((BaseSequentialStream *)&SD2, "%i ", ST2MS(chVTGetSystemTimeX())); chprintf((BaseSequentialStream *)&SD2, msg, ##__VA_ARGS__);}
+/*
+ * Each source file that logs defines _LOG_SUBSYSTEM, next to its
+ * _LOG_PFX, so its log calls can be filtered as a group.
+ */
+enum logging_subsystem {
+    LOG_SUBSYSTEM_SYS = 0,
+    LOG_SUBSYSTEM_API,
+    LOG_SUBSYSTEM_LED,
+    LOG_SUBSYSTEM_DISPLAY,
+    LOG_SUBSYSTEM_SYS_CAN,
+    LOG_SUBSYSTEM_SYS_SPI,
+    LOG_SUBSYSTEM_ADC,
+    LOG_SUBSYSTEM_BUTTON,
+    LOG_SUBSYSTEM_SCHED
+};
+#define LOG_SUBSYSTEM_MASK(subsystem) (1U << (subsystem))
 
-/* Brief functions */
-#define log_info_b(msg, ...) if (get_logging_level() >= logging_level_info) {chprintf((BaseSequentialStream *)&SD2, msg, ##__VA_ARGS__);}
-#define log_trace_b(msg, ...) if (get_logging_level() >= logging_level_trace) {chprintf((BaseSequentialStream *)&SD2, msg, ##__VA_ARGS__);}
+/*
+ * Build time filters, set from the Makefile: log calls above
+ * LOG_LEVEL_MAX or outside the LOG_SUBSYSTEMS mask fold to nothing,
+ * taking their arguments and format strings with them.
+ */
+#ifndef LOG_LEVEL_MAX
+#define LOG_LEVEL_MAX logging_level_trace
+#endif
+#ifndef LOG_SUBSYSTEMS
+#define LOG_SUBSYSTEMS 0xFFFF
+#endif
+
+/* Runtime filters; read directly so an enabled check is two loads */
+extern enum logging_levels g_logging_level;
+extern uint16_t g_logging_subsystems;
+
+#define log_enabled(level, subsystem) \
+    ((level) <= LOG_LEVEL_MAX && (LOG_SUBSYSTEMS & LOG_SUBSYSTEM_MASK(subsystem)) && \
+     g_logging_level >= (level) && (g_logging_subsystems & LOG_SUBSYSTEM_MASK(subsystem)))
+
+/*
+ * Logging is deferred: a log call only copies its format ID, the time
+ * and up to LOG_MAX_ARGS integer arguments into a ring buffer, and the
+ * log worker drains the records to the serial port. Format strings are
+ * kept out of flash in the ELF's .logfmt section, where the host side
+ * decoder (log_decode.py) looks them up; a string's offset in the
+ * section is its format ID. A record that doesn't fit is dropped and
+ * counted rather than waited for.
+ */
+#define LOG_MAX_ARGS 8
+
+/* A record is a header word, the system time and then the arguments */
+#define LOG_RECORD_HEADER_WORDS 2
+#define LOG_RECORD_MAX_WORDS (LOG_RECORD_HEADER_WORDS + LOG_MAX_ARGS)
+#define LOG_RECORD_MAX_BYTES (LOG_RECORD_MAX_WORDS * sizeof(uint32_t))
+
+#define _log_record(level, msg, ...) do { \
+    if (log_enabled(level, _LOG_SUBSYSTEM)) { \
+        static const char _log_format[] __attribute__((section(".logfmt"))) = msg; \
+        const uint32_t _log_args[] = {0, ##__VA_ARGS__}; \
+        log_record(_log_format, &_log_args[1], sizeof(_log_args) / sizeof(_log_args[0]) - 1); \
+    } \
+} while (0)
+
+#define log_info(msg, ...) _log_record(logging_level_info, msg, ##__VA_ARGS__)
+#define log_trace(msg, ...) _log_record(logging_level_trace, msg, ##__VA_ARGS__)
+
+/* CAN data is logged as two words with the first byte leftmost */
+#define log_CAN_rx_message(log_pfx, can_frame) \
+    log_trace(log_pfx "CAN Rx ID(%i) DLC(%i) %08X%08X\r\n", log_CAN_id(can_frame), (can_frame)->DLC, \
+              __builtin_bswap32((can_frame)->data32[0]), __builtin_bswap32((can_frame)->data32[1]))
+#define log_CAN_tx_message(log_pfx, can_frame) \
+    log_info(log_pfx "CAN Tx ID(%i) DLC(%i) %08X%08X\r\n", log_CAN_id(can_frame), (can_frame)->DLC, \
+             __builtin_bswap32((can_frame)->data32[0]), __builtin_bswap32((can_frame)->data32[1]))
+#define log_CAN_id(can_frame) ((can_frame)->IDE == CAN_IDE_EXT ? (can_frame)->EID : (can_frame)->SID)
 
 void set_logging_level(enum logging_levels level);
 
 enum logging_levels get_logging_level(void);
 
-void log_CAN_rx_message(char* log_pfx, CANRxFrame * can_frame);
+void set_logging_subsystems(uint16_t mask);
+
+uint16_t get_logging_subsystems(void);
+
+void log_record(const char *format, const uint32_t *args, size_t count);
+
+uint32_t get_log_drops(void);
 
-void log_CAN_tx_message(char *log_pfx, CANTxFrame * can_frame);
+void log_worker(void);
 
 #endif /* LOGGING_H_ */
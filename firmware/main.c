@@ -31,50 +31,34 @@
 #include "system_ADC.h"
 #include "system_button.h"
 #include "system_display.h"
+#include "system_scheduler.h"
+#include "system_profiling.h"
 
-#define CAN_THREAD_STACK 512
-#define LED_THREAD_STACK 256
-#define LED_FLASH_THREAD_STACK 256
-#define STARTUP_DEMO_THREAD_STACK 256
-#define MAIN_THREAD_SLEEP_NORMAL_MS 10000
-#define MAIN_THREAD_SLEEP_FINE_MS   1000
-#define MAIN_THREAD_CHECK_INTERVAL_MS 100
+#define LOG_THREAD_STACK 320
+#define CAN_EVENT_THREAD_STACK 128
+#define TICK_INTERVAL_MS 100
+#define STATS_INTERVAL_MS 10000
 #define WATCHDOG_TIMEOUT 11000
 #define WATCHDOG_ENABLED true
 
 /*
- * CAN receiver thread.
+ * Log worker thread; drains the deferred log records in the background.
  */
-static THD_WORKING_AREA(can_rx_wa, CAN_THREAD_STACK);
-static THD_FUNCTION(can_rx, arg)
+static THD_WORKING_AREA(log_work_wa, LOG_THREAD_STACK);
+static THD_FUNCTION(log_work, arg)
 {
     (void)arg;
-    chRegSetThreadName("CAN_worker");
-    can_worker();
+    log_worker();
 }
 
-static THD_WORKING_AREA(led_work_wa, LED_THREAD_STACK);
-static THD_FUNCTION(led_work, arg)
-{
-    (void)arg;
-    chRegSetThreadName("LED_worker");
-    led_worker();
-}
-
-static THD_WORKING_AREA(led_flash_work_wa, LED_FLASH_THREAD_STACK);
-static THD_FUNCTION(led_flash_work, arg)
-{
-    (void)arg;
-    chRegSetThreadName("LED_flas_worker");
-    led_flash_worker();
-}
-
-static THD_WORKING_AREA(startup_demo_work_wa, STARTUP_DEMO_THREAD_STACK);
-static THD_FUNCTION(startup_demo_work, arg)
+/*
+ * CAN event thread; hands the CAN driver's events to the scheduler.
+ */
+static THD_WORKING_AREA(can_events_wa, CAN_EVENT_THREAD_STACK);
+static THD_FUNCTION(can_events, arg)
 {
     (void)arg;
-    chRegSetThreadName("LED_flas_worker");
-    startup_demo_worker();
+    can_relay_events();
 }
 
 static const WDGConfig wdgcfg = {
@@ -93,6 +77,33 @@ static void _start_watchdog(void)
     wdgStart(&WDGD1, &wdgcfg);
 }
 
+/* Scheduler tick: slow housekeeping, including the button check */
+static void _service_tick(void)
+{
+    static uint32_t stats_check = 0;
+    stats_check += TICK_INTERVAL_MS;
+    if (stats_check > STATS_INTERVAL_MS) {
+        broadcast_stats();
+        stats_check = 0;
+    }
+    button_check_broadcast_state();
+    display_update_brightness();
+    led_service_tick();
+    stats_service_tick();
+    can_service_tick();
+    if (WATCHDOG_ENABLED)
+        wdgReset(&WDGD1);
+    check_system_state();
+}
+
+static const scheduler_service_t scheduler_services[SCHEDULER_EVENTS] = {
+    [SCHEDULER_EVENT_CAN_ERROR] = can_service_error,
+    [SCHEDULER_EVENT_CAN_RX] = can_service_rx,
+    [SCHEDULER_EVENT_FLASH] = led_service_flash,
+    [SCHEDULER_EVENT_FRAME] = led_service_frame,
+    [SCHEDULER_EVENT_TICK] = _service_tick
+};
+
 int main(void)
 {
     /*
@@ -106,6 +117,8 @@ int main(void)
     /* ChibiOS initialization */
     halInit();
     chSysInit();
+    profiling_init();
+    scheduler_init();
     _start_watchdog();
 
     /* Application specific initialization */
@@ -114,28 +127,19 @@ int main(void)
     system_serial_init();
     system_display_init();
     api_initialize();
+    led_init();
+
+    thread_t *log_thread = chThdCreateStatic(log_work_wa, sizeof(log_work_wa), LOWPRIO, log_work, NULL);
+    profiling_register_thread(PROFILING_CONTEXT_LOG, log_thread, sizeof(log_work_wa));
+    thread_t *can_thread = chThdCreateStatic(can_events_wa, sizeof(can_events_wa), NORMALPRIO + 1, can_events, NULL);
+    profiling_register_thread(PROFILING_CONTEXT_CAN, can_thread, sizeof(can_events_wa));
 
     /*
-     * Creates the processing threads.
+     * The main thread becomes the scheduler and does all of the work,
+     * woken by CAN, the frame and flash timers and the housekeeping tick;
+     * the flash timer only runs while an LED is flashing or fading.
      */
-    chThdCreateStatic(can_rx_wa, sizeof(can_rx_wa), NORMALPRIO, can_rx, NULL);
-    chThdCreateStatic(led_work_wa, sizeof(led_work_wa), NORMALPRIO, led_work, NULL);
-    chThdCreateStatic(led_flash_work_wa, sizeof(led_flash_work_wa), NORMALPRIO, led_flash_work, NULL);
-    chThdCreateStatic(startup_demo_work_wa, sizeof(startup_demo_work_wa), NORMALPRIO, startup_demo_work, NULL);
-
-    uint32_t stats_check = 0;
-    while (true) {
-        chThdSleepMilliseconds(MAIN_THREAD_CHECK_INTERVAL_MS);
-        stats_check += MAIN_THREAD_CHECK_INTERVAL_MS;
-        if (stats_check > MAIN_THREAD_SLEEP_NORMAL_MS) {
-            broadcast_stats();
-            stats_check = 0;
-        }
-        button_check_broadcast_state();
-        display_update_brightness();
-        if (WATCHDOG_ENABLED)
-            wdgReset(&WDGD1);
-        check_system_state();
-    }
+    scheduler_signal_every(SCHEDULER_EVENT_TICK, MS2ST(TICK_INTERVAL_MS));
+    scheduler_run(scheduler_services);
     return 0;
 }
@@ -34,12 +34,31 @@
 #define SETTINGS_LINEAR_GRAPH_COUNT 7
 #define SETTINGS_LINEAR_GRAPH_OFFSET 0
 
+/* Digits on the 7 segment display. Boards with more than one digit
+ * define SETTINGS_DISPLAY_DIGIT_MAPPING, the {port, pin} select line of
+ * each digit, and optionally SETTINGS_DISPLAY_DIGIT_BRIGHTNESS, each
+ * digit's relative brightness in percent */
+#define SETTINGS_DISPLAY_DIGITS 1
+
 /* how long we wait before resetting the system */
 #define SYSTEM_RESET_DELAY 10
 
-/* The timeout value while we wait
- * for an available CAN transmission slot */
-#define CAN_TRANSMIT_TIMEOUT 100
+/* Drop frames outside of our API window in the bxCAN filters;
+ * disable to have every frame on the bus reach software */
+#define CAN_HARDWARE_FILTERING true
 
 #define NO_ACTIVITY_TIMEOUT 10000
+
+/* APA102 SPI clock = PCLK / 2^(LED_SPI_BR + 1);
+ * 0 = 24MHz, 1 = 12MHz, 2 = 6MHz ... 7 = 187.5KHz */
+#define LED_SPI_BR 2
+
+/* Minimum time between LED frames */
+#define LED_FRAME_INTERVAL_MS 1
+
+/* LEDs are refreshed at least this often even if nothing changed */
+#define LED_KEEPALIVE_INTERVAL_MS 1000
+
+/* Flash pattern timebase; rates up to half the tick rate are representable */
+#define FLASH_TICK_INTERVAL_MS 5
 #endif /* SETTINGS_H_ */
@@ -22,11 +22,16 @@
 
 #include "logging.h"
 #include "system_LED.h"
+#include "system_LED_flash.h"
+#include "system_LED_animation.h"
 #include "system_display.h"
+#include "system_CAN_log.h"
 #include "settings.h"
 #include "ch.h"
 #include "hal.h"
+#include <string.h>
 #define _LOG_PFX "API:         "
+#define _LOG_SUBSYSTEM LOG_SUBSYSTEM_API
 
 static struct AlertThreshold g_alert_threshold[ALERT_COUNT][ALERT_THRESHOLDS];
 static uint16_t g_current_alert_value[ALERT_COUNT];
@@ -35,12 +40,78 @@ static struct LinearGraphConfig g_linear_graph_config;
 static struct LinearGraphThreshold g_linear_graph_threshold[LINEAR_GRAPH_THRESHOLDS];
 
 static uint16_t g_current_linear_graph_value;
-static struct LedFlashConfig g_flash_config[LED_COUNT];
 
 static struct ConfigGroup1 g_config_group_1 = {DEFAULT_BRIGHTNESS, DEFAULT_LIGHT_SENSOR_SCALING, DEFAULT_ORIENTATION};
 
 static bool g_provisioned = false;
 
+/*
+ * Live values received but not yet rendered. Only the newest value per
+ * channel is kept; it is rendered once per LED output frame.
+ */
+static bool g_linear_graph_pending;
+static bool g_alert_pending[ALERT_COUNT];
+static bool g_display_pending;
+static uint8_t g_display_digit;
+static char g_display_value;
+
+static struct ApiRenderStats g_render_stats;
+
+/*
+ * The Cortex-M0 has no hardware divider, so the linear graph is rendered
+ * with fixed point scale factors that are computed once whenever the
+ * range changes. A scale factor is LEDs per unit of value with
+ * LINEAR_GRAPH_FRACTION_BITS fractional bits; since values are railed
+ * to the range, value * scale never exceeds graph size << 28 and fits
+ * in 32 bits for graphs of up to 7 LEDs.
+ */
+#define LINEAR_GRAPH_FRACTION_BITS 28
+#define LINEAR_GRAPH_DIM_BITS 8
+#if LINEAR_GRAPH_COUNT >= 8
+#error "Linear graph fixed point scaling supports at most 7 LEDs"
+#endif
+
+struct LinearGraphScaling {
+    uint32_t range;
+    uint32_t center_value;
+    uint32_t leds_per_value;
+    uint32_t center_leds_per_value;
+};
+static struct LinearGraphScaling g_linear_graph_scaling;
+
+/*
+ * Optional dead reckoning of the linear graph value between updates
+ * from the host. Rates are in value units per system tick with
+ * LINEAR_GRAPH_RATE_BITS fractional bits.
+ */
+#define LINEAR_GRAPH_RATE_BITS 8
+
+/* Updates further apart than this are treated as a stall, not a trend */
+#define LINEAR_GRAPH_PREDICTION_MAX_INTERVAL_MS 200
+
+struct LinearGraphPredictor {
+    bool has_sample;
+    bool extrapolating;
+    uint16_t value;
+    int32_t rate;
+    systime_t sample_time;
+    systime_t interval;
+};
+static struct LinearGraphPredictor g_linear_graph_predictor;
+
+/*
+ * Linear graph thresholds compiled into value breakpoints, sorted by
+ * value. A value selects the threshold of the last breakpoint at or
+ * below it; values below the first breakpoint select no threshold.
+ * Rebuilt whenever a threshold changes.
+ */
+struct LinearGraphBreakpoint {
+    uint16_t value;
+    struct LinearGraphThreshold *threshold;
+};
+static struct LinearGraphBreakpoint g_linear_graph_breakpoints[LINEAR_GRAPH_THRESHOLDS];
+static size_t g_linear_graph_breakpoint_count;
+
 static void _set_led_multi(size_t index, size_t length, uint8_t red, uint8_t green, uint8_t blue, uint8_t flash)
 {
     size_t i;
@@ -72,31 +143,111 @@ static void _update_alert_value(uint8_t alert_id)
     uint8_t disp_led_idx = (get_orientation() == DISPLAY_BOTTOM) ? alert_id : (ALERT_COUNT - alert_id - 1);
     set_led(ALERT_OFFSET + disp_led_idx, red, green, blue);
     set_flash_config(ALERT_OFFSET + disp_led_idx, flash);
+
+    if (animation_alert_value(alert_id, current_value)) {
+        /* the animation bound to this alert ended; redraw what it covered */
+        g_linear_graph_pending = true;
+        for (i = 0; i < ALERT_COUNT; i++) {
+            g_alert_pending[i] = true;
+        }
+        led_request_refresh();
+    }
 }
 
-static struct LinearGraphThreshold * _select_linear_threshold(uint16_t value)
+/* A threshold of 0 disables all but the first threshold */
+static bool _linear_threshold_enabled(size_t index)
+{
+    return g_linear_graph_threshold[index].threshold > 0 || index == 0;
+}
+
+/*
+ * Build the breakpoint table. The highest numbered enabled threshold at
+ * or below a value wins, matching the order thresholds were scanned in
+ * before the table existed.
+ */
+static void _update_linear_graph_breakpoints(void)
 {
+    size_t count = 0;
     size_t i;
-    struct LinearGraphThreshold  * t = NULL;
     for (i = 0; i < LINEAR_GRAPH_THRESHOLDS; i++) {
-        struct LinearGraphThreshold  * ttest = &g_linear_graph_threshold[i];
-        if (value >= ttest->threshold && (ttest->threshold > 0 || i == 0)) {
-            t = ttest;
+        if (!_linear_threshold_enabled(i))
+            continue;
+        uint16_t value = g_linear_graph_threshold[i].threshold;
+
+        /* insertion sort by value; an equal value means a higher index wins */
+        size_t pos = count;
+        while (pos > 0 && g_linear_graph_breakpoints[pos - 1].value > value)
+            pos--;
+        if (pos > 0 && g_linear_graph_breakpoints[pos - 1].value == value) {
+            g_linear_graph_breakpoints[pos - 1].threshold = &g_linear_graph_threshold[i];
+            continue;
         }
+        memmove(&g_linear_graph_breakpoints[pos + 1], &g_linear_graph_breakpoints[pos],
+                (count - pos) * sizeof(g_linear_graph_breakpoints[0]));
+        g_linear_graph_breakpoints[pos].value = value;
+        g_linear_graph_breakpoints[pos].threshold = &g_linear_graph_threshold[i];
+        count++;
     }
-    return t;
+
+    /* a higher numbered threshold overrides lower numbered ones above it */
+    for (i = 1; i < count; i++) {
+        if (g_linear_graph_breakpoints[i].threshold < g_linear_graph_breakpoints[i - 1].threshold)
+            g_linear_graph_breakpoints[i].threshold = g_linear_graph_breakpoints[i - 1].threshold;
+    }
+    g_linear_graph_breakpoint_count = count;
 }
 
-static void _update_linear_graph(uint16_t value, uint16_t range, struct LinearGraphThreshold * threshold, uint8_t graph_size, uint8_t start_offset, enum linear_style lstyle, bool left_right)
+static struct LinearGraphThreshold * _select_linear_threshold(uint16_t value)
+{
+    /* binary search for the last breakpoint at or below the value */
+    size_t low = 0;
+    size_t high = g_linear_graph_breakpoint_count;
+    while (low < high) {
+        size_t mid = (low + high) >> 1;
+        if (g_linear_graph_breakpoints[mid].value <= value) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low > 0 ? g_linear_graph_breakpoints[low - 1].threshold : NULL;
+}
+
+/* Rounded up, so a value at the top of the range lights the full graph */
+static uint32_t _calculate_leds_per_value(uint8_t graph_size, uint32_t range)
+{
+    uint32_t full_scale = (uint32_t)graph_size << LINEAR_GRAPH_FRACTION_BITS;
+    if (range == 0 || range > full_scale)
+        return 0;
+    return (full_scale + range - 1) / range;
+}
+
+/* Recompute the linear graph scale factors; called on configuration changes */
+static void _update_linear_graph_scaling(void)
+{
+    struct LinearGraphScaling *scaling = &g_linear_graph_scaling;
+    uint32_t low_range = g_linear_graph_config.low_range;
+    uint32_t high_range = g_linear_graph_config.high_range;
+
+    scaling->range = high_range - low_range;
+    scaling->center_value = scaling->range >> 1;
+    scaling->leds_per_value = _calculate_leds_per_value(LINEAR_GRAPH_COUNT, scaling->range);
+    scaling->center_leds_per_value = _calculate_leds_per_value((LINEAR_GRAPH_COUNT / 2) + 1, scaling->center_value);
+}
+
+static void _update_linear_graph(uint32_t value, uint32_t range, uint32_t leds_per_value, struct LinearGraphThreshold * threshold, uint8_t graph_size, uint8_t start_offset, enum linear_style lstyle, bool left_right)
 {
     uint8_t graph_length = 0;
+    uint32_t fraction = 0;
 
     if (lstyle == LINEAR_STYLE_STEPPED) {
         graph_length = threshold->segment_length;
     } else {
-        /* percentage of range */
-        uint32_t pct = (value * 100) / range;
-        graph_length = (graph_size * pct) / 100;
+        /* graph position in LEDs, fixed point */
+        uint32_t position = min(value, range) * leds_per_value;
+        graph_length = position >> LINEAR_GRAPH_FRACTION_BITS;
+        fraction = (position >> (LINEAR_GRAPH_FRACTION_BITS - LINEAR_GRAPH_DIM_BITS)) &
+                   ((1 << LINEAR_GRAPH_DIM_BITS) - 1);
     }
 
     /* rail to max number of LEDs, for safety */
@@ -126,11 +277,9 @@ static void _update_linear_graph(uint16_t value, uint16_t range, struct LinearGr
     }
     /* linerally dim the next LED based on the fractional amount */
     if (lstyle == LINEAR_STYLE_SMOOTH && graph_length < graph_size) {
-        uint32_t pct = (value * 100) / range;
-        uint32_t remainder = (graph_size * pct) % 100;
-        red = red * remainder / 100;
-        green = green * remainder / 100;
-        blue = blue * remainder / 100;
+        red = (red * fraction) >> LINEAR_GRAPH_DIM_BITS;
+        green = (green * fraction) >> LINEAR_GRAPH_DIM_BITS;
+        blue = (blue * fraction) >> LINEAR_GRAPH_DIM_BITS;
         led_index = (render_lr) ?
                     start_offset + graph_length :
                     (start_offset + graph_size - 1) - graph_length;
@@ -139,12 +288,13 @@ static void _update_linear_graph(uint16_t value, uint16_t range, struct LinearGr
     }
 }
 
-static void _update_center_graph(uint16_t value, uint16_t range, struct LinearGraphThreshold * threshold, enum linear_style lstyle)
+static void _update_center_graph(uint32_t value, struct LinearGraphThreshold * threshold, enum linear_style lstyle)
 {
     /* assuming odd number of LEDs */
     uint8_t center_led = (LINEAR_GRAPH_COUNT / 2);
     uint8_t graph_count = center_led + 1;
-    uint32_t center_value = range / 2;
+    uint32_t center_value = g_linear_graph_scaling.center_value;
+    uint32_t leds_per_value = g_linear_graph_scaling.center_leds_per_value;
 
     size_t index;
 
@@ -154,24 +304,22 @@ static void _update_center_graph(uint16_t value, uint16_t range, struct LinearGr
             set_led(index, 0, 0, 0);
         }
         uint8_t offset = (get_orientation() == DISPLAY_BOTTOM) ? center_led : 0;
-        _update_linear_graph(value - center_value, range / 2, threshold, graph_count, offset, lstyle, true);
+        _update_linear_graph(value - center_value, center_value, leds_per_value, threshold, graph_count, offset, lstyle, true);
     } else { /* right to left rendering */
         /* turn off LEDs right of center */
         for (index = center_led; index < LINEAR_GRAPH_COUNT; index++) {
             set_led(index, 0, 0, 0);
         }
         uint8_t offset = (get_orientation() == DISPLAY_BOTTOM) ? 0 : center_led;
-        _update_linear_graph(center_value - value, range / 2, threshold, graph_count, offset, lstyle, false);
+        _update_linear_graph(center_value - value, center_value, leds_per_value, threshold, graph_count, offset, lstyle, false);
     }
 }
 
-static void _update_linear_graph_value(void)
+static void _update_linear_graph_value(uint16_t current_value)
 {
     uint32_t low_range = g_linear_graph_config.low_range;
-    uint32_t high_range = g_linear_graph_config.high_range;
-    uint32_t range = high_range - low_range;
+    const struct LinearGraphScaling *scaling = &g_linear_graph_scaling;
 
-    uint16_t current_value = g_current_linear_graph_value;
     uint16_t range_adj_value;
     /* offset to zero */
     if ( current_value < low_range ) {
@@ -191,11 +339,11 @@ static void _update_linear_graph_value(void)
     }
     switch (rstyle) {
     case RENDER_STYLE_CENTER:
-        _update_center_graph(range_adj_value, range, threshold, lstyle);
+        _update_center_graph(range_adj_value, threshold, lstyle);
         break;
     case RENDER_STYLE_LEFT_RIGHT:
     case RENDER_STYLE_RIGHT_LEFT:
-        _update_linear_graph(range_adj_value, range, threshold, LINEAR_GRAPH_COUNT, LINEAR_GRAPH_OFFSET, lstyle, left_right);
+        _update_linear_graph(range_adj_value, scaling->range, scaling->leds_per_value, threshold, LINEAR_GRAPH_COUNT, LINEAR_GRAPH_OFFSET, lstyle, left_right);
         break;
     default:
         log_info(_LOG_PFX "Invalid render style (%i)\r\n", rstyle);
@@ -203,6 +351,94 @@ static void _update_linear_graph_value(void)
     }
 }
 
+/* Record a linear graph sample and estimate its rate of change from the last one */
+static void _update_linear_graph_prediction(uint16_t value)
+{
+    struct LinearGraphPredictor *predictor = &g_linear_graph_predictor;
+    systime_t now = chVTGetSystemTimeX();
+    systime_t interval = now - predictor->sample_time;
+
+    predictor->rate = 0;
+    if (predictor->has_sample && interval > 0 && interval <= MS2ST(LINEAR_GRAPH_PREDICTION_MAX_INTERVAL_MS)) {
+        int32_t change = (int32_t)value - predictor->value;
+        predictor->rate = change * (1 << LINEAR_GRAPH_RATE_BITS) / (int32_t)interval;
+    }
+    predictor->value = value;
+    predictor->sample_time = now;
+    predictor->interval = interval;
+    predictor->has_sample = true;
+    predictor->extrapolating = predictor->rate != 0;
+}
+
+/*
+ * The value the graph should show now. Extrapolates along the last rate
+ * of change for at most one sample interval, so the prediction never
+ * moves further than the last real change did, then holds that endpoint
+ * for the next sample. If updates stall, it settles on the last sample.
+ */
+static uint16_t _predict_linear_graph_value(void)
+{
+    struct LinearGraphPredictor *predictor = &g_linear_graph_predictor;
+    systime_t elapsed = chVTTimeElapsedSinceX(predictor->sample_time);
+    if (elapsed >= MS2ST(LINEAR_GRAPH_PREDICTION_MAX_INTERVAL_MS)) {
+        predictor->extrapolating = false;
+        return predictor->value;
+    }
+    elapsed = min(elapsed, predictor->interval);
+    int32_t value = predictor->value + ((predictor->rate * (int32_t)elapsed) >> LINEAR_GRAPH_RATE_BITS);
+    value = max(0, min(UINT16_MAX, value));
+    return value;
+}
+
+/*
+ * Render the newest value of every channel updated since the last frame.
+ * Returns how soon another render is wanted, for linear graph prediction.
+ */
+systime_t api_render_pending(void)
+{
+    systime_t next_render = TIME_INFINITE;
+    if (g_linear_graph_predictor.extrapolating) {
+        /* redraw every frame until a new sample or a stall ends the prediction */
+        g_linear_graph_pending = false;
+        _update_linear_graph_value(_predict_linear_graph_value());
+        g_render_stats.renders++;
+        if (g_linear_graph_predictor.extrapolating)
+            next_render = MS2ST(LED_FRAME_INTERVAL_MS);
+    } else if (g_linear_graph_pending) {
+        g_linear_graph_pending = false;
+        _update_linear_graph_value(g_current_linear_graph_value);
+        g_render_stats.renders++;
+    }
+
+    for (size_t i = 0; i < ALERT_COUNT; i++) {
+        if (g_alert_pending[i]) {
+            g_alert_pending[i] = false;
+            _update_alert_value(i);
+            g_render_stats.renders++;
+        }
+    }
+
+    if (g_display_pending) {
+        g_display_pending = false;
+        display_set_value(g_display_digit, g_display_value);
+        g_render_stats.renders++;
+    }
+    return next_render;
+}
+
+const struct ApiRenderStats * get_api_render_stats(void)
+{
+    return &g_render_stats;
+}
+
+/* Mark a channel as needing a render; a pending render is superseded */
+static void _set_render_pending(bool *pending)
+{
+    if (*pending)
+        g_render_stats.renders_skipped++;
+    *pending = true;
+}
+
 bool api_is_provisoned(void)
 {
     return g_provisioned;
@@ -216,10 +452,11 @@ void set_api_is_provisioned(bool provisioned)
 void api_initialize(void)
 {
     size_t i;
+    animation_init();
+
     /* Init flash configuration */
     for (i = 0; i < LED_COUNT; i++) {
-        g_flash_config[i].current_state = 0;
-        g_flash_config[i].flash_hz = 0;
+        set_flash_config(i, 0);
     }
 
     /* Init alert configuration */
@@ -244,6 +481,8 @@ void api_initialize(void)
     g_linear_graph_config.linear_style = LINEAR_STYLE_SMOOTH;
     g_linear_graph_config.low_range = 0;
     g_linear_graph_config.high_range = 10000;
+    g_linear_graph_config.prediction = false;
+    _update_linear_graph_scaling();
 
     /* Set default linear graph thresholds */
     g_linear_graph_threshold[0].threshold = 3000;
@@ -265,7 +504,8 @@ void api_initialize(void)
     g_linear_graph_threshold[2].red = 255;
     g_linear_graph_threshold[2].green = 0;
     g_linear_graph_threshold[2].blue = 0;
-    g_linear_graph_threshold[2].flash_hz = 5;
+    g_linear_graph_threshold[2].flash_hz = 3;
+    _update_linear_graph_breakpoints();
 }
 
 static void _set_brightness(uint8_t brightness)
@@ -298,23 +538,14 @@ enum orientation get_orientation(void)
     return g_config_group_1.orientation;
 }
 
-struct LedFlashConfig * get_flash_config(size_t led_index)
-{
-    return &g_flash_config[led_index];
-}
-
 void set_flash_config(size_t led_index, uint8_t flash_hz)
 {
-    g_flash_config[led_index].flash_hz = flash_hz;
+    set_led_flash(led_index, flash_hz);
 }
 
 
 void api_set_config_group_1(CANRxFrame *rx_msg)
 {
-    if (rx_msg->DLC < 1) {
-        log_info(_LOG_PFX "Invalid params for set config group 1\r\n");
-        return;
-    }
     uint32_t brightness = rx_msg->data8[0];
     if (brightness > 0) {
         /**
@@ -347,12 +578,22 @@ void api_set_config_group_1(CANRxFrame *rx_msg)
     }
 }
 
+void api_set_log_config(CANRxFrame *rx_msg)
+{
+    uint8_t level = rx_msg->data8[0];
+    uint16_t subsystems = rx_msg->data8[1] | rx_msg->data8[2] << 8;
+    uint8_t max_frame_rate = rx_msg->data8[3];
+    uint8_t max_bus_share = rx_msg->data8[4];
+
+    set_logging_level(level);
+    set_logging_subsystems(subsystems);
+    can_log_configure(max_frame_rate, max_bus_share);
+    log_info(_LOG_PFX "Set log config : level(%i) subsystems(%x) frame rate(%i) bus share(%i)\r\n",
+             level, subsystems, max_frame_rate, max_bus_share);
+}
+
 void api_set_discrete_led(CANRxFrame *rx_msg)
 {
-    if (rx_msg->DLC < 6) {
-        log_info(_LOG_PFX "Invalid params for set discrete LED\r\n");
-        return;
-    }
     /* data validation on LED index */
     uint8_t index = rx_msg->data8[0];
     index = index < LED_COUNT ? index : LED_COUNT - 1;
@@ -366,17 +607,21 @@ void api_set_discrete_led(CANRxFrame *rx_msg)
     uint8_t green =  rx_msg->data8[3];
     uint8_t blue =  rx_msg->data8[4];
     uint8_t flash = rx_msg->data8[5];
+    /* optional fade time constant */
+    uint16_t fade_ms = rx_msg->DLC > 6 ? rx_msg->data8[6] * DISCRETE_LED_FADE_UNIT_MS : 0;
 
-    log_trace(_LOG_PFX "Set Discrete LED : (%i) length(%i) rgb(%i, %i, %i) flash(%i)\r\n", index, length, red, green, blue, flash);
-    _set_led_multi(index, length, red, green, blue, flash);
+    log_trace(_LOG_PFX "Set Discrete LED : (%i) length(%i) rgb(%i, %i, %i) flash(%i) fade(%i)\r\n", index, length, red, green, blue, flash, fade_ms);
+    /* direct writes must land on top of any value received before them */
+    api_render_pending();
+    size_t i;
+    for (i = 0; i < length; i++) {
+        set_led_fade(index + i, red, green, blue, fade_ms);
+        set_flash_config(index + i, flash);
+    }
 }
 
 void api_set_alert_led(CANRxFrame *rx_msg)
 {
-    if (rx_msg->DLC < 5) {
-        log_info(_LOG_PFX "Invalid param count for set alert LED\r\n");
-        return;
-    }
     /* data validation on LED index */
     uint8_t alert_id = rx_msg->data8[0];
     if (alert_id >= ALERT_COUNT) {
@@ -390,6 +635,8 @@ void api_set_alert_led(CANRxFrame *rx_msg)
     uint8_t flash = rx_msg->data8[4];
 
     log_trace(_LOG_PFX "Set Alert LED (%i) : rgb(%i, %i, %i) flash(%i)\r\n", alert_id, red, green, blue, flash);
+    /* a direct write supersedes a pending alert value */
+    g_alert_pending[alert_id] = false;
     uint8_t disp_led_idx = (get_orientation() == DISPLAY_BOTTOM) ? alert_id : (ALERT_COUNT - alert_id - 1);
     set_led(ALERT_OFFSET + disp_led_idx, red, green, blue);
     set_flash_config(ALERT_OFFSET + disp_led_idx, flash);
@@ -397,11 +644,6 @@ void api_set_alert_led(CANRxFrame *rx_msg)
 
 void api_set_alert_threshold(CANRxFrame *rx_msg)
 {
-    if (rx_msg->DLC < 8) {
-        log_info(_LOG_PFX "Invalid param count for set alert threshold\r\n");
-        return;
-    }
-
     uint8_t alert_id = rx_msg->data8[0];
     if (alert_id >= ALERT_COUNT) {
         log_info(_LOG_PFX "Invalid alert id for set alert threshold\r\n");
@@ -431,11 +673,6 @@ void api_set_alert_threshold(CANRxFrame *rx_msg)
 
 void api_set_current_alert_value(CANRxFrame *rx_msg)
 {
-    if (rx_msg->DLC < 3) {
-        log_info(_LOG_PFX "Invalid param count for set current alert value\r\n");
-        return;
-    }
-
     uint8_t alert_id = rx_msg->data8[0];
     if (alert_id >= ALERT_COUNT) {
         log_info(_LOG_PFX "Invalid alert id for set current alert value\r\n");
@@ -445,16 +682,11 @@ void api_set_current_alert_value(CANRxFrame *rx_msg)
     uint16_t current_value = rx_msg->data8[1] + (rx_msg->data8[2] * 256);
     g_current_alert_value[alert_id] = current_value;
     log_trace(_LOG_PFX "Set current alert value : alert_id(%i) value(%i)\r\n", alert_id, current_value);
-    _update_alert_value(alert_id);
+    _set_render_pending(&g_alert_pending[alert_id]);
 }
 
 void api_config_linear_graph(CANRxFrame *rx_msg)
 {
-    if (rx_msg->DLC < 6) {
-        log_info(_LOG_PFX "Invalid param count for config linear graph\r\n");
-        return;
-    }
-
     uint8_t rstyle = rx_msg->data8[0];
     if (rstyle > RENDER_STYLE_RIGHT_LEFT) {
         log_info(_LOG_PFX "Invalid render style %i specified for config linear graph\r\n", rstyle);
@@ -480,17 +712,19 @@ void api_config_linear_graph(CANRxFrame *rx_msg)
     g_linear_graph_config.linear_style = lstyle;
     g_linear_graph_config.low_range = low_range;
     g_linear_graph_config.high_range = high_range;
+    /* prediction is optional and off unless requested */
+    g_linear_graph_config.prediction = rx_msg->DLC > 6 && rx_msg->data8[6] != 0;
+    if (!g_linear_graph_config.prediction) {
+        g_linear_graph_predictor.has_sample = false;
+        g_linear_graph_predictor.extrapolating = false;
+    }
+    _update_linear_graph_scaling();
 
-    log_trace(_LOG_PFX "Config linear graph : render style(%i) linear style(%i) low range(%i) high range(%i)\r\n", rstyle, lstyle, low_range, high_range);
+    log_trace(_LOG_PFX "Config linear graph : render style(%i) linear style(%i) low range(%i) high range(%i) prediction(%i)\r\n", rstyle, lstyle, low_range, high_range, g_linear_graph_config.prediction);
 }
 
 void api_set_linear_threshold(CANRxFrame *rx_msg)
 {
-    if (rx_msg->DLC < 8) {
-        log_info(_LOG_PFX "Invalid param count for set linear graph threshold\r\n");
-        return;
-    }
-
     uint8_t threshold_id = rx_msg->data8[0];
     if (threshold_id >= LINEAR_GRAPH_THRESHOLDS) {
         log_info(_LOG_PFX "Invalid threshold id for set linear graph threshold\r\n");
@@ -516,20 +750,18 @@ void api_set_linear_threshold(CANRxFrame *rx_msg)
     t->green = green;
     t->blue = blue;
     t->flash_hz = flash;
+    _update_linear_graph_breakpoints();
     log_trace(_LOG_PFX "Set Linear Graph Threshold : threshold_id(%i) threshold(%i) rgb(%i, %i, %i) flash(%i)\r\n",
               threshold_id, threshold, red, green, blue, flash);
 }
 
 void api_set_current_linear_graph_value(CANRxFrame *rx_msg)
 {
-    if (rx_msg->DLC < 2) {
-        log_info(_LOG_PFX "Invalid param count for set current linear graph value\r\n");
-        return;
-    }
-
     uint16_t current_value = rx_msg->data16[0];
     g_current_linear_graph_value = current_value;
-    _update_linear_graph_value();
+    if (g_linear_graph_config.prediction)
+        _update_linear_graph_prediction(current_value);
+    _set_render_pending(&g_linear_graph_pending);
 }
 
 void api_send_announcement(void)
@@ -543,32 +775,105 @@ void api_send_announcement(void)
     announce.data8[4] = MINOR_VER;
     announce.data8[5] = PATCH_VER;
     announce.DLC = 6;
-    canTransmit(&CAND1, CAN_ANY_MAILBOX, &announce, MS2ST(CAN_TRANSMIT_TIMEOUT));
+    can_transmit(&announce);
     log_info(_LOG_PFX "Broadcast announcement\r\n");
 }
 
 void api_set_display_value(CANRxFrame *rx_msg)
 {
-    if (rx_msg->DLC < 2) {
-        log_info(_LOG_PFX "Invalid param count for set display value\r\n");
-        return;
-    }
     uint8_t digit = rx_msg->data8[0];
     char value = (char)rx_msg->data8[1];
-    display_set_value(digit, value);
+    /* only the newest value of a single digit is held back */
+    if (g_display_pending && digit != g_display_digit)
+        api_render_pending();
+    g_display_digit = digit;
+    g_display_value = value;
+    _set_render_pending(&g_display_pending);
 }
 
 void api_set_display_segment(CANRxFrame *rx_msg)
 {
-    if (rx_msg->DLC < 8) {
-        log_info(_LOG_PFX "Invalid param count for set display segment\r\n");
-        return;
-    }
     uint8_t digit = rx_msg->data8[0];
+    /* direct writes must land on top of any value received before them */
+    api_render_pending();
 
+    /* segment A in bit 6 through segment G in bit 0 */
+    uint8_t segments = 0;
     for (size_t i = 1; i < 8; i++) {
-        uint8_t segment = rx_msg->data8[i];
-        bool enabled = segment != 0;
-        display_set_segment(digit, i - 1, enabled);
+        segments = segments << 1;
+        if (rx_msg->data8[i] != 0)
+            segments |= 1;
+    }
+    log_trace(_LOG_PFX "Set display segments : digit(%i) segments(%x)\r\n", digit, segments);
+    display_set_segments(digit, segments);
+}
+
+void api_config_animation(CANRxFrame *rx_msg)
+{
+    uint8_t animation_id = rx_msg->data8[0];
+    uint8_t step_count = rx_msg->data8[1];
+    uint8_t loop_step = rx_msg->data8[2];
+    uint8_t repeat = rx_msg->data8[3];
+    int8_t shift = (int8_t)rx_msg->data8[4];
+    uint8_t next = rx_msg->data8[5];
+
+    if (!animation_configure(animation_id, step_count, loop_step, repeat, shift, next)) {
+        log_info(_LOG_PFX "Invalid config animation : animation_id(%i) steps(%i) loop step(%i) next(%i)\r\n",
+                 animation_id, step_count, loop_step, next);
+        return;
+    }
+    log_trace(_LOG_PFX "Config animation : animation_id(%i) steps(%i) loop step(%i) repeat(%i) shift(%i) next(%i)\r\n",
+              animation_id, step_count, loop_step, repeat, shift, next);
+}
+
+void api_set_animation_step(CANRxFrame *rx_msg)
+{
+    uint8_t animation_id = rx_msg->data8[0];
+    uint8_t step_index = rx_msg->data8[1];
+    struct AnimationStep step;
+    step.led_index = (int8_t)rx_msg->data8[2];
+    step.led_count = rx_msg->data8[3];
+    step.red = rx_msg->data8[4];
+    step.green = rx_msg->data8[5];
+    step.blue = rx_msg->data8[6];
+    step.hold = rx_msg->data8[7];
+
+    if (!animation_set_step(animation_id, step_index, &step)) {
+        log_info(_LOG_PFX "Invalid animation step : animation_id(%i) step(%i)\r\n", animation_id, step_index);
+        return;
+    }
+    log_trace(_LOG_PFX "Set animation step : animation_id(%i) step(%i) led(%i) length(%i) rgb(%i, %i, %i) hold(%i)\r\n",
+              animation_id, step_index, step.led_index, step.led_count, step.red, step.green, step.blue, step.hold);
+}
+
+void api_play_animation(CANRxFrame *rx_msg)
+{
+    uint8_t animation_id = rx_msg->data8[0];
+    /* animations draw on top of anything received before them */
+    api_render_pending();
+
+    if (animation_id == ANIMATION_NONE) {
+        animation_stop();
+        log_trace(_LOG_PFX "Stop animation\r\n");
+        return;
+    }
+    if (!animation_play(animation_id)) {
+        log_info(_LOG_PFX "Invalid animation id %i for play animation\r\n", animation_id);
+        return;
+    }
+    log_trace(_LOG_PFX "Play animation : animation_id(%i)\r\n", animation_id);
+}
+
+void api_set_animation_trigger(CANRxFrame *rx_msg)
+{
+    uint8_t animation_id = rx_msg->data8[0];
+    uint8_t alert_id = rx_msg->data8[1];
+    uint16_t threshold = rx_msg->data16[1];
+
+    if (!animation_set_trigger(animation_id, alert_id, threshold)) {
+        log_info(_LOG_PFX "Invalid animation trigger : animation_id(%i) alert_id(%i)\r\n", animation_id, alert_id);
+        return;
     }
+    log_trace(_LOG_PFX "Set animation trigger : animation_id(%i) alert_id(%i) threshold(%i)\r\n",
+              animation_id, alert_id, threshold);
 }
@@ -58,16 +58,12 @@ enum orientation {
 #define DEFAULT_LINEAR_GRAPH_COLOR_BLUE  0
 #define DEFAULT_LINEAR_GRAPH_FLASH  0
 
-struct LedFlashConfig {
-    uint8_t current_state;
-    uint8_t flash_hz;
-};
-
 struct LinearGraphConfig {
     enum render_style render_style;
     enum linear_style linear_style;
     uint16_t low_range;
     uint16_t high_range;
+    bool prediction;
 };
 
 struct LinearGraphThreshold {
@@ -84,6 +80,12 @@ struct LinearGraphThreshold {
 #define DISPLAY_ORIENTATIONS            2
 #define DEFAULT_ORIENTATION             DISPLAY_BOTTOM
 
+/* Live value render counters */
+struct ApiRenderStats {
+    uint32_t renders;
+    uint32_t renders_skipped;
+};
+
 struct ConfigGroup1 {
     uint8_t brightness;
     uint8_t light_sensor_scaling;
@@ -99,10 +101,15 @@ struct ConfigGroup1 {
 #define API_RESET_DEVICE                    1
 #define API_STATS                           2
 #define API_SET_CONFIG_GROUP_1              3
+#define API_STATS_EXTENDED                  4
+#define API_STATS_PROFILING                 5
+#define API_LOG_RECORD                      6
+#define API_SET_LOG_CONFIG                  7
 
 /* Configuration and Runtime */
 /* Direct control messages */
 #define API_SET_DISCRETE_LED                10
+#define DISCRETE_LED_FADE_UNIT_MS           10
 
 /* Alert configuration and control messages */
 #define API_SET_ALERT_LED                   20
@@ -119,21 +126,60 @@ struct ConfigGroup1 {
 #define API_SET_DISPLAY_VALUE               50
 #define API_SET_DISPLAY_SEGMENT             51
 
+/* Animation upload and playback messages */
+#define API_CONFIG_ANIMATION                70
+#define API_SET_ANIMATION_STEP              71
+#define API_PLAY_ANIMATION                  72
+#define API_SET_ANIMATION_TRIGGER           73
+
+/* Extended statistics IDs */
+#define STATS_CAN_RX_FRAMES                 0
+#define STATS_CAN_RX_REJECTED               1
+#define STATS_CAN_RX_FIFO0_OVERRUNS         2
+#define STATS_CAN_RX_FIFO1_OVERRUNS         3
+#define STATS_CAN_RX_QUEUE_HIGH_WATER       4
+#define STATS_CAN_RX_QUEUE_DROPS            5
+#define STATS_RENDERS                       6
+#define STATS_RENDERS_SKIPPED               7
+#define STATS_LED_FRAMES_SENT               8
+#define STATS_LED_FRAMES_BUSY               9
+#define STATS_LED_FRAME_TIME_US             10
+#define STATS_LED_FRAMES_SKIPPED            11
+/* One statistic per scheduler event, offset by the event id */
+#define STATS_SCHEDULER_LATENCY_US          12
+#define STATS_SCHEDULER_SERVICE_US          17
+#define STATS_LOG_DROPS                     22
+#define STATS_LOG_CAN_FRAMES_SENT           23
+#define STATS_LOG_CAN_FRAMES_FAILED         24
+#define STATS_CAN_TX_QUEUE_DROPS            25
+#define STATS_LOG_CAN_RECORDS_DROPPED       26
+#define STATS_EXTENDED_COUNT                27
+
+/* Profiling statistics IDs, sent by builds with profiling enabled */
+#define PROFILING_STACK_SIZE                0
+#define PROFILING_STACK_USED                1
+#define PROFILING_RUN_TIME_US               2
+#define PROFILING_CPU_LOAD                  3
+#define PROFILING_IRQ_COUNT                 4
+
 uint8_t get_brightness(void);
 
 uint8_t get_light_sensor_scaling(void);
 
 enum orientation get_orientation(void);
 
-struct LedFlashConfig * get_flash_config(size_t index);
 void set_flash_config(size_t led_index, uint8_t flash_hz);
 
 
+/* API message handlers; the dispatcher validates the minimum DLC
+ * of each message before calling its handler */
+
 /* Base API functions */
 bool api_is_provisoned(void);
 void set_api_is_provisioned(bool);
 void api_initialize(void);
 void api_set_config_group_1(CANRxFrame *rx_msg);
+void api_set_log_config(CANRxFrame *rx_msg);
 void api_set_discrete_led(CANRxFrame *rx_msg);
 
 /* Alert related functions */
@@ -150,6 +196,16 @@ void api_set_current_linear_graph_value(CANRxFrame *rx_msg);
 void api_set_display_value(CANRxFrame *rx_msg);
 void api_set_display_segment(CANRxFrame *rx_msg);
 
+/* Animation related functions */
+void api_config_animation(CANRxFrame *rx_msg);
+void api_set_animation_step(CANRxFrame *rx_msg);
+void api_play_animation(CANRxFrame *rx_msg);
+void api_set_animation_trigger(CANRxFrame *rx_msg);
+
 void api_send_announcement(void);
 
+/* Live value rendering; called once per LED output frame */
+systime_t api_render_pending(void);
+const struct ApiRenderStats * get_api_render_stats(void);
+
 #endif /* SHIFTX3_API_H_ */
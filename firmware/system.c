@@ -26,8 +26,15 @@
 #include "logging.h"
 #include "shiftx3_api.h"
 #include "system_CAN.h"
+#include "system_CAN_queue.h"
+#include "system_CAN_log.h"
+#include "system_SPI.h"
+#include "system_LED.h"
+#include "system_scheduler.h"
+#include "system_profiling.h"
 
 #define _LOG_PFX "SYS:         "
+#define _LOG_SUBSYSTEM LOG_SUBSYSTEM_SYS
 
 /* Flag to indicate if system is initialized
  * and ready for normal operation */
@@ -45,8 +52,45 @@ bool get_system_initialized(void)
 }
 
 
-/* Broadcast some current stats */
-void broadcast_stats(void)
+/* Frames of one statistics broadcast: the version message, each
+ * extended statistic, then the profiling statistics */
+#define STATS_FRAME_VERSION     0
+#define STATS_FRAME_EXTENDED    1
+#define STATS_FRAME_PROFILING   (STATS_FRAME_EXTENDED + STATS_EXTENDED_COUNT)
+#if SHIFTX3_PROFILING == TRUE
+#define STATS_FRAMES_PROFILING  (PROFILING_CONTEXTS * 2 + PROFILING_THREADS + 1 + PROFILING_IRQS)
+#else
+#define STATS_FRAMES_PROFILING  0
+#endif
+#define STATS_FRAMES            (STATS_FRAME_PROFILING + STATS_FRAMES_PROFILING)
+
+/* Stats frames left queued at the end of a tick; fewer than the 3
+ * transmit mailboxes, so once they go out on the next tick there is a
+ * mailbox free for an announcement or button state */
+#define STATS_TX_QUEUE_MAX      2
+
+/* Next frame of the broadcast in progress; STATS_FRAMES when idle */
+static size_t g_stats_frame = STATS_FRAMES;
+
+#if SHIFTX3_PROFILING == TRUE
+static const struct ProfilingStats *g_profiling;
+#endif
+
+/* Queue a single statistic of a statistics group */
+static void _queue_stat(uint32_t api_id, uint8_t stat_id, uint8_t instance, uint32_t value)
+{
+    CANTxFrame can_stat;
+    prepare_can_tx_message(&can_stat, CAN_IDE_EXT, get_can_base_id() + api_id);
+    can_stat.data8[0] = stat_id;
+    can_stat.data8[1] = instance;
+    can_stat.data8[2] = 0;
+    can_stat.data8[3] = 0;
+    can_stat.data32[1] = value;
+    can_stat.DLC = 8;
+    can_transmit(&can_stat);
+}
+
+static void _queue_version(void)
 {
     CANTxFrame can_stats;
     prepare_can_tx_message(&can_stats, CAN_IDE_EXT, get_can_base_id() + API_STATS);
@@ -56,8 +100,128 @@ void broadcast_stats(void)
     can_stats.data8[1] = MINOR_VER;
     can_stats.data8[2] = PATCH_VER;
     can_stats.DLC = 3;
-    canTransmit(&CAND1, CAN_ANY_MAILBOX, &can_stats, MS2ST(CAN_TRANSMIT_TIMEOUT));
-    log_info(_LOG_PFX "Broadcast stats\r\n");
+    can_transmit(&can_stats);
+}
+
+static uint32_t _ticks_to_us(systime_t ticks)
+{
+    return ticks * (1000000 / CH_CFG_ST_FREQUENCY);
+}
+
+/* Current value of an extended statistic */
+static uint32_t _extended_stat_value(uint8_t stat_id)
+{
+    if (stat_id >= STATS_SCHEDULER_LATENCY_US &&
+        stat_id < STATS_SCHEDULER_LATENCY_US + SCHEDULER_EVENTS)
+        return _ticks_to_us(get_scheduler_stats(stat_id - STATS_SCHEDULER_LATENCY_US)->max_latency);
+
+    if (stat_id >= STATS_SCHEDULER_SERVICE_US &&
+        stat_id < STATS_SCHEDULER_SERVICE_US + SCHEDULER_EVENTS)
+        return _ticks_to_us(get_scheduler_stats(stat_id - STATS_SCHEDULER_SERVICE_US)->max_service);
+
+    switch (stat_id) {
+        case STATS_CAN_RX_FRAMES:
+            return get_can_stats()->rx_frames;
+        case STATS_CAN_RX_REJECTED:
+            return get_can_stats()->rx_rejected;
+        case STATS_CAN_RX_FIFO0_OVERRUNS:
+            return get_can_stats()->rx_fifo0_overruns;
+        case STATS_CAN_RX_FIFO1_OVERRUNS:
+            return get_can_stats()->rx_fifo1_overruns;
+        case STATS_CAN_RX_QUEUE_HIGH_WATER:
+            return get_can_rx_queue_stats()->high_water;
+        case STATS_CAN_RX_QUEUE_DROPS:
+            return get_can_rx_queue_stats()->drops;
+        case STATS_RENDERS:
+            return get_api_render_stats()->renders;
+        case STATS_RENDERS_SKIPPED:
+            return get_api_render_stats()->renders_skipped;
+        case STATS_LED_FRAMES_SENT:
+            return get_spi_stats()->frames_sent;
+        case STATS_LED_FRAMES_BUSY:
+            return get_spi_stats()->frames_busy;
+        case STATS_LED_FRAME_TIME_US:
+            return spi_get_frame_time_us();
+        case STATS_LED_FRAMES_SKIPPED:
+            return get_led_stats()->frames_skipped;
+        case STATS_LOG_DROPS:
+            return get_log_drops();
+        case STATS_LOG_CAN_FRAMES_SENT:
+            return get_can_log_stats()->frames_sent;
+        case STATS_LOG_CAN_FRAMES_FAILED:
+            return get_can_log_stats()->frames_failed;
+        case STATS_CAN_TX_QUEUE_DROPS:
+            return get_can_tx_queue_stats()->drops;
+        case STATS_LOG_CAN_RECORDS_DROPPED:
+            return get_can_log_stats()->records_dropped;
+        default:
+            return 0;
+    }
+}
+
+#if SHIFTX3_PROFILING == TRUE
+/* Queue one stack, run time, CPU load or interrupt statistic */
+static void _queue_profiling_stat(size_t index)
+{
+    if (index < PROFILING_CONTEXTS) {
+        _queue_stat(API_STATS_PROFILING, PROFILING_STACK_SIZE, index, g_profiling->stacks[index].size);
+        return;
+    }
+    index -= PROFILING_CONTEXTS;
+    if (index < PROFILING_CONTEXTS) {
+        _queue_stat(API_STATS_PROFILING, PROFILING_STACK_USED, index, g_profiling->stacks[index].used);
+        return;
+    }
+    index -= PROFILING_CONTEXTS;
+    if (index < PROFILING_THREADS) {
+        _queue_stat(API_STATS_PROFILING, PROFILING_RUN_TIME_US, index, g_profiling->run_time_us[index]);
+        return;
+    }
+    index -= PROFILING_THREADS;
+    if (index == 0) {
+        _queue_stat(API_STATS_PROFILING, PROFILING_CPU_LOAD, 0, g_profiling->cpu_load);
+        return;
+    }
+    index -= 1;
+    _queue_stat(API_STATS_PROFILING, PROFILING_IRQ_COUNT, index, g_profiling->irqs[index]);
+}
+#endif
+
+static void _queue_stats_frame(size_t frame)
+{
+    if (frame == STATS_FRAME_VERSION) {
+        _queue_version();
+    } else if (frame < STATS_FRAME_PROFILING) {
+        uint8_t stat_id = frame - STATS_FRAME_EXTENDED;
+        _queue_stat(API_STATS_EXTENDED, stat_id, 0, _extended_stat_value(stat_id));
+    }
+#if SHIFTX3_PROFILING == TRUE
+    else {
+        _queue_profiling_stat(frame - STATS_FRAME_PROFILING);
+    }
+#endif
+}
+
+/* Start broadcasting the current stats; the frames go out from stats_service_tick() */
+void broadcast_stats(void)
+{
+#if SHIFTX3_PROFILING == TRUE
+    g_profiling = profiling_sample();
+#endif
+    g_stats_frame = STATS_FRAME_VERSION;
+}
+
+/* Scheduler tick: send stats frames to the free transmit mailboxes, queueing a few more */
+void stats_service_tick(void)
+{
+    if (g_stats_frame >= STATS_FRAMES)
+        return;
+
+    while (g_stats_frame < STATS_FRAMES && can_tx_queue_space() > CAN_TX_QUEUE_SIZE - STATS_TX_QUEUE_MAX) {
+        _queue_stats_frame(g_stats_frame++);
+    }
+    if (g_stats_frame == STATS_FRAMES)
+        log_info(_LOG_PFX "Broadcast stats\r\n");
 }
 
 /* perform a soft reset of this processor */
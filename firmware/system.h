@@ -31,6 +31,7 @@ void set_system_initialized(bool initialized);
 bool get_system_initialized(void);
 
 void broadcast_stats(void);
+void stats_service_tick(void);
 
 void check_system_state(void);
 
@@ -21,22 +21,52 @@
 
 #include "system_ADC.h"
 #include "logging.h"
+#include "system_profiling.h"
 #define _LOG_PFX "ADC:         "
+#define _LOG_SUBSYSTEM LOG_SUBSYSTEM_ADC
 
 #define ADC_GRP1_NUM_CHANNELS   1
-#define ADC_GRP1_BUF_DEPTH      1
+/* Samples per callback; the circular buffer holds two halves */
+#define ADC_OVERSAMPLING        8
+#define ADC_GRP1_BUF_DEPTH      (ADC_OVERSAMPLING * 2)
 #define SAMPLE_BUFFER_SIZE ADC_GRP1_NUM_CHANNELS * ADC_GRP1_BUF_DEPTH
+
+/* Conversions are triggered by the display PWM timer's update event */
+#define ADC_TRIGGER_TIM3_TRGO   3
+
+/* Exponential filter; each block of samples moves the level 1/2^n of the way */
+#define AMBIENT_FILTER_SHIFT    5
+
 static adcsample_t samples1[SAMPLE_BUFFER_SIZE];
+
+/*
+ * Filtered light sensor reading, as the sum of ADC_OVERSAMPLING samples
+ * with AMBIENT_FILTER_SHIFT fractional bits. Written only by the ADC
+ * callback; the published level is a single aligned 32 bit word, so
+ * readers need no lock.
+ */
+static uint32_t g_ambient_filter;
+static bool g_ambient_filter_seeded;
+static volatile uint32_t g_ambient_light;
+
 /*
- * ADC streaming callback.
+ * ADC streaming callback; called for each half of the circular buffer.
  */
 static void adccallback(ADCDriver *adcp, adcsample_t *buffer, size_t n)
 {
     (void)adcp;
-    (void)buffer;
-    (void)n;
-    samples1[0] = buffer[0];
-    //log_info(_LOG_PFX " ADC %i\r\n", samples1[0]);
+    profiling_count_irq(PROFILING_IRQ_ADC);
+    uint32_t sum = 0;
+    size_t i;
+    for (i = 0; i < n; i++) {
+        sum += buffer[i];
+    }
+    if (!g_ambient_filter_seeded) {
+        g_ambient_filter = sum << AMBIENT_FILTER_SHIFT;
+        g_ambient_filter_seeded = true;
+    }
+    g_ambient_filter += sum - (g_ambient_filter >> AMBIENT_FILTER_SHIFT);
+    g_ambient_light = g_ambient_filter >> AMBIENT_FILTER_SHIFT;
 }
 
 static void adcerrorcallback(ADCDriver *adcp, adcerror_t err)
@@ -48,17 +78,18 @@ static void adcerrorcallback(ADCDriver *adcp, adcerror_t err)
 
 /*
  * ADC conversion group.
- * Mode:        Continuous, 16 samples of 8 channels, SW triggered.
- * Channels:    IN10, IN11, Sensor, VRef.
+ * Mode:        Circular, one sample of IN1 per TIM3 update event.
+ * Channels:    IN1 (light sensor).
  */
 static const ADCConversionGroup adcgrpcfg1 = {
-    FALSE,
+    TRUE,
     ADC_GRP1_NUM_CHANNELS,
     adccallback,
     adcerrorcallback,
-    ADC_CFGR1_RES_12BIT,             /* CFGR1 */
+    ADC_CFGR1_RES_12BIT |                             /* CFGR1 */
+    ADC_CFGR1_EXTEN_RISING | ADC_CFGR1_EXTSEL_SRC(ADC_TRIGGER_TIM3_TRGO),
     ADC_TR(0, 0),                                     /* TR */
-    ADC_SMPR_SMP_28P5,                                /* SMPR */
+    ADC_SMPR_SMP_239P5,                               /* SMPR */
     ADC_CHSELR_CHSEL1
 };
 
@@ -74,13 +105,13 @@ void system_adc_init(void)
     palSetGroupMode(GPIOA, PAL_PORT_BIT(1), 0, PAL_MODE_INPUT_ANALOG);
     adcStart(&ADCD1, NULL);
     //  adcSTM32SetCCR(ADC_CCR_VBATEN | ADC_CCR_TSEN | ADC_CCR_VREFEN);
-    /* start continuous conversion */
+    /* start continuous conversion; samples flow once the trigger timer runs */
+    adcStartConversion(&ADCD1, &adcgrpcfg1, samples1, ADC_GRP1_BUF_DEPTH);
     log_info("adc init\r\n");
 }
 
-uint16_t system_adc_sample(void)
+/* The filtered ambient light level, on the 0 - 4095 scale of a single sample */
+uint16_t system_adc_ambient_light(void)
 {
-    adcStartConversion(&ADCD1, &adcgrpcfg1, samples1, ADC_GRP1_BUF_DEPTH);
-    return samples1[0];
+    return g_ambient_light / ADC_OVERSAMPLING;
 }
-
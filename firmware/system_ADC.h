@@ -26,6 +26,6 @@
 #include "hal.h"
 
 void system_adc_init(void);
-uint16_t system_adc_sample(void);
+uint16_t system_adc_ambient_light(void);
 
 #endif /* ADC_H_ */
@@ -20,19 +20,119 @@
  */
 
 #include "system_CAN.h"
+#include "system_CAN_filter.h"
+#include "system_CAN_queue.h"
 #include "logging.h"
 #include "system_serial.h"
 #include "settings.h"
 #include "shiftx3_api.h"
 #include "system.h"
+#include "system_LED.h"
+#include "system_scheduler.h"
 #include "stm32f042x6.h"
 
 #define _LOG_PFX "SYS_CAN:     "
+#define _LOG_SUBSYSTEM LOG_SUBSYSTEM_SYS_CAN
 
-#define CAN_WORKER_STARTUP_DELAY 500
+/* Announce ourselves shortly after startup, then periodically until provisioned */
+#define CAN_ANNOUNCEMENT_DELAY_MS 500
+#define CAN_ANNOUNCEMENT_INTERVAL_MS 1000
+
+/* Live value updates are routed to FIFO0 and drained first,
+ * so a burst of configuration traffic cannot starve them */
+#define CAN_FIFO_VALUE 0
+#define CAN_FIFO_CONFIG 1
+#define CAN_FIFO_MAILBOX(fifo) ((fifo) + 1)
+#define CAN_FIFO_DEPTH 3
+
+/* Queued frames handed over at a time; the bxCAN has 3 transmit mailboxes */
+#define CAN_TX_MAILBOXES 3
+
+/* Filter banks we are willing to program; this is built on
+ * the main thread's stack so keep it modest */
+#define CAN_FILTER_MAX_BANKS 8
 #define ADR1_ADDRESS_PORT 0
 #define ADR2_BAUD_PORT 4
 static uint32_t g_can_base_address = SHIFTX3_CAN_BASE_ID;
+static struct CanStats g_can_stats;
+
+/* The driver's events, relayed to the scheduler by the event thread */
+static event_listener_t g_rx_listener;
+static event_listener_t g_error_listener;
+
+static systime_t g_last_message;
+static systime_t g_last_announcement;
+static uint32_t g_announcements;
+
+/* An API message handler and the validation applied before calling it */
+struct ApiHandler {
+    void (*handler)(CANRxFrame *rx_msg);
+    uint8_t min_dlc;
+    /* configuration messages mark the device as provisioned */
+    bool config;
+};
+
+enum api_handler_id {
+    API_HANDLER_NONE = 0,
+    API_HANDLER_CONFIG_GROUP_1,
+    API_HANDLER_LOG_CONFIG,
+    API_HANDLER_DISCRETE_LED,
+    API_HANDLER_ALERT_LED,
+    API_HANDLER_ALERT_THRESHOLD,
+    API_HANDLER_CURRENT_ALERT_VALUE,
+    API_HANDLER_CONFIG_LINEAR_GRAPH,
+    API_HANDLER_LINEAR_THRESHOLD,
+    API_HANDLER_CURRENT_LINEAR_GRAPH_VALUE,
+    API_HANDLER_DISPLAY_VALUE,
+    API_HANDLER_DISPLAY_SEGMENT,
+    API_HANDLER_CONFIG_ANIMATION,
+    API_HANDLER_ANIMATION_STEP,
+    API_HANDLER_PLAY_ANIMATION,
+    API_HANDLER_ANIMATION_TRIGGER,
+    API_HANDLER_COUNT
+};
+
+static const struct ApiHandler api_handlers[API_HANDLER_COUNT] = {
+    [API_HANDLER_NONE]                       = {NULL, 0, false},
+    [API_HANDLER_CONFIG_GROUP_1]             = {api_set_config_group_1, 1, true},
+    [API_HANDLER_LOG_CONFIG]                 = {api_set_log_config, 5, true},
+    [API_HANDLER_DISCRETE_LED]               = {api_set_discrete_led, 6, false},
+    [API_HANDLER_ALERT_LED]                  = {api_set_alert_led, 5, false},
+    [API_HANDLER_ALERT_THRESHOLD]            = {api_set_alert_threshold, 8, true},
+    [API_HANDLER_CURRENT_ALERT_VALUE]        = {api_set_current_alert_value, 3, false},
+    [API_HANDLER_CONFIG_LINEAR_GRAPH]        = {api_config_linear_graph, 6, true},
+    [API_HANDLER_LINEAR_THRESHOLD]           = {api_set_linear_threshold, 8, true},
+    [API_HANDLER_CURRENT_LINEAR_GRAPH_VALUE] = {api_set_current_linear_graph_value, 2, false},
+    [API_HANDLER_DISPLAY_VALUE]              = {api_set_display_value, 2, false},
+    [API_HANDLER_DISPLAY_SEGMENT]            = {api_set_display_segment, 8, false},
+    [API_HANDLER_CONFIG_ANIMATION]           = {api_config_animation, 6, true},
+    [API_HANDLER_ANIMATION_STEP]             = {api_set_animation_step, 8, true},
+    [API_HANDLER_PLAY_ANIMATION]             = {api_play_animation, 1, false},
+    [API_HANDLER_ANIMATION_TRIGGER]          = {api_set_animation_trigger, 4, true},
+};
+
+/*
+ * Maps every offset in the API window to its handler; unlisted
+ * offsets map to API_HANDLER_NONE. One byte per offset keeps the
+ * table small in flash compared to a table of handler structs.
+ */
+static const uint8_t api_handler_index[SHIFTX3_CAN_API_RANGE] = {
+    [API_SET_CONFIG_GROUP_1]             = API_HANDLER_CONFIG_GROUP_1,
+    [API_SET_LOG_CONFIG]                 = API_HANDLER_LOG_CONFIG,
+    [API_SET_DISCRETE_LED]               = API_HANDLER_DISCRETE_LED,
+    [API_SET_ALERT_LED]                  = API_HANDLER_ALERT_LED,
+    [API_SET_ALERT_THRESHOLD]            = API_HANDLER_ALERT_THRESHOLD,
+    [API_SET_CURRENT_ALERT_VALUE]        = API_HANDLER_CURRENT_ALERT_VALUE,
+    [API_CONFIG_LINEAR_GRAPH]            = API_HANDLER_CONFIG_LINEAR_GRAPH,
+    [API_SET_LINEAR_THRESHOLD]           = API_HANDLER_LINEAR_THRESHOLD,
+    [API_SET_CURRENT_LINEAR_GRAPH_VALUE] = API_HANDLER_CURRENT_LINEAR_GRAPH_VALUE,
+    [API_SET_DISPLAY_VALUE]              = API_HANDLER_DISPLAY_VALUE,
+    [API_SET_DISPLAY_SEGMENT]            = API_HANDLER_DISPLAY_SEGMENT,
+    [API_CONFIG_ANIMATION]               = API_HANDLER_CONFIG_ANIMATION,
+    [API_SET_ANIMATION_STEP]             = API_HANDLER_ANIMATION_STEP,
+    [API_PLAY_ANIMATION]                 = API_HANDLER_PLAY_ANIMATION,
+    [API_SET_ANIMATION_TRIGGER]          = API_HANDLER_ANIMATION_TRIGGER,
+};
 
 /*
  * 500K baud; 36MHz clock
@@ -56,6 +156,51 @@ static const CANConfig * _select_can_configuration(void)
 {
     return palReadPad(GPIOA, ADR2_BAUD_PORT) == PAL_HIGH ? &cancfg_500K : &cancfg_1MB;
 }
+
+/* Bus speed selected by the baud jumper, in bits per second */
+uint32_t get_can_bitrate(void)
+{
+    return _select_can_configuration() == &cancfg_500K ? 500000 : 1000000;
+}
+
+/*
+ * Program the hardware acceptance filters so traffic outside of
+ * our API window is dropped before it reaches the RX FIFO.
+ * Must be called while the CAN driver is stopped.
+ */
+static void init_can_filters(void)
+{
+    if (!CAN_HARDWARE_FILTERING)
+        return;
+
+    /* one spec per live value handler, plus the API window */
+    struct CanFilterSpec filter_specs[API_HANDLER_COUNT];
+    size_t spec_count = 0;
+
+    /* Live value messages get an exact filter into the value FIFO */
+    for (size_t offset = 0; offset < SHIFTX3_CAN_API_RANGE; offset++) {
+        const struct ApiHandler *api = &api_handlers[api_handler_index[offset]];
+        if (!api->handler || api->config || spec_count >= API_HANDLER_COUNT - 1)
+            continue;
+        struct CanFilterSpec *spec = &filter_specs[spec_count++];
+        spec->id = g_can_base_address + offset;
+        spec->mask = CAN_FILTER_EXACT_MASK;
+        spec->fifo = CAN_FIFO_VALUE;
+    }
+
+    /* everything else in the API window is configuration */
+    struct CanFilterSpec *spec = &filter_specs[spec_count++];
+    spec->id = g_can_base_address;
+    spec->mask = SHIFTX3_CAN_FILTER_MASK;
+    spec->fifo = CAN_FIFO_CONFIG;
+
+    CANFilter banks[CAN_FILTER_MAX_BANKS];
+    size_t bank_count = can_filter_build_banks(filter_specs, spec_count,
+                        banks, CAN_FILTER_MAX_BANKS);
+    /* Single CAN part; the CAN2 start bank is ignored by the hardware */
+    canSTM32SetFilters(1, bank_count, banks);
+}
+
 /*
  * Initialize our CAN peripheral
  */
@@ -66,13 +211,10 @@ static void init_can_gpio(void)
     /* CAN TX.       */
     palSetPadMode(GPIOA, 12, PAL_STM32_MODE_ALTERNATE | PAL_STM32_ALTERNATE(4));
 
+    init_can_filters();
+
     /* Activates the CAN driver */
     canStart(&CAND1, _select_can_configuration());
-
-    // Disable CAN filtering for now until we can verify proper operation / settings.
-    // CANFilter shiftx3_can_filter = {1, 0, 1, 0, 0x000E3700, 0x1FFFFF00}; // g_can_base_address, SHIFTX3_CAN_FILTER_MASK
-    //canSTM32SetFilters(1, 1, &shiftx3_can_filter);
-
 }
 
 /*
@@ -93,6 +235,25 @@ void system_can_init(void)
 {
     init_can_operating_parameters();
     init_can_gpio();
+    g_last_message = chVTGetSystemTimeX();
+    g_last_announcement = g_last_message;
+}
+
+static uint32_t _get_api_offset(const CANRxFrame *rx_msg)
+{
+    uint32_t can_id = rx_msg->IDE == CAN_IDE_EXT ? rx_msg->EID : rx_msg->SID;
+    return can_id - g_can_base_address;
+}
+
+/* Look up the handler for a received message; NULL if it is not ours */
+static const struct ApiHandler * _get_api_handler(const CANRxFrame *rx_msg)
+{
+    uint32_t api_offset = _get_api_offset(rx_msg);
+    if (api_offset >= SHIFTX3_CAN_API_RANGE)
+        return NULL;
+
+    const struct ApiHandler *api = &api_handlers[api_handler_index[api_offset]];
+    return api->handler ? api : NULL;
 }
 
 /*
@@ -100,49 +261,18 @@ void system_can_init(void)
  */
 static bool dispatch_can_rx(CANRxFrame *rx_msg)
 {
-    int32_t can_id = rx_msg->IDE == CAN_IDE_EXT ? rx_msg->EID : rx_msg->SID;
-    bool got_config_message = false;
-    switch (can_id - g_can_base_address) {
-    case API_SET_CONFIG_GROUP_1:
-        api_set_config_group_1(rx_msg);
-        got_config_message = true;
-        break;
-    case API_SET_DISCRETE_LED:
-        api_set_discrete_led(rx_msg);
-        break;
-    case API_SET_ALERT_LED:
-        api_set_alert_led(rx_msg);
-        break;
-    case API_SET_ALERT_THRESHOLD:
-        api_set_alert_threshold(rx_msg);
-        got_config_message = true;
-        break;
-    case API_SET_CURRENT_ALERT_VALUE:
-        api_set_current_alert_value(rx_msg);
-        break;
-    case API_CONFIG_LINEAR_GRAPH:
-        api_config_linear_graph(rx_msg);
-        got_config_message = true;
-        break;
-    case API_SET_LINEAR_THRESHOLD:
-        api_set_linear_threshold(rx_msg);
-        got_config_message = true;
-        break;
-    case API_SET_CURRENT_LINEAR_GRAPH_VALUE:
-        api_set_current_linear_graph_value(rx_msg);
-        break;
-    case API_SET_DISPLAY_VALUE:
-        api_set_display_value(rx_msg);
-        break;
-    case API_SET_DISPLAY_SEGMENT:
-        api_set_display_segment(rx_msg);
-        break;
-    default:
+    const struct ApiHandler *api = _get_api_handler(rx_msg);
+    if (!api)
         return false;
+
+    if (rx_msg->DLC >= api->min_dlc) {
+        api->handler(rx_msg);
+    } else {
+        log_info(_LOG_PFX "Invalid param count (%i) for API %i\r\n", rx_msg->DLC, _get_api_offset(rx_msg));
     }
     /* if we received a configuration message then we are provisioned */
-    if (got_config_message)
-        set_api_is_provisioned(got_config_message);
+    if (api->config)
+        set_api_is_provisioned(true);
     return true;
 }
 
@@ -151,43 +281,144 @@ uint32_t get_can_base_id(void)
     return g_can_base_address;
 }
 
-/* Main worker for receiving CAN messages */
-void can_worker(void)
+const struct CanStats * get_can_stats(void)
+{
+    return &g_can_stats;
+}
+
+/*
+ * Render stage: dispatch the messages queued by the CAN receive
+ * service. Handlers run from the frame service, so a burst of
+ * messages is drained from the hardware FIFOs before any rendering.
+ */
+void can_dispatch_queued_rx(void)
 {
-    event_listener_t el;
     CANRxFrame rx_msg;
-    chRegSetThreadName("CAN receiver");
-    chEvtRegister(&CAND1.rxfull_event, &el, 0);
+    while (can_rx_queue_pop(&rx_msg)) {
+        log_CAN_rx_message(_LOG_PFX, &rx_msg);
+        dispatch_can_rx(&rx_msg);
+    }
+}
 
-    chThdSleepMilliseconds(CAN_WORKER_STARTUP_DELAY);
-    log_info(_LOG_PFX "CAN base address: %u\r\n", g_can_base_address);
+/*
+ * The driver reports overruns of either FIFO with the same flag.
+ * We check before draining, so the FIFO that overflowed is still full.
+ */
+static void _count_fifo_overruns(eventflags_t flags)
+{
+    if (!(flags & CAN_OVERFLOW_ERROR))
+        return;
 
-    api_send_announcement();
+    if ((CAND1.can->RF0R & CAN_RF0R_FMP0) == CAN_FIFO_DEPTH)
+        g_can_stats.rx_fifo0_overruns++;
+    if ((CAND1.can->RF1R & CAN_RF1R_FMP1) == CAN_FIFO_DEPTH)
+        g_can_stats.rx_fifo1_overruns++;
+}
 
-    systime_t last_message = chVTGetSystemTimeX();
+/* Fetch the next frame, always preferring the live value FIFO */
+static bool _receive_next(CANRxFrame *rx_msg)
+{
+    return canReceive(&CAND1, CAN_FIFO_MAILBOX(CAN_FIFO_VALUE), rx_msg, TIME_IMMEDIATE) == MSG_OK ||
+           canReceive(&CAND1, CAN_FIFO_MAILBOX(CAN_FIFO_CONFIG), rx_msg, TIME_IMMEDIATE) == MSG_OK;
+}
 
-    while(!chThdShouldTerminateX()) {
-        /* check if we've timed out after we've been active */
-        if (api_is_provisoned() && chVTTimeElapsedSinceX(last_message) > MS2ST(NO_ACTIVITY_TIMEOUT)) {
-            log_info(_LOG_PFX "No activity after %u ms, resetting system\r\n", NO_ACTIVITY_TIMEOUT);
-            reset_system();
-        }
+/*
+ * Relay CAN reception and errors to the scheduler; never returns. The
+ * driver has no callbacks, only events that wake a thread, so this runs
+ * on a thread above the scheduler's priority. It preempts whatever the
+ * scheduler is servicing, so the events are timed from when they arrive.
+ */
+void can_relay_events(void)
+{
+    chRegSetThreadName("CAN events");
+    chEvtRegister(&CAND1.rxfull_event, &g_rx_listener, SCHEDULER_EVENT_CAN_RX);
+    chEvtRegister(&CAND1.error_event, &g_error_listener, SCHEDULER_EVENT_CAN_ERROR);
 
-        if (chEvtWaitAnyTimeout(ALL_EVENTS, MS2ST(1000)) == 0) {
-            /* continue to send announcements until we are provisioned */
-            if (!api_is_provisoned())
-                api_send_announcement();
-            continue;
+    while (true) {
+        eventmask_t events = chEvtWaitAny(ALL_EVENTS);
+        if (events & EVENT_MASK(SCHEDULER_EVENT_CAN_ERROR))
+            scheduler_signal(SCHEDULER_EVENT_CAN_ERROR);
+        if (events & EVENT_MASK(SCHEDULER_EVENT_CAN_RX))
+            scheduler_signal(SCHEDULER_EVENT_CAN_RX);
+    }
+}
+
+void can_service_error(void)
+{
+    _count_fifo_overruns(chEvtGetAndClearFlags(&g_error_listener));
+}
+
+/* Drain the hardware FIFOs, handing our messages to the render stage */
+void can_service_rx(void)
+{
+    CANRxFrame rx_msg;
+    bool queued = false;
+    while (_receive_next(&rx_msg)) {
+        g_can_stats.rx_frames++;
+        if (_get_api_handler(&rx_msg)) {
+            queued |= can_rx_queue_push(&rx_msg);
+            g_last_message = chVTGetSystemTimeX();
+        } else {
+            g_can_stats.rx_rejected++;
         }
-        while (canReceive(&CAND1, CAN_ANY_MAILBOX, &rx_msg, TIME_IMMEDIATE) == MSG_OK) {
-            /* Process message.*/
-            log_CAN_rx_message(_LOG_PFX, &rx_msg);
-            if (dispatch_can_rx(&rx_msg)) {
-                last_message = chVTGetSystemTime();
-            }
+    }
+    if (queued)
+        led_request_refresh();
+}
+
+/* Hand queued frames to whatever transmit mailboxes are free */
+static void _service_tx(void)
+{
+    const CANTxFrame *frame;
+    for (size_t i = 0; i < CAN_TX_MAILBOXES && (frame = can_tx_queue_peek()); i++) {
+        if (canTransmit(&CAND1, CAN_ANY_MAILBOX, frame, TIME_IMMEDIATE) != MSG_OK)
+            break;
+        can_tx_queue_pop();
+    }
+}
+
+/*
+ * Send a frame. The scheduler thread never waits for the bus: the frame
+ * goes straight to a free transmit mailbox if none are queued ahead of
+ * it, and is otherwise queued to go out from the tick as mailboxes free
+ * up. Returns false if the queue was full and the frame was dropped.
+ */
+bool can_transmit(const CANTxFrame *frame)
+{
+    _service_tx();
+    if (!can_tx_queue_peek() && canTransmit(&CAND1, CAN_ANY_MAILBOX, frame, TIME_IMMEDIATE) == MSG_OK)
+        return true;
+    return can_tx_queue_push(frame);
+}
+
+/* Announce until provisioned, reset if the host goes quiet */
+static void _check_activity(void)
+{
+    /* check if we've timed out after we've been active */
+    if (api_is_provisoned()) {
+        if (chVTTimeElapsedSinceX(g_last_message) > MS2ST(NO_ACTIVITY_TIMEOUT)) {
+            log_info(_LOG_PFX "No activity after %u ms, resetting system\r\n", NO_ACTIVITY_TIMEOUT);
+            reset_system();
         }
+        return;
     }
-    chEvtUnregister(&CAND1.rxfull_event, &el);
+
+    /* continue to send announcements until we are provisioned */
+    systime_t interval = g_announcements ? MS2ST(CAN_ANNOUNCEMENT_INTERVAL_MS) : MS2ST(CAN_ANNOUNCEMENT_DELAY_MS);
+    if (chVTTimeElapsedSinceX(g_last_announcement) < interval)
+        return;
+    if (!g_announcements)
+        log_info(_LOG_PFX "CAN base address: %u\r\n", g_can_base_address);
+    api_send_announcement();
+    g_announcements++;
+    g_last_announcement = chVTGetSystemTimeX();
+}
+
+/* Scheduler tick: check host activity and send queued frames */
+void can_service_tick(void)
+{
+    _check_activity();
+    _service_tx();
 }
 
 /* Prepare a CAN message with the specified CAN ID and type */
@@ -25,9 +25,28 @@
 #include "ch.h"
 #include "hal.h"
 
+/* Counters for frames that made it past the hardware filters */
+struct CanStats {
+    uint32_t rx_frames;
+    uint32_t rx_rejected;
+    uint32_t rx_fifo0_overruns;
+    uint32_t rx_fifo1_overruns;
+};
+
 uint32_t get_can_base_id(void);
+uint32_t get_can_bitrate(void);
+const struct CanStats * get_can_stats(void);
 void system_can_init(void);
-void can_worker(void);
+void can_dispatch_queued_rx(void);
+bool can_transmit(const CANTxFrame *frame);
+
+void can_relay_events(void);
+
+/* Scheduler services */
+void can_service_error(void);
+void can_service_rx(void);
+void can_service_tick(void);
+
 void prepare_can_tx_message(CANTxFrame *tx_frame, uint8_t can_id_type, uint32_t can_id);
 
 #endif /* CAN_H_ */
@@ -0,0 +1,107 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "system_CAN_filter.h"
+
+/* bxCAN filter register layout for 32 bit scale: EXID[28:0] | IDE | RTR | 0 */
+#define FILTER_EXID_SHIFT 3
+#define FILTER_IDE 0x04
+#define FILTER_RTR 0x02
+
+#define FILTER_MODE_MASK 0
+#define FILTER_MODE_LIST 1
+#define FILTER_SCALE_32 1
+
+/* Identifier register: extended data frame with the specified ID */
+static uint32_t _id_register(uint32_t can_id)
+{
+    return (can_id << FILTER_EXID_SHIFT) | FILTER_IDE;
+}
+
+/* Mask register: always require IDE set and RTR clear */
+static uint32_t _mask_register(uint32_t mask)
+{
+    return (mask << FILTER_EXID_SHIFT) | FILTER_IDE | FILTER_RTR;
+}
+
+static void _init_bank(CANFilter *bank, size_t index, uint8_t mode, uint8_t fifo,
+                       uint32_t register1, uint32_t register2)
+{
+    bank->filter = index;
+    bank->mode = mode;
+    bank->scale = FILTER_SCALE_32;
+    bank->assignment = fifo;
+    bank->register1 = register1;
+    bank->register2 = register2;
+}
+
+/*
+ * Build the bxCAN filter banks needed to accept the specified IDs.
+ * Specs with a partial mask get a mask mode bank each; exact IDs are
+ * packed two per bank in list mode, pairing only IDs bound for the
+ * same FIFO.
+ *
+ * Returns the number of banks populated. If the specs do not fit in
+ * max_banks, 0 is returned; passing 0 to canSTM32SetFilters() programs
+ * the driver's default accept-all filter, so we fail open.
+ */
+size_t can_filter_build_banks(const struct CanFilterSpec *specs, size_t spec_count,
+                              CANFilter *banks, size_t max_banks)
+{
+    size_t bank_count = 0;
+    size_t i;
+
+    /* Ranges of IDs; one mask mode bank per spec */
+    for (i = 0; i < spec_count; i++) {
+        const struct CanFilterSpec *spec = &specs[i];
+        if ((spec->mask & CAN_FILTER_EXACT_MASK) == CAN_FILTER_EXACT_MASK)
+            continue;
+        if (bank_count >= max_banks || spec->fifo >= CAN_FILTER_FIFO_COUNT)
+            return 0;
+        _init_bank(&banks[bank_count], bank_count, FILTER_MODE_MASK, spec->fifo,
+                   _id_register(spec->id & spec->mask), _mask_register(spec->mask));
+        bank_count++;
+    }
+
+    /* Exact IDs; pair them up into list mode banks per FIFO */
+    CANFilter *pending[CAN_FILTER_FIFO_COUNT] = {NULL};
+    for (i = 0; i < spec_count; i++) {
+        const struct CanFilterSpec *spec = &specs[i];
+        if ((spec->mask & CAN_FILTER_EXACT_MASK) != CAN_FILTER_EXACT_MASK)
+            continue;
+        if (spec->fifo >= CAN_FILTER_FIFO_COUNT)
+            return 0;
+        uint32_t id_register = _id_register(spec->id);
+        if (pending[spec->fifo]) {
+            pending[spec->fifo]->register2 = id_register;
+            pending[spec->fifo] = NULL;
+            continue;
+        }
+        if (bank_count >= max_banks)
+            return 0;
+        /* second slot duplicates the first until a partner shows up */
+        pending[spec->fifo] = &banks[bank_count];
+        _init_bank(&banks[bank_count], bank_count, FILTER_MODE_LIST, spec->fifo,
+                   id_register, id_register);
+        bank_count++;
+    }
+    return bank_count;
+}
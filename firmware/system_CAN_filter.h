@@ -0,0 +1,45 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CAN_FILTER_H_
+#define CAN_FILTER_H_
+#include "ch.h"
+#include "hal.h"
+
+/* Mask that matches every bit of an extended CAN ID */
+#define CAN_FILTER_EXACT_MASK 0x1FFFFFFF
+
+/* bxCAN receive FIFOs; list mode filters win over mask mode filters,
+ * so exact IDs can be steered to a different FIFO than their range */
+#define CAN_FILTER_FIFO_COUNT 2
+
+/* An extended CAN ID (or range of IDs) to accept in hardware */
+struct CanFilterSpec {
+    uint32_t id;
+    uint32_t mask;
+    uint8_t fifo;
+};
+
+size_t can_filter_build_banks(const struct CanFilterSpec *specs, size_t spec_count,
+                              CANFilter *banks, size_t max_banks);
+
+#endif /* CAN_FILTER_H_ */
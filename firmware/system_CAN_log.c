@@ -0,0 +1,134 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "system_CAN_log.h"
+#include "system_CAN.h"
+#include "system_LED.h"
+#include "logging.h"
+#include "shiftx3_api.h"
+#include "settings.h"
+#include <string.h>
+
+/*
+ * Log records are streamed on API_LOG_RECORD, split over as many frames
+ * as they need. The first data byte of each frame holds the record
+ * sequence number in bits 0-3 and the fragment index in bits 4-7; the
+ * rest holds the next CAN_LOG_FRAGMENT_BYTES of the record, in the same
+ * layout written to the serial port. The record's header gives its
+ * length, so the last frame is simply short.
+ *
+ * Frames are spaced to respect both the configured frame rate and the
+ * share of the bus. One record is sent at a time, a frame per slot, from
+ * its own copy; the log worker wakes for each slot rather than sleeping,
+ * so the serial port is drained at its own pace. Records logged while
+ * one is still going out are dropped from CAN and counted.
+ */
+#define CAN_LOG_SEQUENCE_MASK 0x0F
+#define CAN_LOG_FRAGMENT_SHIFT 4
+
+/* Worst case length of an extended frame with 8 data bytes, bit stuffing included */
+#define CAN_LOG_FRAME_BITS 160
+
+/* Minimum ticks between frames; 0 while CAN logging is off */
+static volatile systime_t g_frame_interval;
+static systime_t g_last_frame;
+static uint8_t g_sequence;
+static struct CanLogStats g_can_log_stats;
+
+/* The record going out, and the offset of its next fragment */
+static uint8_t g_record[LOG_RECORD_MAX_BYTES];
+static size_t g_record_length;
+static size_t g_record_offset;
+
+/*
+ * Enable CAN logging, limited to max_frame_rate frames per second and
+ * max_bus_share tenths of a percent of the bus; 0 for either turns it off.
+ */
+void can_log_configure(uint8_t max_frame_rate, uint8_t max_bus_share)
+{
+    if (max_frame_rate == 0 || max_bus_share == 0) {
+        g_frame_interval = 0;
+        return;
+    }
+    systime_t rate_interval = (S2ST(1) + max_frame_rate - 1) / max_frame_rate;
+    uint32_t share_bits_per_s = get_can_bitrate() / 1000 * max_bus_share;
+    systime_t share_interval = (S2ST(1) * CAN_LOG_FRAME_BITS + share_bits_per_s - 1) / share_bits_per_s;
+    g_frame_interval = max(rate_interval, share_interval);
+}
+
+/* Queue a log record for CAN; called from the log thread, sent by can_log_service() */
+void can_log_write_record(const uint32_t *record, size_t words)
+{
+    if (!g_frame_interval)
+        return;
+    if (g_record_offset < g_record_length) {
+        g_can_log_stats.records_dropped++;
+        return;
+    }
+    g_record_length = words * sizeof(uint32_t);
+    g_record_offset = 0;
+    memcpy(g_record, record, g_record_length);
+}
+
+/*
+ * Send the next fragment of the current record if its slot has come;
+ * never blocks. Returns the ticks until the next fragment is due, or
+ * TIME_INFINITE when there is nothing left to send.
+ */
+systime_t can_log_service(void)
+{
+    systime_t interval = g_frame_interval;
+    if (!interval)
+        g_record_length = 0;
+
+    while (g_record_offset < g_record_length) {
+        systime_t elapsed = chVTGetSystemTimeX() - g_last_frame;
+        if (elapsed < interval)
+            return interval - elapsed;
+        g_last_frame = chVTGetSystemTimeX();
+
+        CANTxFrame frame;
+        prepare_can_tx_message(&frame, CAN_IDE_EXT, get_can_base_id() + API_LOG_RECORD);
+        size_t chunk = min(g_record_length - g_record_offset, CAN_LOG_FRAGMENT_BYTES);
+        uint8_t fragment = g_record_offset / CAN_LOG_FRAGMENT_BYTES;
+        frame.data8[0] = (g_sequence & CAN_LOG_SEQUENCE_MASK) | fragment << CAN_LOG_FRAGMENT_SHIFT;
+        memcpy(&frame.data8[1], g_record + g_record_offset, chunk);
+        frame.DLC = chunk + 1;
+        g_record_offset += chunk;
+
+        if (canTransmit(&CAND1, CAN_ANY_MAILBOX, &frame, TIME_IMMEDIATE) == MSG_OK) {
+            g_can_log_stats.frames_sent++;
+        } else {
+            /* the rest of the record can't be reassembled without this frame */
+            g_can_log_stats.frames_failed++;
+            g_record_offset = g_record_length;
+        }
+        if (g_record_offset == g_record_length)
+            g_sequence++;
+    }
+    return TIME_INFINITE;
+}
+
+const struct CanLogStats * get_can_log_stats(void)
+{
+    return &g_can_log_stats;
+}
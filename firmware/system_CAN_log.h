@@ -0,0 +1,44 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CAN_LOG_H_
+#define CAN_LOG_H_
+#include "ch.h"
+#include "hal.h"
+
+/* Record bytes carried per frame, after the sequence / fragment byte */
+#define CAN_LOG_FRAGMENT_BYTES 7
+
+struct CanLogStats {
+    uint32_t frames_sent;
+    /* frames not sent because no transmit mailbox was free */
+    uint32_t frames_failed;
+    /* records not sent because the previous one was still going out */
+    uint32_t records_dropped;
+};
+
+void can_log_configure(uint8_t max_frame_rate, uint8_t max_bus_share);
+void can_log_write_record(const uint32_t *record, size_t words);
+systime_t can_log_service(void);
+const struct CanLogStats * get_can_log_stats(void);
+
+#endif /* CAN_LOG_H_ */
@@ -0,0 +1,127 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "system_CAN_queue.h"
+
+#define CAN_RX_QUEUE_MASK (CAN_RX_QUEUE_SIZE - 1)
+#define CAN_TX_QUEUE_MASK (CAN_TX_QUEUE_SIZE - 1)
+
+/*
+ * Single producer / single consumer ring of received frames.
+ * The CAN receive service is the only writer of head and the frame
+ * service the only writer of tail, so no locking is needed; the indexes run freely
+ * and are masked on access. Aligned 32 bit loads and stores are atomic
+ * on the Cortex-M0, and with a single core and no data cache a compiler
+ * barrier is enough to order the frame copy against the index update.
+ */
+#define compiler_barrier() __asm__ volatile("" ::: "memory")
+
+static CANRxFrame g_rx_queue[CAN_RX_QUEUE_SIZE];
+static volatile uint32_t g_rx_queue_head;
+static volatile uint32_t g_rx_queue_tail;
+static struct CanQueueStats g_rx_queue_stats;
+
+/* Called by the producer only. Returns false if the frame was dropped */
+bool can_rx_queue_push(const CANRxFrame *frame)
+{
+    uint32_t head = g_rx_queue_head;
+    uint32_t depth = head - g_rx_queue_tail;
+    if (depth >= CAN_RX_QUEUE_SIZE) {
+        g_rx_queue_stats.drops++;
+        return false;
+    }
+    g_rx_queue[head & CAN_RX_QUEUE_MASK] = *frame;
+    compiler_barrier();
+    g_rx_queue_head = head + 1;
+
+    if (depth + 1 > g_rx_queue_stats.high_water)
+        g_rx_queue_stats.high_water = depth + 1;
+    return true;
+}
+
+/* Called by the consumer only. Returns false if the queue is empty */
+bool can_rx_queue_pop(CANRxFrame *frame)
+{
+    uint32_t tail = g_rx_queue_tail;
+    if (tail == g_rx_queue_head)
+        return false;
+
+    compiler_barrier();
+    *frame = g_rx_queue[tail & CAN_RX_QUEUE_MASK];
+    compiler_barrier();
+    g_rx_queue_tail = tail + 1;
+    return true;
+}
+
+const struct CanQueueStats * get_can_rx_queue_stats(void)
+{
+    return &g_rx_queue_stats;
+}
+
+/*
+ * Frames waiting to be sent. Only the scheduler thread queues and
+ * sends them, so this ring needs no barriers; a frame stays queued
+ * until a transmit mailbox takes it.
+ */
+static CANTxFrame g_tx_queue[CAN_TX_QUEUE_SIZE];
+static uint32_t g_tx_queue_head;
+static uint32_t g_tx_queue_tail;
+static struct CanQueueStats g_tx_queue_stats;
+
+/* Returns false if the frame was dropped */
+bool can_tx_queue_push(const CANTxFrame *frame)
+{
+    uint32_t depth = g_tx_queue_head - g_tx_queue_tail;
+    if (depth >= CAN_TX_QUEUE_SIZE) {
+        g_tx_queue_stats.drops++;
+        return false;
+    }
+    g_tx_queue[g_tx_queue_head++ & CAN_TX_QUEUE_MASK] = *frame;
+
+    if (depth + 1 > g_tx_queue_stats.high_water)
+        g_tx_queue_stats.high_water = depth + 1;
+    return true;
+}
+
+/* The oldest queued frame, or NULL if there is none */
+const CANTxFrame * can_tx_queue_peek(void)
+{
+    if (g_tx_queue_tail == g_tx_queue_head)
+        return NULL;
+    return &g_tx_queue[g_tx_queue_tail & CAN_TX_QUEUE_MASK];
+}
+
+/* Discard the oldest queued frame, once it has been sent */
+void can_tx_queue_pop(void)
+{
+    if (g_tx_queue_tail != g_tx_queue_head)
+        g_tx_queue_tail++;
+}
+
+size_t can_tx_queue_space(void)
+{
+    return CAN_TX_QUEUE_SIZE - (g_tx_queue_head - g_tx_queue_tail);
+}
+
+const struct CanQueueStats * get_can_tx_queue_stats(void)
+{
+    return &g_tx_queue_stats;
+}
@@ -0,0 +1,50 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CAN_QUEUE_H_
+#define CAN_QUEUE_H_
+#include "ch.h"
+#include "hal.h"
+
+/* Number of frames buffered between reception and rendering;
+ * must be a power of two */
+#define CAN_RX_QUEUE_SIZE 16
+
+struct CanQueueStats {
+    uint32_t high_water;
+    uint32_t drops;
+};
+
+bool can_rx_queue_push(const CANRxFrame *frame);
+bool can_rx_queue_pop(CANRxFrame *frame);
+const struct CanQueueStats * get_can_rx_queue_stats(void);
+
+/* Number of frames waiting for a transmit mailbox; must be a power of two */
+#define CAN_TX_QUEUE_SIZE 8
+
+bool can_tx_queue_push(const CANTxFrame *frame);
+const CANTxFrame * can_tx_queue_peek(void);
+void can_tx_queue_pop(void);
+size_t can_tx_queue_space(void);
+const struct CanQueueStats * get_can_tx_queue_stats(void);
+
+#endif /* CAN_QUEUE_H_ */
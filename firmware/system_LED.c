@@ -20,25 +20,54 @@
  */
 #include "system_LED.h"
 #include "system_SPI.h"
+#include "system_LED_flash.h"
+#include "system_LED_fade.h"
+#include "system_LED_animation.h"
+#include "system_scheduler.h"
 #include "logging.h"
 #include "shiftx3_api.h"
 #include "system_ADC.h"
+#include "system_CAN.h"
+#include <string.h>
 
 #define _LOG_PFX "LED:     "
+#define _LOG_SUBSYSTEM LOG_SUBSYSTEM_LED
 
+#define DEMO_START_DELAY_MS 1000
 #define DEMO_DURATION_MS 30000
 
-/* Brightness averaging buffer */
-#define BRIGHTNESS_AVG_BUFFER 20
-static uint16_t brightness_avg_buffer[BRIGHTNESS_AVG_BUFFER] = {0};
-static size_t brightness_avg_index = 0;
-
 /*
- * LED buffer
+ * LED framebuffers. Renderers compose into the back buffer and the
+ * frame service commits it by swapping it with the front buffer, which
+ * is what the SPI DMA sends. Everything renders on the scheduler
+ * thread, so a frame is never committed partially rendered.
  */
-static uint8_t txbuf[TXBUF_LEN];
+static uint8_t g_framebuffers[2][TXBUF_LEN];
+static uint8_t *g_front_buffer = g_framebuffers[0];
+static uint8_t *g_back_buffer = g_framebuffers[1];
+
+/* Set when the back buffer differs from what was last sent */
+static bool g_frame_dirty = false;
+
+static systime_t g_last_frame;
+static systime_t g_last_push;
+
+/* Brightness applied to lit LEDs, updated every scheduler tick */
+static uint8_t g_brightness = 0;
+
+/* The flash tick only runs while an LED is flashing or fading */
+static bool g_flash_ticking = false;
 
-static void _init_leds(uint8_t default_brightness, uint8_t default_red, uint8_t default_green, uint8_t default_blue)
+enum demo_state {
+    DEMO_WAITING = 0,
+    DEMO_PLAYING,
+    DEMO_DONE
+};
+static enum demo_state g_demo_state = DEMO_WAITING;
+
+static struct LedStats g_led_stats;
+
+static void _init_leds(uint8_t *txbuf, uint8_t default_brightness, uint8_t default_red, uint8_t default_green, uint8_t default_blue)
 {
     size_t i;
     /* initialize start frame */
@@ -58,137 +87,239 @@ static void _init_leds(uint8_t default_brightness, uint8_t default_red, uint8_t
     }
 }
 
+/* Have the frame service render and push a frame */
+void led_request_refresh(void)
+{
+    scheduler_signal(SCHEDULER_EVENT_FRAME);
+}
+
+const struct LedStats * get_led_stats(void)
+{
+    return &g_led_stats;
+}
+
+/*
+ * Make the back buffer the front buffer. Only called while the SPI
+ * is idle, so the old front buffer is free to become the back buffer;
+ * it is brought up to date since renders only touch what changed.
+ */
+static void _commit_frame(void)
+{
+    uint8_t *committed = g_back_buffer;
+    g_back_buffer = g_front_buffer;
+    g_front_buffer = committed;
+    memcpy(g_back_buffer, g_front_buffer, TXBUF_LEN);
+}
+
+static void _write_led(size_t index, uint8_t red, uint8_t green, uint8_t blue)
+{
+    uint8_t *led = &g_back_buffer[APA102_LED_DATA_START + (APA102_BYTES_PER_LED * index)];
+    if (led[1] == blue && led[2] == green && led[3] == red)
+        return;
+    led[1] = blue;
+    led[2] = green;
+    led[3] = red;
+    g_frame_dirty = true;
+}
+
 void set_led(size_t index, uint8_t red, uint8_t green, uint8_t blue)
 {
-    if (index > LED_COUNT)
+    if (index >= LED_COUNT)
+        return;
+    /* an instant change replaces any fade in progress */
+    fade_cancel(index);
+    _write_led(index, red, green, blue);
+}
+
+static void _start_flash_tick(void)
+{
+    if (g_flash_ticking)
         return;
-    txbuf[APA102_LED_DATA_START + (APA102_BYTES_PER_LED * index) + 1] = blue;
-    txbuf[APA102_LED_DATA_START + (APA102_BYTES_PER_LED * index) + 2] = green;
-    txbuf[APA102_LED_DATA_START + (APA102_BYTES_PER_LED * index) + 3] = red;
+    g_flash_ticking = true;
+    scheduler_signal_every(SCHEDULER_EVENT_FLASH, MS2ST(FLASH_TICK_INTERVAL_MS));
+}
+
+/* Flash an LED at a whole number rate; 0 stops it flashing */
+void set_led_flash(size_t index, uint8_t flash_hz)
+{
+    flash_set_hz(index, flash_hz);
+    if (flash_active())
+        _start_flash_tick();
+}
+
+/* Fade an LED from its current color; a time constant of 0 sets it instantly */
+void set_led_fade(size_t index, uint8_t red, uint8_t green, uint8_t blue, uint16_t time_constant_ms)
+{
+    if (index >= LED_COUNT)
+        return;
+    if (time_constant_ms == 0) {
+        set_led(index, red, green, blue);
+        return;
+    }
+    const uint8_t *led = &g_back_buffer[APA102_LED_DATA_START + (APA102_BYTES_PER_LED * index)];
+    uint8_t from[3] = {led[3], led[2], led[1]};
+    uint8_t to[3] = {red, green, blue};
+    fade_start(index, from, to, time_constant_ms);
+    _start_flash_tick();
+}
+
+static void _advance_fades(void)
+{
+    uint32_t changed = fade_advance();
+    size_t i;
+    for (i = 0; changed; i++, changed >>= 1) {
+        if (changed & 1) {
+            uint8_t red, green, blue;
+            fade_get_color(i, &red, &green, &blue);
+            _write_led(i, red, green, blue);
+        }
+    }
 }
 
 void set_led_brightness(size_t index, uint8_t brightness)
 {
-    if (index > LED_COUNT)
+    if (index >= LED_COUNT)
         return;
     brightness = brightness > APA102_MAX_BRIGHTNESS ? APA102_MAX_BRIGHTNESS : brightness;
-    txbuf[APA102_LED_DATA_START + (APA102_BYTES_PER_LED * index)] = APA102_GLOBAL_PREAMBLE + brightness;
+    uint8_t *led = &g_back_buffer[APA102_LED_DATA_START + (APA102_BYTES_PER_LED * index)];
+    if (*led == APA102_GLOBAL_PREAMBLE + brightness)
+        return;
+    *led = APA102_GLOBAL_PREAMBLE + brightness;
+    g_frame_dirty = true;
 }
 
-void led_worker(void)
+void led_init(void)
 {
-    log_info(_LOG_PFX "Starting LED worker\r\n");
-    chRegSetThreadName("LED worker");
+    log_info(_LOG_PFX "Initializing LEDs\r\n");
     spi_init();
-    _init_leds(APA102_DEFAULT_BRIGHTNESS, 0x00, 0x00, 0x00);
-    while(!chThdShouldTerminateX()) {
-        spi_send_buffer(txbuf, sizeof(txbuf));
-        chThdSleepMilliseconds(1);
+    _init_leds(g_front_buffer, APA102_DEFAULT_BRIGHTNESS, 0x00, 0x00, 0x00);
+    _init_leds(g_back_buffer, APA102_DEFAULT_BRIGHTNESS, 0x00, 0x00, 0x00);
+    g_frame_dirty = true;
+    g_last_push = chVTGetSystemTimeX();
+    led_request_refresh();
+}
+
+/* Frame service: render what changed and push the frame to the LEDs */
+void led_service_frame(void)
+{
+    /* cap the refresh rate; updates arriving meanwhile are coalesced */
+    systime_t since_frame = chVTTimeElapsedSinceX(g_last_frame);
+    if (since_frame < MS2ST(LED_FRAME_INTERVAL_MS)) {
+        scheduler_signal_in(SCHEDULER_EVENT_FRAME, MS2ST(LED_FRAME_INTERVAL_MS) - since_frame);
+        return;
+    }
+    g_last_frame = chVTGetSystemTimeX();
+
+    /* render whatever the CAN service received since the last frame */
+    can_dispatch_queued_rx();
+    systime_t render_delay = api_render_pending();
+    systime_t animation_delay = animation_run();
+    render_delay = min(render_delay, animation_delay);
+    bool keepalive = chVTTimeElapsedSinceX(g_last_push) >= MS2ST(LED_KEEPALIVE_INTERVAL_MS);
+    /* hold the frame back until the previous one is out */
+    if ((g_frame_dirty || keepalive) && !spi_is_busy()) {
+        _commit_frame();
+        g_frame_dirty = false;
+        spi_send_buffer(g_front_buffer, TXBUF_LEN);
+        g_last_push = chVTGetSystemTimeX();
+    } else if (g_frame_dirty) {
+        spi_count_busy();
+    } else {
+        g_led_stats.frames_skipped++;
     }
+
+    /* come back when the held back frame can go, the next render or
+     * animation step is due, or it is time for a keep-alive refresh to
+     * recover LEDs that latched a glitch */
+    if (g_frame_dirty)
+        render_delay = MS2ST(LED_FRAME_INTERVAL_MS);
+    scheduler_signal_in(SCHEDULER_EVENT_FRAME, min(render_delay, MS2ST(LED_KEEPALIVE_INTERVAL_MS)));
 }
 
 uint8_t _calculate_auto_brightness(void)
 {
-    uint16_t light_sensor = system_adc_sample();
+    /* the light level is already filtered by the ADC service */
+    uint16_t light_sensor = system_adc_ambient_light();
     uint8_t scaling = get_light_sensor_scaling();
-    uint16_t brightness = light_sensor * scaling / 100;
+    uint32_t brightness = light_sensor * scaling / 100;
     brightness = brightness > APA102_MAX_BRIGHTNESS ? APA102_MAX_BRIGHTNESS : brightness;
     brightness = brightness < APA102_MIN_BRIGHTNESS ? APA102_MIN_BRIGHTNESS : brightness;
 
-    /* update the averaging buffer */
-    brightness_avg_buffer[brightness_avg_index] = brightness;
-    brightness_avg_index = brightness_avg_index >= BRIGHTNESS_AVG_BUFFER - 1 ? 0 : brightness_avg_index + 1;
-
-    /* calculate the average */
-    uint32_t acc = 0;
-    for (size_t i = 0; i < BRIGHTNESS_AVG_BUFFER; i++) {
-            acc += brightness_avg_buffer[i];
-    }
-    brightness = acc / BRIGHTNESS_AVG_BUFFER;
-
     log_trace(_LOG_PFX "Auto brightness: Sensor ADC/scaling/brightness %d/%d/%d\r\n", light_sensor, scaling, brightness);
     return (uint8_t)brightness;
 }
 
-/* Main worker for receiving CAN messages */
-void led_flash_worker(void)
+/* Apply the brightness to lit LEDs, and turn off those in the off part of a flash */
+static void _apply_brightness(void)
 {
-    log_info(_LOG_PFX "Starting flash worker\r\n");
-    chRegSetThreadName("flash worker");
-
-    uint32_t interval = 0;
-    while(!chThdShouldTerminateX()) {
-        uint8_t brightness = get_brightness();
-        if (brightness == 0) {
-            brightness = _calculate_auto_brightness();
-        }
-        size_t i;
-        for (i = 0; i < LED_COUNT; i++) {
-            struct LedFlashConfig * flash_config = get_flash_config(i);
-            uint8_t working_brightness = brightness;
-            uint8_t flash_hz = flash_config->flash_hz;
-            uint8_t current_state = flash_config->current_state;
-            if (flash_hz > 0) {
-                if (interval % (10 / flash_hz) == 0) {
-                    current_state = current_state == 1 ? 0 : 1;
-                    flash_config->current_state = current_state;
-                }
-                working_brightness = current_state ? working_brightness : 0;
-            }
-            set_led_brightness(i, working_brightness);
-        }
-        chThdSleepMilliseconds(100);
-        interval += 1;
+    size_t i;
+    for (i = 0; i < LED_COUNT; i++) {
+        set_led_brightness(i, flash_is_on(i) ? g_brightness : 0);
     }
+    if (g_frame_dirty)
+        led_request_refresh();
 }
 
-static void set_linear_point(size_t index, uint8_t red, uint8_t green, uint8_t blue)
+/* Flash service: advance flash patterns and fades every flash tick */
+void led_service_flash(void)
 {
-    int i;
-    for (i = 0; i < LED_COUNT; i++) {
-        int fade = max(0, (abs(i-index) * 100));
-        set_led(i, max(0, (int)red - fade), max(0, (int)green - fade), max(0, (int)blue - fade));
+    _advance_fades();
+    flash_advance();
+    _apply_brightness();
+
+    /* stop ticking once the last flash or fade has ended; this tick
+     * has already turned back on any LED a flash left off */
+    if (!flash_active() && !fade_active()) {
+        scheduler_signal_in(SCHEDULER_EVENT_FLASH, TIME_INFINITE);
+        g_flash_ticking = false;
     }
 }
 
-static void larson_scan(uint8_t red, uint8_t green, uint8_t blue)
+/*
+ * Play the startup animation for the demo duration, or until we
+ * receive a recognized message
+ */
+static void _service_startup_demo(void)
 {
-    int l;
-    for (l = 0; l < LED_COUNT; l++) {
-        if (api_is_provisoned())
+    systime_t uptime = chVTGetSystemTimeX();
+    switch (g_demo_state) {
+    case DEMO_WAITING:
+        if (uptime < MS2ST(DEMO_START_DELAY_MS))
             return;
-        set_linear_point(l, red, green, blue);
-        if (l < LINEAR_GRAPH_COUNT - 1)
-            chThdSleepMilliseconds(100);
-    }
-    for (l = LED_COUNT - 1; l >= 0; l--) {
-        if (api_is_provisoned())
+        if (!api_is_provisoned())
+            animation_play(ANIMATION_STARTUP);
+        g_demo_state = DEMO_PLAYING;
+        break;
+    case DEMO_PLAYING:
+        if (uptime < MS2ST(DEMO_START_DELAY_MS + DEMO_DURATION_MS) && !api_is_provisoned())
             return;
-        set_linear_point(l, red, green, blue);
-        if (l > 0)
-            chThdSleepMilliseconds(100);
+        /* leave anything the host started playing alone */
+        if (animation_playing() >= ANIMATION_BUILTIN_BASE)
+            animation_stop();
+        int l;
+        for (l = 0; l < LED_COUNT; l++) {
+            set_led(l, 0, 0, 0);
+        }
+        if (g_frame_dirty)
+            led_request_refresh();
+        g_demo_state = DEMO_DONE;
+        break;
+    default:
+        break;
     }
 }
 
-/* Run Larson Scanner for the duration of the timeout, or until we receive a recognized message */
-void startup_light_show(void)
+/* Scheduler tick: follow the light sensor and run the startup demo */
+void led_service_tick(void)
 {
-    chThdSleepMilliseconds(1000);
-
-    systime_t start = chVTGetSystemTimeX();
-    while(chVTTimeElapsedSinceX(start) < MS2ST(DEMO_DURATION_MS) && !api_is_provisoned()) {
-        larson_scan(255, 0, 0);
-        larson_scan(0, 255, 0);
-        larson_scan(0, 0, 255);
+    uint8_t brightness = get_brightness();
+    if (brightness == 0) {
+        brightness = _calculate_auto_brightness();
     }
-    int l;
-    for (l = 0; l < LED_COUNT; l++) {
-        set_led(l, 0, 0, 0);
+    /* applied here too, as the flash tick may not be running */
+    if (brightness != g_brightness) {
+        g_brightness = brightness;
+        _apply_brightness();
     }
-}
-
-/* Worker that runs the startup demo */
-void startup_demo_worker(void)
-{
-    startup_light_show();
+    _service_startup_demo();
 }
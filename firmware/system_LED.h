@@ -52,11 +52,23 @@
 #define TXBUF_LEN APA102_START_FRAME_BYTES + APA102_LED_DATA_BYTES + APA102_END_FRAME_BYTES
 #define APA102_DEFAULT_BRIGHTNESS 0
 
+struct LedStats {
+    /* refreshes where nothing had changed */
+    uint32_t frames_skipped;
+};
+
+void led_request_refresh(void);
+const struct LedStats * get_led_stats(void);
+
 void set_led(size_t index, uint8_t red, uint8_t green, uint8_t blue);
+void set_led_flash(size_t index, uint8_t flash_hz);
+void set_led_fade(size_t index, uint8_t red, uint8_t green, uint8_t blue, uint16_t time_constant_ms);
 void set_led_brightness(size_t index, uint8_t brightness);
 
-void led_worker(void);
-void led_flash_worker(void);
+void led_init(void);
 
-void startup_demo_worker(void);
+/* Scheduler services */
+void led_service_frame(void);
+void led_service_flash(void);
+void led_service_tick(void);
 #endif /* SYSTEM_LED_H_ */
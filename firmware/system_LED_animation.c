@@ -0,0 +1,273 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "system_LED_animation.h"
+#include "system_LED.h"
+
+/* Limits the steps applied in one frame if no step holds */
+#define ANIMATION_STEP_BUDGET ANIMATION_MAX_STEPS
+
+struct AnimationSlot {
+    struct Animation animation;
+    struct AnimationStep steps[ANIMATION_MAX_STEPS];
+};
+
+static struct AnimationSlot g_animation_slots[ANIMATION_SLOTS];
+
+/* Larson scanner, lit LED at center with a two LED falloff on each side */
+#define LARSON_FADE(c, d) ((c) > 100 * (d) ? (c) - 100 * (d) : 0)
+#define LARSON_STEPS(center, r, g, b) { \
+    {0, 0, 0, 0, 0, 0}, \
+    {(center) - 2, 1, LARSON_FADE(r, 2), LARSON_FADE(g, 2), LARSON_FADE(b, 2), 0}, \
+    {(center) - 1, 1, LARSON_FADE(r, 1), LARSON_FADE(g, 1), LARSON_FADE(b, 1), 0}, \
+    {(center), 1, (r), (g), (b), 0}, \
+    {(center) + 1, 1, LARSON_FADE(r, 1), LARSON_FADE(g, 1), LARSON_FADE(b, 1), 0}, \
+    {(center) + 2, 1, LARSON_FADE(r, 2), LARSON_FADE(g, 2), LARSON_FADE(b, 2), 100 / ANIMATION_TICK_MS} \
+}
+#define LARSON_STEP_COUNT 6
+
+static const struct AnimationStep g_larson_red_up[] = LARSON_STEPS(0, 255, 0, 0);
+static const struct AnimationStep g_larson_red_down[] = LARSON_STEPS(LED_COUNT - 1, 255, 0, 0);
+static const struct AnimationStep g_larson_green_up[] = LARSON_STEPS(0, 0, 255, 0);
+static const struct AnimationStep g_larson_green_down[] = LARSON_STEPS(LED_COUNT - 1, 0, 255, 0);
+static const struct AnimationStep g_larson_blue_up[] = LARSON_STEPS(0, 0, 0, 255);
+static const struct AnimationStep g_larson_blue_down[] = LARSON_STEPS(LED_COUNT - 1, 0, 0, 255);
+
+/* Startup light show; scans back and forth in red, green then blue */
+static const struct Animation g_builtin_animations[] = {
+    {g_larson_red_up, LARSON_STEP_COUNT, 0, LED_COUNT, 1, ANIMATION_STARTUP + 1, ANIMATION_NONE, 0},
+    {g_larson_red_down, LARSON_STEP_COUNT, 0, LED_COUNT, -1, ANIMATION_STARTUP + 2, ANIMATION_NONE, 0},
+    {g_larson_green_up, LARSON_STEP_COUNT, 0, LED_COUNT, 1, ANIMATION_STARTUP + 3, ANIMATION_NONE, 0},
+    {g_larson_green_down, LARSON_STEP_COUNT, 0, LED_COUNT, -1, ANIMATION_STARTUP + 4, ANIMATION_NONE, 0},
+    {g_larson_blue_up, LARSON_STEP_COUNT, 0, LED_COUNT, 1, ANIMATION_STARTUP + 5, ANIMATION_NONE, 0},
+    {g_larson_blue_down, LARSON_STEP_COUNT, 0, LED_COUNT, -1, ANIMATION_STARTUP, ANIMATION_NONE, 0},
+};
+#define ANIMATION_BUILTIN_COUNT (sizeof(g_builtin_animations) / sizeof(g_builtin_animations[0]))
+
+/* Playback state; only touched from the scheduler thread */
+static const struct Animation *g_playing;
+static uint8_t g_playing_id = ANIMATION_NONE;
+static uint8_t g_step;
+static uint8_t g_iteration;
+static systime_t g_step_start;
+static systime_t g_hold;
+/* The alert and animation that started playback, if an alert trigger did */
+static uint8_t g_trigger_alert = ANIMATION_NONE;
+static uint8_t g_trigger_id = ANIMATION_NONE;
+
+static bool _is_valid_id(uint8_t id)
+{
+    return id < ANIMATION_SLOTS ||
+           (id >= ANIMATION_BUILTIN_BASE && (size_t)(id - ANIMATION_BUILTIN_BASE) < ANIMATION_BUILTIN_COUNT);
+}
+
+static const struct Animation * _get_animation(uint8_t id)
+{
+    if (id < ANIMATION_SLOTS) {
+        const struct Animation *animation = &g_animation_slots[id].animation;
+        /* not playable until configured */
+        return animation->step_count > 0 ? animation : NULL;
+    }
+    if (_is_valid_id(id))
+        return &g_builtin_animations[id - ANIMATION_BUILTIN_BASE];
+    return NULL;
+}
+
+void animation_init(void)
+{
+    size_t i;
+    for (i = 0; i < ANIMATION_SLOTS; i++) {
+        struct Animation *animation = &g_animation_slots[i].animation;
+        animation->steps = g_animation_slots[i].steps;
+        animation->step_count = 0;
+        animation->next = ANIMATION_NONE;
+        animation->trigger_alert = ANIMATION_NONE;
+    }
+}
+
+bool animation_configure(uint8_t id, uint8_t step_count, uint8_t loop_step, uint8_t repeat, int8_t shift, uint8_t next)
+{
+    if (id >= ANIMATION_SLOTS || step_count == 0 || step_count > ANIMATION_MAX_STEPS ||
+            loop_step >= step_count || (next != ANIMATION_NONE && !_is_valid_id(next)))
+        return false;
+
+    /* the step position of a playing animation may no longer be valid */
+    if (g_playing_id == id)
+        animation_stop();
+
+    struct Animation *animation = &g_animation_slots[id].animation;
+    animation->step_count = step_count;
+    animation->loop_step = loop_step;
+    animation->repeat = repeat;
+    animation->shift = shift;
+    animation->next = next;
+    return true;
+}
+
+bool animation_set_step(uint8_t id, uint8_t step_index, const struct AnimationStep *step)
+{
+    if (id >= ANIMATION_SLOTS || step_index >= ANIMATION_MAX_STEPS)
+        return false;
+    g_animation_slots[id].steps[step_index] = *step;
+    return true;
+}
+
+bool animation_set_trigger(uint8_t id, uint8_t alert_id, uint16_t threshold)
+{
+    if (id >= ANIMATION_SLOTS || (alert_id != ANIMATION_NONE && alert_id >= ALERT_COUNT))
+        return false;
+    struct Animation *animation = &g_animation_slots[id].animation;
+    animation->trigger_alert = alert_id;
+    animation->trigger_threshold = threshold;
+    return true;
+}
+
+static bool _start(uint8_t id)
+{
+    const struct Animation *animation = _get_animation(id);
+    if (!animation)
+        return false;
+    g_playing = animation;
+    g_playing_id = id;
+    g_step = 0;
+    g_iteration = 0;
+    return true;
+}
+
+bool animation_play(uint8_t id)
+{
+    if (!_start(id))
+        return false;
+    g_trigger_alert = ANIMATION_NONE;
+    g_trigger_id = ANIMATION_NONE;
+    g_step_start = chVTGetSystemTimeX();
+    g_hold = 0;
+    led_request_refresh();
+    return true;
+}
+
+void animation_stop(void)
+{
+    g_playing = NULL;
+    g_playing_id = ANIMATION_NONE;
+    g_trigger_alert = ANIMATION_NONE;
+    g_trigger_id = ANIMATION_NONE;
+}
+
+uint8_t animation_playing(void)
+{
+    return g_playing_id;
+}
+
+/*
+ * Start or stop animations bound to an alert. The highest numbered
+ * animation whose threshold the value reaches plays; returns true if a
+ * triggered animation was stopped and the LEDs need to be re-rendered.
+ */
+bool animation_alert_value(uint8_t alert_id, uint16_t value)
+{
+    uint8_t triggered = ANIMATION_NONE;
+    size_t i;
+    for (i = 0; i < ANIMATION_SLOTS; i++) {
+        const struct Animation *animation = &g_animation_slots[i].animation;
+        if (animation->step_count > 0 && animation->trigger_alert == alert_id &&
+                value >= animation->trigger_threshold)
+            triggered = i;
+    }
+
+    if (triggered != ANIMATION_NONE) {
+        if (g_trigger_alert != alert_id || g_trigger_id != triggered) {
+            animation_play(triggered);
+            g_trigger_alert = alert_id;
+            g_trigger_id = triggered;
+        }
+        return false;
+    }
+    if (g_trigger_alert == alert_id) {
+        animation_stop();
+        return true;
+    }
+    return false;
+}
+
+static void _apply_step(const struct AnimationStep *step, int offset)
+{
+    int index = step->led_index + offset;
+    size_t count = step->led_count;
+    if (count == 0) {
+        /* the whole strip, regardless of shift */
+        index = 0;
+        count = LED_COUNT;
+    }
+    size_t i;
+    for (i = 0; i < count; i++, index++) {
+        if (index >= 0)
+            set_led(index, step->red, step->green, step->blue);
+    }
+}
+
+/* Move to the next repeat or the next animation; false if playback ended */
+static bool _end_of_steps(void)
+{
+    g_iteration++;
+    if (g_playing->repeat == 0 || g_iteration < g_playing->repeat) {
+        g_step = g_playing->loop_step;
+        return true;
+    }
+    if (_start(g_playing->next))
+        return true;
+    animation_stop();
+    return false;
+}
+
+/*
+ * Apply the steps that are due. Called every LED frame; returns the time
+ * until the next step is due, or TIME_INFINITE if nothing is playing.
+ */
+systime_t animation_run(void)
+{
+    if (!g_playing)
+        return TIME_INFINITE;
+
+    systime_t elapsed = chVTTimeElapsedSinceX(g_step_start);
+    if (elapsed < g_hold)
+        return g_hold - elapsed;
+
+    /* keep to the animation's timebase unless we've fallen behind it */
+    g_step_start += g_hold;
+    if (elapsed - g_hold > MS2ST(ANIMATION_TICK_MS))
+        g_step_start = chVTGetSystemTimeX();
+
+    size_t i;
+    for (i = 0; i < ANIMATION_STEP_BUDGET; i++) {
+        if (g_step >= g_playing->step_count && !_end_of_steps())
+            return TIME_INFINITE;
+        const struct AnimationStep *step = &g_playing->steps[g_step++];
+        _apply_step(step, g_playing->shift * g_iteration);
+        if (step->hold) {
+            g_hold = MS2ST(step->hold * ANIMATION_TICK_MS);
+            return g_hold;
+        }
+    }
+    g_hold = MS2ST(ANIMATION_TICK_MS);
+    return g_hold;
+}
@@ -0,0 +1,86 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef LED_ANIMATION_H_
+#define LED_ANIMATION_H_
+#include "ch.h"
+#include "hal.h"
+#include "settings.h"
+
+/* Animations uploaded over CAN are held in RAM slots 0 -> ANIMATION_SLOTS - 1 */
+#define ANIMATION_SLOTS 4
+#define ANIMATION_MAX_STEPS 12
+
+/* Built in animations are stored in flash */
+#define ANIMATION_BUILTIN_BASE 0x80
+#define ANIMATION_STARTUP ANIMATION_BUILTIN_BASE
+
+#define ANIMATION_NONE 0xFF
+
+/* Step hold times are in units of ANIMATION_TICK_MS */
+#define ANIMATION_TICK_MS 10
+
+/*
+ * Sets a run of LEDs to a color; a count of 0 sets every LED and is not
+ * moved by the animation's shift. Steps with a hold of 0 are applied
+ * together with the steps that follow them, so a frame is a series
+ * of steps ending with one that holds.
+ */
+struct AnimationStep {
+    int8_t led_index;
+    uint8_t led_count;
+    uint8_t red;
+    uint8_t green;
+    uint8_t blue;
+    uint8_t hold;
+};
+
+/*
+ * After the last step, playback continues at loop_step until the
+ * animation has played repeat times (0 = forever), then moves on to
+ * the next animation. Each repeat moves the steps shift LEDs further.
+ */
+struct Animation {
+    const struct AnimationStep *steps;
+    uint8_t step_count;
+    uint8_t loop_step;
+    uint8_t repeat;
+    int8_t shift;
+    uint8_t next;
+    uint8_t trigger_alert;
+    uint16_t trigger_threshold;
+};
+
+void animation_init(void);
+bool animation_configure(uint8_t id, uint8_t step_count, uint8_t loop_step, uint8_t repeat, int8_t shift, uint8_t next);
+bool animation_set_step(uint8_t id, uint8_t step_index, const struct AnimationStep *step);
+bool animation_set_trigger(uint8_t id, uint8_t alert_id, uint16_t threshold);
+
+/* Playback; called from the scheduler thread */
+bool animation_play(uint8_t id);
+void animation_stop(void);
+uint8_t animation_playing(void);
+bool animation_alert_value(uint8_t alert_id, uint16_t value);
+systime_t animation_run(void);
+
+#endif /* LED_ANIMATION_H_ */
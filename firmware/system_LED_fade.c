@@ -0,0 +1,122 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "system_LED_fade.h"
+#include "system_LED.h"
+
+#define FADE_CHANNELS 3
+
+/* Fractional bits of the fade colors and the per tick fade factor */
+#define FADE_COLOR_BITS 8
+#define FADE_ALPHA_BITS 12
+
+/* Output color of a fade color, rounded to nearest */
+#define FADE_OUTPUT(color) (((color) + (1 << (FADE_COLOR_BITS - 1))) >> FADE_COLOR_BITS)
+
+#if LED_COUNT > 32
+#error "Fade active mask supports at most 32 LEDs"
+#endif
+
+/*
+ * Per LED fade state; colors are in red, green, blue order. Each tick
+ * a fading LED moves alpha of the way from its current color to its
+ * target, an exponential approach with the requested time constant.
+ */
+struct LedFade {
+    uint16_t current[FADE_CHANNELS];
+    uint8_t target[FADE_CHANNELS];
+    uint16_t alpha;
+};
+
+static struct LedFade g_fades[LED_COUNT];
+static uint32_t g_fade_active;
+
+void fade_start(size_t led_index, const uint8_t *from, const uint8_t *to, uint16_t time_constant_ms)
+{
+    if (led_index >= LED_COUNT)
+        return;
+    struct LedFade *fade = &g_fades[led_index];
+    size_t c;
+    for (c = 0; c < FADE_CHANNELS; c++) {
+        /* keep the fractional color of a fade that is being retargeted */
+        if (!(g_fade_active & (1 << led_index)) || FADE_OUTPUT(fade->current[c]) != from[c])
+            fade->current[c] = from[c] << FADE_COLOR_BITS;
+        fade->target[c] = to[c];
+    }
+    /* backward Euler step; stable for any time constant, one divide per fade */
+    uint32_t tick = FLASH_TICK_INTERVAL_MS;
+    fade->alpha = ((tick << FADE_ALPHA_BITS) + (time_constant_ms + tick) / 2) / (time_constant_ms + tick);
+    g_fade_active |= 1 << led_index;
+}
+
+void fade_cancel(size_t led_index)
+{
+    g_fade_active &= ~(1 << led_index);
+}
+
+/* Advance every fading LED by one tick; returns the LEDs whose color changed */
+uint32_t fade_advance(void)
+{
+    uint32_t active = g_fade_active;
+    uint32_t changed = 0;
+    size_t i;
+    for (i = 0; active; i++, active >>= 1) {
+        if (!(active & 1))
+            continue;
+        struct LedFade *fade = &g_fades[i];
+        bool done = true;
+        size_t c;
+        for (c = 0; c < FADE_CHANNELS; c++) {
+            int32_t current = fade->current[c];
+            int32_t diff = (fade->target[c] << FADE_COLOR_BITS) - current;
+            /* round toward zero, so fades down slow as fades up do */
+            int32_t step = diff < 0 ? -((-diff * fade->alpha) >> FADE_ALPHA_BITS) :
+                           (diff * fade->alpha) >> FADE_ALPHA_BITS;
+            /* finish once the approach has slowed to nothing */
+            if (step == 0 || (diff >= -1 && diff <= 1)) {
+                step = diff;
+            } else {
+                done = false;
+            }
+            if (FADE_OUTPUT(current) != FADE_OUTPUT(current + step))
+                changed |= 1 << i;
+            fade->current[c] = current + step;
+        }
+        if (done)
+            g_fade_active &= ~(1 << i);
+    }
+    return changed;
+}
+
+/* True while any LED is fading */
+bool fade_active(void)
+{
+    return g_fade_active != 0;
+}
+
+void fade_get_color(size_t led_index, uint8_t *red, uint8_t *green, uint8_t *blue)
+{
+    const struct LedFade *fade = &g_fades[led_index];
+    *red = FADE_OUTPUT(fade->current[0]);
+    *green = FADE_OUTPUT(fade->current[1]);
+    *blue = FADE_OUTPUT(fade->current[2]);
+}
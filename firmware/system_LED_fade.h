@@ -0,0 +1,36 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#ifndef LED_FADE_H_
+#define LED_FADE_H_
+#include "ch.h"
+#include "hal.h"
+#include "settings.h"
+
+void fade_start(size_t led_index, const uint8_t *from, const uint8_t *to, uint16_t time_constant_ms);
+void fade_cancel(size_t led_index);
+uint32_t fade_advance(void);
+bool fade_active(void);
+void fade_get_color(size_t led_index, uint8_t *red, uint8_t *green, uint8_t *blue);
+
+#endif /* LED_FADE_H_ */
@@ -0,0 +1,106 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "system_LED_flash.h"
+#include "system_LED.h"
+
+#define FLASH_TICK_HZ (1000 / FLASH_TICK_INTERVAL_MS)
+
+/* Phase advance per tick for a rate of 1/FLASH_RATE_SCALE Hz,
+ * where a full period is 2^32 */
+#define FLASH_PHASE_PER_RATE ((uint32_t)((1ULL << 32) / (FLASH_RATE_SCALE * FLASH_TICK_HZ)))
+
+#define FLASH_PHASE_SHIFT 24
+
+#if LED_COUNT > 32
+#error "Flash active mask supports at most 32 LEDs"
+#endif
+
+/*
+ * Per LED phase accumulators. Each LED is on while the top byte of its
+ * phase is below its duty cycle. Phases are aligned to the free running
+ * tick count when a pattern is set, so LEDs flashing at the same rate
+ * stay in step regardless of when they were configured.
+ */
+struct LedFlashState {
+    uint32_t phase;
+    uint32_t increment;
+    uint16_t rate;
+    uint8_t duty;
+    uint8_t phase_offset;
+};
+
+static struct LedFlashState g_flash_state[LED_COUNT];
+static uint32_t g_flash_tick;
+/* LEDs with a nonzero rate */
+static uint32_t g_flash_active;
+
+void flash_set_pattern(size_t led_index, uint16_t rate, uint8_t duty, uint8_t phase_offset)
+{
+    if (led_index >= LED_COUNT)
+        return;
+    /* also keeps the phase increment from overflowing */
+    rate = rate > FLASH_MAX_RATE ? FLASH_MAX_RATE : rate;
+    struct LedFlashState *state = &g_flash_state[led_index];
+    if (state->rate == rate && state->duty == duty && state->phase_offset == phase_offset)
+        return;
+
+    state->rate = rate;
+    state->duty = duty;
+    state->phase_offset = phase_offset;
+    state->increment = rate * FLASH_PHASE_PER_RATE;
+    state->phase = g_flash_tick * state->increment + ((uint32_t)phase_offset << FLASH_PHASE_SHIFT);
+    if (rate) {
+        g_flash_active |= 1 << led_index;
+    } else {
+        g_flash_active &= ~(1 << led_index);
+    }
+}
+
+/* Set a 50% duty cycle flash at a whole number rate, as the CAN API does */
+void flash_set_hz(size_t led_index, uint8_t flash_hz)
+{
+    flash_set_pattern(led_index, flash_hz * FLASH_RATE_SCALE, FLASH_DEFAULT_DUTY, 0);
+}
+
+/* Advance every LED by one tick; called every FLASH_TICK_INTERVAL_MS */
+void flash_advance(void)
+{
+    size_t i;
+    g_flash_tick++;
+    for (i = 0; i < LED_COUNT; i++) {
+        g_flash_state[i].phase += g_flash_state[i].increment;
+    }
+}
+
+/* True while any LED is flashing */
+bool flash_active(void)
+{
+    return g_flash_active != 0;
+}
+
+bool flash_is_on(size_t led_index)
+{
+    const struct LedFlashState *state = &g_flash_state[led_index];
+    if (state->rate == 0)
+        return true;
+    return (state->phase >> FLASH_PHASE_SHIFT) < state->duty;
+}
@@ -0,0 +1,45 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef LED_FLASH_H_
+#define LED_FLASH_H_
+#include "ch.h"
+#include "hal.h"
+#include "settings.h"
+
+/* Flash rates are specified in hundredths of a Hz */
+#define FLASH_RATE_SCALE 100
+
+/* Faster rates are limited to this, as documented for the CAN API */
+#define FLASH_MAX_HZ 25
+#define FLASH_MAX_RATE (FLASH_MAX_HZ * FLASH_RATE_SCALE)
+
+/* Duty cycle and phase offset are fractions of a flash period in 1/256ths */
+#define FLASH_DEFAULT_DUTY 128
+
+void flash_set_pattern(size_t led_index, uint16_t rate, uint8_t duty, uint8_t phase_offset);
+void flash_set_hz(size_t led_index, uint8_t flash_hz);
+void flash_advance(void);
+bool flash_active(void);
+bool flash_is_on(size_t led_index);
+
+#endif /* LED_FLASH_H_ */
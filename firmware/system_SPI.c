@@ -24,43 +24,87 @@
 #include "system_serial.h"
 #include "settings.h"
 #include "system.h"
+#include "system_profiling.h"
 
 #define _LOG_PFX "SYS_SPI:     "
+#define _LOG_SUBSYSTEM LOG_SUBSYSTEM_SYS_SPI
+
+/* APA102 bit clock; see LED_SPI_BR */
+#define LED_SPI_CLOCK (STM32_PCLK >> (LED_SPI_BR + 1))
+
+static void _spi_end_callback(SPIDriver *spip);
 
 /*
- * Low speed SPI configuration (140.625kHz, CPHA=0, CPOL=0, MSb first).
+ * LED SPI configuration (CPHA=1, CPOL=1, MSb first, 8 bit).
  */
-static const SPIConfig ls_spicfg = {
-    NULL,
+static const SPIConfig led_spicfg = {
+    _spi_end_callback,
     GPIOB,
     1,
-    SPI_CR1_BR_2 | SPI_CR1_BR_1 | SPI_CR1_BR_0 | SPI_CR1_CPHA | SPI_CR1_CPOL,
+    (LED_SPI_BR * SPI_CR1_BR_0) | SPI_CR1_CPHA | SPI_CR1_CPOL,
     SPI_CR2_DS_2 | SPI_CR2_DS_1 | SPI_CR2_DS_0
 };
 
-/* Initialize our CAN peripheral */
+/* Set while a DMA transfer is in flight; cleared from the ISR */
+static volatile bool g_spi_busy = false;
+static struct SpiStats g_spi_stats;
+
+static void _spi_end_callback(SPIDriver *spip)
+{
+    (void)spip;
+    profiling_count_irq(PROFILING_IRQ_SPI);
+    g_spi_busy = false;
+}
+
+/* Initialize our SPI peripheral */
 void spi_init(void)
 {
     /* SPI1_SCK       */
     palSetPadMode(GPIOA, 5, PAL_STM32_MODE_ALTERNATE | PAL_STM32_ALTERNATE(0));
-    /* SPI1_MISO      */
+    /* SPI1_MOSI      */
     palSetPadMode(GPIOA, 7, PAL_STM32_MODE_ALTERNATE | PAL_STM32_ALTERNATE(0));
+
+    /* The LEDs are the only device on the bus, so we configure
+     * it once and keep it; no need to acquire or select the slave. */
+    spiStart(&SPID1, &led_spicfg);
+}
+
+/*
+ * Start sending the buffer via DMA and return immediately.
+ * The buffer must not change until the transfer completes.
+ * Returns false if the previous transfer is still in flight.
+ */
+bool spi_send_buffer(const uint8_t *buffer, size_t length)
+{
+    if (g_spi_busy) {
+        g_spi_stats.frames_busy++;
+        return false;
+    }
+    g_spi_busy = true;
+    g_spi_stats.frames_sent++;
+    g_spi_stats.frame_length = length;
+    spiStartSend(&SPID1, length, buffer);
+    return true;
 }
 
+bool spi_is_busy(void)
+{
+    return g_spi_busy;
+}
 
-void spi_send_buffer(uint8_t *buffer, size_t length)
+/* Count a frame held back because the previous one is still in flight */
+void spi_count_busy(void)
 {
-    spiAcquireBus(&SPID1);              /* Acquire ownership of the bus.    */
-    spiStart(&SPID1, &ls_spicfg);       /* Setup transfer parameters.       */
-    /* We do not need to select the slave; it is the only device on the bus.
-     * otherwise we would add spiSelect(&SPID1);
-     */
-    spiSend(&SPID1, length, buffer);    /* Atomic transfer operations.      */
-    /* We do not need to de-select the slave; it is the only device on the bus.
-     * otherwise we would add spiUnselect(&SPID1);
-     */
-    spiReleaseBus(&SPID1);              /* Ownership release.               */
-//    log_info(_LOG_PFX "Broadcasting SPI\r\n");
+    g_spi_stats.frames_busy++;
 }
 
+const struct SpiStats * get_spi_stats(void)
+{
+    return &g_spi_stats;
+}
 
+/* Time on the bus for the last frame sent, derived from the SPI clock */
+uint32_t spi_get_frame_time_us(void)
+{
+    return g_spi_stats.frame_length * 8 * 1000 / (LED_SPI_CLOCK / 1000);
+}
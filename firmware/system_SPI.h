@@ -26,8 +26,19 @@
 #include "hal.h"
 
 
+struct SpiStats {
+    uint32_t frames_sent;
+    /* frames not sent because the previous one was still in flight */
+    uint32_t frames_busy;
+    size_t frame_length;
+};
+
 void spi_init(void);
-void spi_send_buffer(uint8_t *buffer, size_t length);
+bool spi_send_buffer(const uint8_t *buffer, size_t length);
+bool spi_is_busy(void);
+void spi_count_busy(void);
+const struct SpiStats * get_spi_stats(void);
+uint32_t spi_get_frame_time_us(void);
 
 
 #endif /* SYSTEM_SPI_H_ */
@@ -22,6 +22,7 @@
 #include "system_button.h"
 #include "logging.h"
 #define _LOG_PFX "BUTTON:      "
+#define _LOG_SUBSYSTEM LOG_SUBSYSTEM_BUTTON
 #include "system_CAN.h"
 #include "shiftx3_api.h"
 #include "settings.h"
@@ -53,7 +54,7 @@ static void _broadcast_button_state(uint8_t button_id, bool pressed)
     can_stats.data8[0] = pressed;
     can_stats.data8[1] = report_id;
     can_stats.DLC = 2;
-    canTransmit(&CAND1, CAN_ANY_MAILBOX, &can_stats, MS2ST(CAN_TRANSMIT_TIMEOUT));
+    can_transmit(&can_stats);
     log_trace(_LOG_PFX "Broadcast button_states\r\n");
 }
 
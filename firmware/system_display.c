@@ -25,19 +25,26 @@
 #include "ch.h"
 #include "hal.h"
 #include "shiftx3_api.h"
+#include "system_profiling.h"
 
 #define _LOG_PFX "DISPLAY: "
+#define _LOG_SUBSYSTEM LOG_SUBSYSTEM_DISPLAY
 
-#define DISPLAY_DIGITS 1
+#define DISPLAY_DIGITS SETTINGS_DISPLAY_DIGITS
 
-#define DISPLAY_SEGMENT_A_PORT GPIOB
-#define DISPLAY_SEGMENT_B_PORT GPIOB
-#define DISPLAY_SEGMENT_C_PORT GPIOB
-#define DISPLAY_SEGMENT_D_PORT GPIOA
-#define DISPLAY_SEGMENT_E_PORT GPIOB
-#define DISPLAY_SEGMENT_F_PORT GPIOB
-#define DISPLAY_SEGMENT_G_PORT GPIOA
-#define DISPLAY_SEGMENT_DP_PORT GPIOA
+/* Segment pins are on two ports, numbered so their pin masks can be built at compile time */
+#define DISPLAY_PORTS 2
+#define DISPLAY_PORT_A 0
+#define DISPLAY_PORT_B 1
+
+#define DISPLAY_SEGMENT_A_PORT DISPLAY_PORT_B
+#define DISPLAY_SEGMENT_B_PORT DISPLAY_PORT_B
+#define DISPLAY_SEGMENT_C_PORT DISPLAY_PORT_B
+#define DISPLAY_SEGMENT_D_PORT DISPLAY_PORT_A
+#define DISPLAY_SEGMENT_E_PORT DISPLAY_PORT_B
+#define DISPLAY_SEGMENT_F_PORT DISPLAY_PORT_B
+#define DISPLAY_SEGMENT_G_PORT DISPLAY_PORT_A
+#define DISPLAY_SEGMENT_DP_PORT DISPLAY_PORT_A
 
 #define DISPLAY_SEGMENT_A_PIN 6
 #define DISPLAY_SEGMENT_B_PIN 5
@@ -51,32 +58,42 @@
 #define DISPLAY_PWM_CONTROL_PORT GPIOB
 #define DISPLAY_PWM_CONTROL_PIN 0
 #define DISPLAY_MIN_BRIGHTNESS 125
-#define DISPLAY_MAX_BRIGHTNESS 1000
+#define DISPLAY_MAX_BRIGHTNESS (DISPLAY_PWM_PERIOD - DISPLAY_BLANKING_TICKS)
 
-#define DISPLAY_PWM_CLOCK_FREQUENCY 200000
+/* Each digit is lit for one PWM period in turn, at 200Hz per digit */
+#define DISPLAY_PWM_CLOCK_FREQUENCY (200000 * DISPLAY_DIGITS)
 #define DISPLAY_PWM_PERIOD 1000
+#define DISPLAY_PWM_CHANNEL 2
 #define DISPLAY_PWM_SCALING 2
 #define DISPLAY_PWM_OFFSET 125
 #define DISPLAY_PWM_PERCENT_SCALING 35
 
-/* Brightness averaging buffer */
-#define BRIGHTNESS_AVG_BUFFER 20
-static uint16_t brightness_avg_buffer[BRIGHTNESS_AVG_BUFFER] = {0};
-static size_t brightness_avg_index = 0;
+/*
+ * PWM ticks at the end of every period where the display is dark; the
+ * next digit is selected then so it never shows the previous digit's
+ * segments.
+ */
+#define DISPLAY_BLANKING_TICKS 20
+
+/* Relative brightness of each digit in percent, for boards whose digits differ */
+#ifdef SETTINGS_DISPLAY_DIGIT_BRIGHTNESS
+static const uint8_t display_digit_brightness[DISPLAY_DIGITS] = SETTINGS_DISPLAY_DIGIT_BRIGHTNESS;
+#endif
 
+static void _display_refresh_callback(PWMDriver *pwmp);
 
 static PWMConfig pwmcfg = {
-    DISPLAY_PWM_CLOCK_FREQUENCY, /* 200Khz PWM clock frequency*/
+    DISPLAY_PWM_CLOCK_FREQUENCY, /* 200Khz PWM clock frequency per digit */
     DISPLAY_PWM_PERIOD,
     NULL, /* No callback */
     /* Enabled channels */
     {
         {PWM_OUTPUT_ACTIVE_LOW, NULL},
         {PWM_OUTPUT_ACTIVE_LOW, NULL},
-        {PWM_OUTPUT_ACTIVE_LOW, NULL},
+        {PWM_OUTPUT_ACTIVE_LOW, _display_refresh_callback},
         {PWM_OUTPUT_ACTIVE_LOW, NULL}
     },
-    0,
+    TIM_CR2_MMS_1, /* update event paces the light sensor ADC */
     0
 };
 
@@ -85,148 +102,214 @@ struct port_pin {
     uint8_t pin;
 };
 
-#define DISPLAY_SEGMENT_COUNT 7
-#define DISPLAY_SEGMENT_BOTTOM_MAPPING {{DISPLAY_SEGMENT_A_PORT, DISPLAY_SEGMENT_A_PIN}, \
-                           {DISPLAY_SEGMENT_B_PORT, DISPLAY_SEGMENT_B_PIN}, \
-                           {DISPLAY_SEGMENT_C_PORT, DISPLAY_SEGMENT_C_PIN}, \
-                           {DISPLAY_SEGMENT_D_PORT, DISPLAY_SEGMENT_D_PIN}, \
-                           {DISPLAY_SEGMENT_E_PORT, DISPLAY_SEGMENT_E_PIN}, \
-                           {DISPLAY_SEGMENT_F_PORT, DISPLAY_SEGMENT_F_PIN}, \
-                           {DISPLAY_SEGMENT_G_PORT, DISPLAY_SEGMENT_G_PIN}, \
-}
-#define DISPLAY_SEGMENT_TOP_MAPPING {{DISPLAY_SEGMENT_D_PORT, DISPLAY_SEGMENT_D_PIN}, \
-                           {DISPLAY_SEGMENT_E_PORT, DISPLAY_SEGMENT_E_PIN}, \
-                           {DISPLAY_SEGMENT_F_PORT, DISPLAY_SEGMENT_F_PIN}, \
-                           {DISPLAY_SEGMENT_A_PORT, DISPLAY_SEGMENT_A_PIN}, \
-                           {DISPLAY_SEGMENT_B_PORT, DISPLAY_SEGMENT_B_PIN}, \
-                           {DISPLAY_SEGMENT_C_PORT, DISPLAY_SEGMENT_C_PIN}, \
-                           {DISPLAY_SEGMENT_G_PORT, DISPLAY_SEGMENT_G_PIN}, \
-}
+/* A segment's pin in a port's pin mask; 0 if it is on the other port */
+#define SEGMENT_PIN(port, segment) \
+    (DISPLAY_SEGMENT_##segment##_PORT == (port) ? 1U << DISPLAY_SEGMENT_##segment##_PIN : 0U)
+#define SEGMENT_PIN_IF(segments, bit, port, segment) \
+    (((segments) >> (bit)) & 1 ? SEGMENT_PIN(port, segment) : 0U)
 
-static const struct port_pin display_port_mappings[DISPLAY_ORIENTATIONS][DISPLAY_SEGMENT_COUNT] = 
-    {DISPLAY_SEGMENT_BOTTOM_MAPPING, DISPLAY_SEGMENT_TOP_MAPPING};
-
-#define CHARMAP { \
-        {'0',0x7E}, \
-        {'1', 0x30}, \
-        {'2', 0x6D}, \
-        {'3', 0x79}, \
-        {'4', 0x33}, \
-        {'5', 0x5B}, \
-        {'6', 0x5F}, \
-        {'7', 0x70}, \
-        {'8', 0x7F}, \
-        {'9', 0x7B}, \
-        {' ', 0x00}, \
-        {'A', 0x77}, \
-        {'a', 0x7D}, \
-        {'B', 0x7F}, \
-        {'b', 0x1F}, \
-        {'C', 0x4E}, \
-        {'c', 0x0D}, \
-        {'D', 0x7E}, \
-        {'d', 0x3D}, \
-        {'E', 0x4F}, \
-        {'e', 0x6f}, \
-        {'F', 0x47}, \
-        {'f', 0x47}, \
-        {'G', 0x5E}, \
-        {'g', 0x7B}, \
-        {'H', 0x37}, \
-        {'h', 0x17}, \
-        {'I', 0x30}, \
-        {'i', 0x10}, \
-        {'J', 0x3C}, \
-        {'j', 0x38}, \
-        {'K', 0x37}, \
-        {'k', 0x17}, \
-        {'L', 0x0E}, \
-        {'l', 0x06}, \
-        {'M', 0x55}, \
-        {'m', 0x55}, \
-        {'N', 0x15}, \
-        {'n', 0x15}, \
-        {'O', 0x7E}, \
-        {'o', 0x1D}, \
-        {'P', 0x67}, \
-        {'p', 0x67}, \
-        {'Q', 0x73}, \
-        {'q', 0x73}, \
-        {'R', 0x77}, \
-        {'r', 0x05}, \
-        {'S', 0x5B}, \
-        {'s', 0x5B}, \
-        {'T', 0x46}, \
-        {'t', 0x0F}, \
-        {'U', 0x3E}, \
-        {'u', 0x1C}, \
-        {'V', 0x27}, \
-        {'v', 0x23}, \
-        {'W', 0x3F}, \
-        {'w', 0x2B}, \
-        {'X', 0x25}, \
-        {'x', 0x25}, \
-        {'Y', 0x3B}, \
-        {'y', 0x33}, \
-        {'Z', 0x6D}, \
-        {'z', 0x6D}, \
-        {'-', 0x01}, \
-        {'=', 0x41}, \
-        {'_', 0x08}, \
-        {'~', 0x49} \
-}
+/*
+ * Pins lit on a port by a segment mask, with segment A in bit 6 through
+ * segment G in bit 0 and the decimal point in bit 7. Upside down, A and
+ * D, B and E, and C and F trade places.
+ */
+#define SEGMENT_PINS_BOTTOM(segments, port) \
+    (SEGMENT_PIN_IF(segments, 6, port, A) | SEGMENT_PIN_IF(segments, 5, port, B) | \
+     SEGMENT_PIN_IF(segments, 4, port, C) | SEGMENT_PIN_IF(segments, 3, port, D) | \
+     SEGMENT_PIN_IF(segments, 2, port, E) | SEGMENT_PIN_IF(segments, 1, port, F) | \
+     SEGMENT_PIN_IF(segments, 0, port, G) | SEGMENT_PIN_IF(segments, 7, port, DP))
+#define SEGMENT_PINS_TOP(segments, port) \
+    (SEGMENT_PIN_IF(segments, 6, port, D) | SEGMENT_PIN_IF(segments, 5, port, E) | \
+     SEGMENT_PIN_IF(segments, 4, port, F) | SEGMENT_PIN_IF(segments, 3, port, A) | \
+     SEGMENT_PIN_IF(segments, 2, port, B) | SEGMENT_PIN_IF(segments, 1, port, C) | \
+     SEGMENT_PIN_IF(segments, 0, port, G) | SEGMENT_PIN_IF(segments, 7, port, DP))
+
+/* Every display pin on a port */
+#define DISPLAY_PINS(port) SEGMENT_PINS_BOTTOM(0xFF, port)
 
-struct char_segment {
-    char character;
-    uint8_t bitmask;
+/* Pins to light on each port, per orientation */
+struct port_masks {
+    uint16_t port[DISPLAY_PORTS];
+};
+struct display_pins {
+    struct port_masks orientation[DISPLAY_ORIENTATIONS];
 };
 
+#define SEGMENT_PINS(segments) {{ \
+    {{SEGMENT_PINS_BOTTOM(segments, DISPLAY_PORT_A), SEGMENT_PINS_BOTTOM(segments, DISPLAY_PORT_B)}}, \
+    {{SEGMENT_PINS_TOP(segments, DISPLAY_PORT_A), SEGMENT_PINS_TOP(segments, DISPLAY_PORT_B)}} \
+}}
 
-static const struct char_segment character_mappings[] = CHARMAP;
+#if DISPLAY_DIGITS > 1
+/* Digit select pins, driven high to enable a digit, left to right */
+static const struct port_pin display_digit_mappings[DISPLAY_DIGITS] = SETTINGS_DISPLAY_DIGIT_MAPPING;
+#endif
 
-#define CHARMAP_COUNT (sizeof(character_mappings) / sizeof(struct char_segment))
+/*
+ * Glyphs, indexed directly by character, hold the pins their segments
+ * light in each orientation. Characters without a glyph leave the
+ * display unchanged.
+ */
+#define DISPLAY_GLYPH_COUNT 128
+#define GLYPH(segments) {SEGMENT_PINS(segments), true}
+#define GLYPH_DP 0x80
+
+#define GLYPHS { \
+    ['0'] = GLYPH(0x7E), \
+    ['1'] = GLYPH(0x30), \
+    ['2'] = GLYPH(0x6D), \
+    ['3'] = GLYPH(0x79), \
+    ['4'] = GLYPH(0x33), \
+    ['5'] = GLYPH(0x5B), \
+    ['6'] = GLYPH(0x5F), \
+    ['7'] = GLYPH(0x70), \
+    ['8'] = GLYPH(0x7F), \
+    ['9'] = GLYPH(0x7B), \
+    [' '] = GLYPH(0x00), \
+    ['A'] = GLYPH(0x77), \
+    ['a'] = GLYPH(0x7D), \
+    ['B'] = GLYPH(0x7F), \
+    ['b'] = GLYPH(0x1F), \
+    ['C'] = GLYPH(0x4E), \
+    ['c'] = GLYPH(0x0D), \
+    ['D'] = GLYPH(0x7E), \
+    ['d'] = GLYPH(0x3D), \
+    ['E'] = GLYPH(0x4F), \
+    ['e'] = GLYPH(0x6F), \
+    ['F'] = GLYPH(0x47), \
+    ['f'] = GLYPH(0x47), \
+    ['G'] = GLYPH(0x5E), \
+    ['g'] = GLYPH(0x7B), \
+    ['H'] = GLYPH(0x37), \
+    ['h'] = GLYPH(0x17), \
+    ['I'] = GLYPH(0x30), \
+    ['i'] = GLYPH(0x10), \
+    ['J'] = GLYPH(0x3C), \
+    ['j'] = GLYPH(0x38), \
+    ['K'] = GLYPH(0x37), \
+    ['k'] = GLYPH(0x17), \
+    ['L'] = GLYPH(0x0E), \
+    ['l'] = GLYPH(0x06), \
+    ['M'] = GLYPH(0x55), \
+    ['m'] = GLYPH(0x55), \
+    ['N'] = GLYPH(0x15), \
+    ['n'] = GLYPH(0x15), \
+    ['O'] = GLYPH(0x7E), \
+    ['o'] = GLYPH(0x1D), \
+    ['P'] = GLYPH(0x67), \
+    ['p'] = GLYPH(0x67), \
+    ['Q'] = GLYPH(0x73), \
+    ['q'] = GLYPH(0x73), \
+    ['R'] = GLYPH(0x77), \
+    ['r'] = GLYPH(0x05), \
+    ['S'] = GLYPH(0x5B), \
+    ['s'] = GLYPH(0x5B), \
+    ['T'] = GLYPH(0x46), \
+    ['t'] = GLYPH(0x0F), \
+    ['U'] = GLYPH(0x3E), \
+    ['u'] = GLYPH(0x1C), \
+    ['V'] = GLYPH(0x27), \
+    ['v'] = GLYPH(0x23), \
+    ['W'] = GLYPH(0x3F), \
+    ['w'] = GLYPH(0x2B), \
+    ['X'] = GLYPH(0x25), \
+    ['x'] = GLYPH(0x25), \
+    ['Y'] = GLYPH(0x3B), \
+    ['y'] = GLYPH(0x33), \
+    ['Z'] = GLYPH(0x6D), \
+    ['z'] = GLYPH(0x6D), \
+    ['-'] = GLYPH(0x01), \
+    ['='] = GLYPH(0x41), \
+    ['_'] = GLYPH(0x08), \
+    ['~'] = GLYPH(0x49), \
+    ['.'] = GLYPH(GLYPH_DP) \
+}
+
+struct display_glyph {
+    struct display_pins pins;
+    bool defined;
+};
 
-void display_set_segment(const uint8_t digit, const uint8_t segment, const bool enabled)
+static const struct display_glyph display_glyphs[DISPLAY_GLYPH_COUNT] = GLYPHS;
+
+/*
+ * Display framebuffer of the pins lit by each digit. Writers only
+ * update the framebuffer; the refresh interrupt drives the GPIOs.
+ */
+static struct display_pins g_display_pins[DISPLAY_DIGITS];
+/* PWM on-time of each digit */
+static volatile pwmcnt_t g_display_widths[DISPLAY_DIGITS];
+static size_t g_display_current_digit;
+
+/* Light a digit's pins and turn off the rest, with one BSRR write per port */
+static void _write_segments(const struct port_masks *lit)
 {
-    const enum orientation orientation = get_orientation();
-    log_trace(_LOG_PFX "set segment %d: %d %d %d\r\n", digit, segment, enabled, orientation);
-    if (segment >= DISPLAY_SEGMENT_COUNT)
-        return;
+    /* segments are open drain and lit when driven low */
+    palWriteGroup(GPIOA, DISPLAY_PINS(DISPLAY_PORT_A), 0, ~lit->port[DISPLAY_PORT_A]);
+    palWriteGroup(GPIOB, DISPLAY_PINS(DISPLAY_PORT_B), 0, ~lit->port[DISPLAY_PORT_B]);
+}
 
-    const struct port_pin *mapping = &display_port_mappings[orientation][segment];
+/*
+ * Called from the PWM interrupt as each digit's on-time ends, so
+ * digits are switched while the display is dark. The width set here
+ * takes effect from the next period, when the new digit is lit.
+ */
+static void _display_refresh_callback(PWMDriver *pwmp)
+{
+    profiling_count_irq(PROFILING_IRQ_DISPLAY);
+    size_t digit = g_display_current_digit + 1;
+    digit = digit >= DISPLAY_DIGITS ? 0 : digit;
+    g_display_current_digit = digit;
 
-    if (enabled) {
-        palClearPad(mapping->port, mapping->pin);
-    } else {
-        palSetPad(mapping->port, mapping->pin);
+#if DISPLAY_DIGITS > 1
+    /* digits read right to left when the display is upside down */
+    size_t position = get_orientation() == DISPLAY_TOP ? DISPLAY_DIGITS - 1 - digit : digit;
+    for (size_t d = 0; d < DISPLAY_DIGITS; d++) {
+        palWritePad(display_digit_mappings[d].port, display_digit_mappings[d].pin, d == position);
     }
+#endif
+    _write_segments(&g_display_pins[digit].orientation[get_orientation()]);
+    pwmEnableChannelI(pwmp, DISPLAY_PWM_CHANNEL, g_display_widths[digit]);
+}
+
+static void _set_pins(const uint8_t digit, const struct display_pins *pins)
+{
+    if (digit >= DISPLAY_DIGITS)
+        return;
+    /* the refresh interrupt reads the digit's pins */
+    chSysLock();
+    g_display_pins[digit] = *pins;
+    chSysUnlock();
+}
+
+void display_set_segments(const uint8_t digit, const uint8_t segments)
+{
+    const struct display_pins pins = SEGMENT_PINS(segments);
+    _set_pins(digit, &pins);
 }
 
 void display_set_value(const uint8_t digit, const char value)
 {
     log_trace(_LOG_PFX "set value %d: %c\r\n", digit, value);
 
-    for (size_t i = 0; i < CHARMAP_COUNT; i++) {
-        const struct char_segment * mapping = & character_mappings[i];
-        if (mapping->character == value) {
-            uint8_t bitmask = mapping->bitmask;
-            uint8_t segment = DISPLAY_SEGMENT_COUNT;
-            while (segment > 0) {
-                segment--;
-                display_set_segment(digit, segment, bitmask & 0x01);
-                bitmask = bitmask >> 1;
-            }
-            break;
+    /* the high bit adds the decimal point to a character */
+    uint8_t character = (uint8_t)value;
+    const struct display_glyph *glyph = &display_glyphs[character & 0x7F];
+    if (!glyph->defined)
+        return;
+    struct display_pins pins = glyph->pins;
+    if (character & 0x80) {
+        for (size_t o = 0; o < DISPLAY_ORIENTATIONS; o++) {
+            pins.orientation[o].port[DISPLAY_SEGMENT_DP_PORT] |= SEGMENT_PIN(DISPLAY_SEGMENT_DP_PORT, DP);
         }
     }
+    _set_pins(digit, &pins);
 }
 
 static void _clear_display(void)
 {
     for (size_t d = 0; d < DISPLAY_DIGITS; d++) {
-        for (size_t i = 0; i < DISPLAY_SEGMENT_COUNT; i++) {
-            display_set_segment(d, i, false);
-        }
+        display_set_segments(d, 0);
     }
 }
 
@@ -234,15 +317,24 @@ void system_display_init(void)
 {
 
     /* init ports for segments */
-    for (size_t i = 0; i < DISPLAY_SEGMENT_COUNT; i++) {
-        const struct port_pin *mapping = &display_port_mappings[DISPLAY_BOTTOM][i];
-        palSetPadMode(mapping->port, mapping->pin, PAL_MODE_OUTPUT_OPENDRAIN);
+    palSetGroupMode(GPIOA, DISPLAY_PINS(DISPLAY_PORT_A), 0, PAL_MODE_OUTPUT_OPENDRAIN);
+    palSetGroupMode(GPIOB, DISPLAY_PINS(DISPLAY_PORT_B), 0, PAL_MODE_OUTPUT_OPENDRAIN);
+#if DISPLAY_DIGITS > 1
+    for (size_t d = 0; d < DISPLAY_DIGITS; d++) {
+        palClearPad(display_digit_mappings[d].port, display_digit_mappings[d].pin);
+        palSetPadMode(display_digit_mappings[d].port, display_digit_mappings[d].pin, PAL_MODE_OUTPUT_PUSHPULL);
+    }
+#endif
+    _clear_display();
+    for (size_t d = 0; d < DISPLAY_DIGITS; d++) {
+        g_display_widths[d] = DISPLAY_MIN_BRIGHTNESS;
     }
 
-    /* init PWM for display brightness control */
+    /* init PWM for display brightness control; refreshes the digits from the channel interrupt */
     palSetPadMode(DISPLAY_PWM_CONTROL_PORT, DISPLAY_PWM_CONTROL_PIN, PAL_MODE_ALTERNATE(1));
     pwmStart(&PWMD3, &pwmcfg);
-    _clear_display();
+    pwmEnableChannel(&PWMD3, DISPLAY_PWM_CHANNEL, DISPLAY_MIN_BRIGHTNESS);
+    pwmEnableChannelNotification(&PWMD3, DISPLAY_PWM_CHANNEL);
 }
 
 void display_update_brightness(void)
@@ -252,7 +344,8 @@ void display_update_brightness(void)
         brightness = DISPLAY_PWM_OFFSET + (brightness * DISPLAY_PWM_PERCENT_SCALING);
         log_trace(_LOG_PFX "User brightness: %d\r\n", brightness);
     } else {
-        uint16_t light_sensor = system_adc_sample();
+        /* the light level is already filtered by the ADC service */
+        uint16_t light_sensor = system_adc_ambient_light();
         uint8_t user_scaling = get_light_sensor_scaling();
         brightness = DISPLAY_PWM_OFFSET + (light_sensor * user_scaling / DISPLAY_PWM_SCALING);
         log_trace(_LOG_PFX "Auto brightness: Sensor ADC/scaling/brightness %d/%d/%d\r\n", light_sensor, user_scaling, brightness);
@@ -260,16 +353,13 @@ void display_update_brightness(void)
     brightness = brightness > DISPLAY_MAX_BRIGHTNESS ? DISPLAY_MAX_BRIGHTNESS : brightness;
     brightness = brightness < DISPLAY_MIN_BRIGHTNESS ? DISPLAY_MIN_BRIGHTNESS : brightness;
 
-    /* update the averaging buffer */
-    brightness_avg_buffer[brightness_avg_index] = brightness;
-    brightness_avg_index = brightness_avg_index >= BRIGHTNESS_AVG_BUFFER - 1 ? 0 : brightness_avg_index + 1;
-
-    /* calculate the average */
-    uint32_t acc = 0;
-    for (size_t i = 0; i < BRIGHTNESS_AVG_BUFFER; i++) {
-            acc += brightness_avg_buffer[i];
+    /* picked up by the refresh interrupt as each digit is lit */
+    for (size_t d = 0; d < DISPLAY_DIGITS; d++) {
+#ifdef SETTINGS_DISPLAY_DIGIT_BRIGHTNESS
+        uint32_t width = brightness * display_digit_brightness[d] / 100;
+        g_display_widths[d] = width < DISPLAY_MIN_BRIGHTNESS ? DISPLAY_MIN_BRIGHTNESS : width;
+#else
+        g_display_widths[d] = brightness;
+#endif
     }
-    brightness = acc / BRIGHTNESS_AVG_BUFFER;
-
-    pwmEnableChannel(&PWMD3, 2, brightness);
 }
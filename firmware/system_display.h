@@ -28,7 +28,7 @@
 #include <stdlib.h>
 
 void display_set_value(const uint8_t digit, char value);
-void display_set_segment(uint8_t digit, uint8_t segment, bool enabled);
+void display_set_segments(uint8_t digit, uint8_t segments);
 void system_display_init(void);
 void display_update_brightness(void);
 
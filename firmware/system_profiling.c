@@ -0,0 +1,155 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "system_profiling.h"
+
+#if SHIFTX3_PROFILING == TRUE
+
+/*
+ * SysTick is unused in tickless mode, so it free runs from HCLK / 8 as
+ * a cycle counter. Its 24 bits wrap every 2.8s; the scheduler's flash
+ * tick guarantees a context switch far more often than that.
+ */
+#define PROFILING_COUNTER_MASK SysTick_LOAD_RELOAD_Msk
+#define PROFILING_COUNTS_PER_US (STM32_HCLK / 8 / 1000000)
+
+/* Unused stack holds the fill pattern written at startup */
+#define STACK_FILL_WORD 0x55555555
+
+extern uint32_t __main_stack_base__;
+extern uint32_t __main_stack_end__;
+extern uint32_t __process_stack_base__;
+extern uint32_t __process_stack_end__;
+
+volatile uint32_t g_profiling_irqs[PROFILING_IRQS];
+
+/* A profiled thread, if any, and the stack it runs on */
+struct ProfilingContext {
+    thread_t *thread;
+    const uint32_t *stack_base;
+    const uint32_t *stack_end;
+};
+static struct ProfilingContext g_contexts[PROFILING_CONTEXTS];
+
+static uint32_t g_last_switch;
+static uint32_t g_elapsed_cycles;
+static struct ProfilingStats g_profiling_stats;
+
+/* run cycles at the last sample, and those not yet counted as a whole microsecond */
+static uint32_t g_sampled_cycles[PROFILING_THREADS];
+static uint32_t g_remainder_cycles[PROFILING_THREADS];
+static uint32_t g_sampled_elapsed_cycles;
+
+/* Charge the thread being switched out for its time; called with the system locked */
+void profiling_context_switch(thread_t *otp)
+{
+    uint32_t now = SysTick->VAL;
+    /* SysTick counts down */
+    uint32_t cycles = (g_last_switch - now) & PROFILING_COUNTER_MASK;
+    otp->p_run_cycles += cycles;
+    g_elapsed_cycles += cycles;
+    g_last_switch = now;
+}
+
+static void _set_context(enum profiling_context context, thread_t *thread, const void *stack_base, const void *stack_end)
+{
+    g_contexts[context].thread = thread;
+    g_contexts[context].stack_base = stack_base;
+    g_contexts[context].stack_end = stack_end;
+}
+
+/* Profile a thread created from a static working area */
+void profiling_register_thread(enum profiling_context context, thread_t *thread, size_t working_area_size)
+{
+    /* the thread's descriptor sits at the bottom of its working area */
+    _set_context(context, thread, thread + 1, (const uint8_t *)thread + working_area_size);
+}
+
+void profiling_init(void)
+{
+    chSysLock();
+    SysTick->LOAD = PROFILING_COUNTER_MASK;
+    SysTick->VAL = 0;
+    /* CLKSOURCE left clear selects HCLK / 8 */
+    SysTick->CTRL = SysTick_CTRL_ENABLE_Msk;
+    g_last_switch = SysTick->VAL;
+    chSysUnlock();
+
+    _set_context(PROFILING_CONTEXT_MAIN, &ch.mainthread, &__process_stack_base__, &__process_stack_end__);
+    profiling_register_thread(PROFILING_CONTEXT_IDLE, (thread_t *)ch.idle_thread_wa, sizeof(ch.idle_thread_wa));
+    _set_context(PROFILING_CONTEXT_IRQ, NULL, &__main_stack_base__, &__main_stack_end__);
+}
+
+static uint32_t _stack_used(const uint32_t *base, const uint32_t *end)
+{
+    const uint32_t *p = base;
+    while (p < end && *p == STACK_FILL_WORD)
+        p++;
+    return (end - p) * sizeof(uint32_t);
+}
+
+static void _sample_stacks(void)
+{
+    for (size_t i = 0; i < PROFILING_CONTEXTS; i++) {
+        const struct ProfilingContext *context = &g_contexts[i];
+        struct ProfilingStack *stack = &g_profiling_stats.stacks[i];
+        stack->size = (context->stack_end - context->stack_base) * sizeof(uint32_t);
+        stack->used = _stack_used(context->stack_base, context->stack_end);
+    }
+}
+
+static void _sample_run_time(void)
+{
+    uint32_t cycles[PROFILING_THREADS];
+    chSysLock();
+    /* bring the running thread's time up to date */
+    profiling_context_switch(chThdGetSelfX());
+    for (size_t i = 0; i < PROFILING_THREADS; i++) {
+        cycles[i] = g_contexts[i].thread ? g_contexts[i].thread->p_run_cycles : 0;
+    }
+    uint32_t elapsed = g_elapsed_cycles - g_sampled_elapsed_cycles;
+    g_sampled_elapsed_cycles = g_elapsed_cycles;
+    chSysUnlock();
+
+    for (size_t i = 0; i < PROFILING_THREADS; i++) {
+        uint32_t delta = cycles[i] - g_sampled_cycles[i];
+        g_sampled_cycles[i] = cycles[i];
+        uint32_t pending = delta + g_remainder_cycles[i];
+        g_profiling_stats.run_time_us[i] += pending / PROFILING_COUNTS_PER_US;
+        g_remainder_cycles[i] = pending % PROFILING_COUNTS_PER_US;
+
+        if (i == PROFILING_CONTEXT_IDLE && elapsed)
+            g_profiling_stats.cpu_load = 1000 - (uint32_t)((uint64_t)delta * 1000 / elapsed);
+    }
+}
+
+/* Take a profiling sample; CPU load covers the time since the previous one */
+const struct ProfilingStats * profiling_sample(void)
+{
+    _sample_stacks();
+    _sample_run_time();
+    for (size_t i = 0; i < PROFILING_IRQS; i++) {
+        g_profiling_stats.irqs[i] = g_profiling_irqs[i];
+    }
+    return &g_profiling_stats;
+}
+
+#endif /* SHIFTX3_PROFILING */
@@ -0,0 +1,81 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SYSTEM_PROFILING_H_
+#define SYSTEM_PROFILING_H_
+#include "ch.h"
+#include "hal.h"
+
+/* Execution contexts we profile; the interrupt stack has no thread */
+enum profiling_context {
+    PROFILING_CONTEXT_MAIN = 0,
+    PROFILING_CONTEXT_IDLE,
+    PROFILING_CONTEXT_LOG,
+    PROFILING_CONTEXT_CAN,
+    PROFILING_CONTEXT_IRQ,
+    PROFILING_CONTEXTS
+};
+#define PROFILING_THREADS PROFILING_CONTEXT_IRQ
+
+/* Interrupts serviced by firmware callbacks */
+enum profiling_irq {
+    PROFILING_IRQ_TIMER = 0,
+    PROFILING_IRQ_ADC,
+    PROFILING_IRQ_DISPLAY,
+    PROFILING_IRQ_SPI,
+    PROFILING_IRQS
+};
+
+#if SHIFTX3_PROFILING == TRUE
+
+struct ProfilingStack {
+    uint32_t size;
+    /* high water mark */
+    uint32_t used;
+};
+
+struct ProfilingStats {
+    struct ProfilingStack stacks[PROFILING_CONTEXTS];
+    /* free running, in microseconds */
+    uint32_t run_time_us[PROFILING_THREADS];
+    /* over the last sample interval, in tenths of a percent */
+    uint32_t cpu_load;
+    uint32_t irqs[PROFILING_IRQS];
+};
+
+extern volatile uint32_t g_profiling_irqs[PROFILING_IRQS];
+
+#define profiling_count_irq(source) (g_profiling_irqs[(source)]++)
+
+void profiling_init(void);
+void profiling_register_thread(enum profiling_context context, thread_t *thread, size_t working_area_size);
+const struct ProfilingStats * profiling_sample(void);
+
+#else
+
+#define profiling_count_irq(source)
+#define profiling_init()
+#define profiling_register_thread(context, thread, working_area_size) (void)(thread)
+
+#endif /* SHIFTX3_PROFILING */
+
+#endif /* SYSTEM_PROFILING_H_ */
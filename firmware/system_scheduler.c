@@ -0,0 +1,185 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "system_scheduler.h"
+#include "logging.h"
+#include "system_profiling.h"
+#include <stdint.h>
+
+#define _LOG_PFX "SCHED:       "
+#define _LOG_SUBSYSTEM LOG_SUBSYSTEM_SCHED
+
+/*
+ * All of the firmware's work runs on one thread, woken by event flags.
+ * Events are raised by other code, including the thread relaying CAN
+ * driver events, or by a virtual timer per event; each is then handed
+ * to its service function.
+ */
+static thread_t *g_scheduler_thread = NULL;
+
+/* Events raised through the scheduler and not yet serviced, and when */
+static eventmask_t g_raised = 0;
+static systime_t g_raised_at[SCHEDULER_EVENTS];
+
+/* Per event timers; a period of 0 is a one shot */
+static virtual_timer_t g_timers[SCHEDULER_EVENTS];
+static systime_t g_deadlines[SCHEDULER_EVENTS];
+static systime_t g_periods[SCHEDULER_EVENTS];
+
+static struct SchedulerStats g_scheduler_stats[SCHEDULER_EVENTS];
+
+/* Raise an event; the time it was due is kept for the first raise only */
+static void _raise_i(enum scheduler_event event, systime_t due)
+{
+    eventmask_t mask = EVENT_MASK(event);
+    if (!(g_raised & mask)) {
+        g_raised |= mask;
+        g_raised_at[event] = due;
+    }
+    /* raised before the scheduler started; picked up when it does */
+    if (g_scheduler_thread != NULL)
+        chEvtSignalI(g_scheduler_thread, mask);
+}
+
+static void _timer_callback(void *arg)
+{
+    enum scheduler_event event = (enum scheduler_event)(uintptr_t)arg;
+    profiling_count_irq(PROFILING_IRQ_TIMER);
+
+    chSysLockFromISR();
+    _raise_i(event, g_deadlines[event]);
+    systime_t period = g_periods[event];
+    if (period) {
+        /* re-arm from the deadline so periodic events don't drift,
+         * but skip ahead rather than firing back to back after a stall */
+        systime_t now = chVTGetSystemTimeX();
+        g_deadlines[event] += period;
+        systime_t delay = g_deadlines[event] - now;
+        if (delay == 0 || delay > period) {
+            g_deadlines[event] = now + period;
+            delay = period;
+        }
+        chVTSetI(&g_timers[event], delay, _timer_callback, arg);
+    }
+    chSysUnlockFromISR();
+}
+
+static void _arm_i(enum scheduler_event event, systime_t delay, systime_t period)
+{
+    g_periods[event] = period;
+    g_deadlines[event] = chVTGetSystemTimeX() + delay;
+    chVTSetI(&g_timers[event], delay, _timer_callback, (void *)(uintptr_t)event);
+}
+
+void scheduler_init(void)
+{
+    for (size_t i = 0; i < SCHEDULER_EVENTS; i++) {
+        chVTObjectInit(&g_timers[i]);
+    }
+}
+
+/* Raise an event from thread context */
+void scheduler_signal(enum scheduler_event event)
+{
+    chSysLock();
+    _raise_i(event, chVTGetSystemTimeX());
+    chSysUnlock();
+}
+
+/* Raise an event from an interrupt or with the system locked */
+void scheduler_signal_i(enum scheduler_event event)
+{
+    _raise_i(event, chVTGetSystemTimeX());
+}
+
+/*
+ * Raise an event once after a delay, replacing any delay already
+ * pending for it. TIME_INFINITE cancels the pending delay.
+ */
+void scheduler_signal_in(enum scheduler_event event, systime_t delay)
+{
+    if (delay == TIME_IMMEDIATE) {
+        scheduler_signal(event);
+        return;
+    }
+    chSysLock();
+    if (delay == TIME_INFINITE) {
+        if (chVTIsArmedI(&g_timers[event]))
+            chVTResetI(&g_timers[event]);
+    } else {
+        _arm_i(event, delay, 0);
+    }
+    chSysUnlock();
+}
+
+/* Raise an event periodically, first after one interval */
+void scheduler_signal_every(enum scheduler_event event, systime_t interval)
+{
+    chSysLock();
+    _arm_i(event, interval, interval);
+    chSysUnlock();
+}
+
+const struct SchedulerStats * get_scheduler_stats(enum scheduler_event event)
+{
+    return &g_scheduler_stats[event];
+}
+
+static void _update_stats(enum scheduler_event event, systime_t latency, systime_t service)
+{
+    struct SchedulerStats *stats = &g_scheduler_stats[event];
+    stats->serviced++;
+    stats->max_latency = latency > stats->max_latency ? latency : stats->max_latency;
+    stats->max_service = service > stats->max_service ? service : stats->max_service;
+}
+
+/* Run the scheduler on the calling thread; never returns */
+void scheduler_run(const scheduler_service_t services[SCHEDULER_EVENTS])
+{
+    log_info(_LOG_PFX "Starting scheduler\r\n");
+    chRegSetThreadName("scheduler");
+
+    chSysLock();
+    g_scheduler_thread = chThdGetSelfX();
+    chEvtSignalI(g_scheduler_thread, g_raised);
+    chSysUnlock();
+
+    while (true) {
+        eventmask_t events = chEvtWaitAny(ALL_EVENTS);
+
+        /* a copy is taken as events may be raised again while being serviced */
+        systime_t raised_at[SCHEDULER_EVENTS];
+        chSysLock();
+        g_raised &= ~events;
+        for (size_t i = 0; i < SCHEDULER_EVENTS; i++) {
+            raised_at[i] = g_raised_at[i];
+        }
+        chSysUnlock();
+
+        for (size_t i = 0; i < SCHEDULER_EVENTS; i++) {
+            if (!(events & EVENT_MASK(i)))
+                continue;
+            systime_t start = chVTGetSystemTimeX();
+            services[i]();
+            _update_stats(i, start - raised_at[i], chVTGetSystemTimeX() - start);
+        }
+    }
+}
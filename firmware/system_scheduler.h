@@ -0,0 +1,56 @@
+/*
+ * ShiftX3 firmware
+ *
+ * Copyright (C) 2018 Autosport Labs
+ *
+ * This file is part of the Race Capture firmware suite
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with
+ * this code. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SYSTEM_SCHEDULER_H_
+#define SYSTEM_SCHEDULER_H_
+#include "ch.h"
+#include "hal.h"
+
+/* Events the scheduler services; raised together, they are serviced in this order */
+enum scheduler_event {
+    SCHEDULER_EVENT_CAN_ERROR = 0,
+    SCHEDULER_EVENT_CAN_RX,
+    SCHEDULER_EVENT_FLASH,
+    SCHEDULER_EVENT_FRAME,
+    SCHEDULER_EVENT_TICK,
+    SCHEDULER_EVENTS
+};
+
+typedef void (*scheduler_service_t)(void);
+
+struct SchedulerStats {
+    uint32_t serviced;
+    /* longest wait from the event being raised until it was serviced */
+    systime_t max_latency;
+    /* longest time taken servicing the event */
+    systime_t max_service;
+};
+
+void scheduler_init(void);
+void scheduler_run(const scheduler_service_t services[SCHEDULER_EVENTS]);
+void scheduler_signal(enum scheduler_event event);
+void scheduler_signal_i(enum scheduler_event event);
+void scheduler_signal_in(enum scheduler_event event, systime_t delay);
+void scheduler_signal_every(enum scheduler_event event, systime_t interval);
+const struct SchedulerStats * get_scheduler_stats(enum scheduler_event event);
+
+#endif /* SYSTEM_SCHEDULER_H_ */